@@ -27,7 +27,10 @@ class Buffer {
   void clear();
   uint8_t* ptr();
   void writePosition(float x, float y, float z, float rotationZ = 0.0);
+  void writeArc(float viaX, float viaY, float viaZ, float endX, float endY, float endZ);
+  void writeDelta(int16_t dx, int16_t dy, int16_t dz);
   void writeU8(uint8_t v);
+  void writeU16(uint16_t v);
   void writeU32(uint32_t v);
   void writeFloat(float f);
 
@@ -64,6 +67,21 @@ inline void Buffer::writePosition(float x, float y, float z, float rotationZ) {
   writeFloat(rotationZ);
 }
 
+inline void Buffer::writeArc(float viaX, float viaY, float viaZ, float endX, float endY, float endZ) {
+  writeFloat(viaX);
+  writeFloat(viaY);
+  writeFloat(viaZ);
+  writeFloat(endX);
+  writeFloat(endY);
+  writeFloat(endZ);
+}
+
+inline void Buffer::writeDelta(int16_t dx, int16_t dy, int16_t dz) {
+  writeU16((uint16_t)dx);
+  writeU16((uint16_t)dy);
+  writeU16((uint16_t)dz);
+}
+
 inline void Buffer::writeFloat(float f) {
   uint8_t* p = (uint8_t*)&f;
   data.push_back(p[3]);
@@ -76,6 +94,12 @@ inline void Buffer::writeU8(uint8_t v) {
   data.push_back(v);
 }
 
+inline void Buffer::writeU16(uint16_t v) {
+  uint8_t* p = (uint8_t*)&v;
+  data.push_back(p[1]);
+  data.push_back(p[0]);
+}
+
 inline void Buffer::writeU32(uint32_t v) {
   uint8_t* p = (uint8_t*)&v;
   data.push_back(p[3]);
@@ -21,11 +21,20 @@
 #include <tinylib.h>
 #include <rapidxml.hpp>
 #include <kanker/Socket.h>
+#include <kanker/SocketReactor.h>
 #include <kanker/Buffer.h>
 #include <kanker/KankerFont.h>
 #include <kanker/KankerGlyph.h>
+#include <kanker/KankerStrokeOptimizer.h>
+#include <kanker/KankerArcFitter.h>
+#include <kanker/KankerAbbMotionModel.h>
+#include <kanker/KankerAbbPacker.h>
+#include <kanker/KankerAbbPeephole.h>
+#include <kanker/KankerAbbReplyParser.h>
 #include <sstream>
 #include <vector>
+#include <list>
+#include <map>
 #include <fstream>
 #include <stdint.h>
 
@@ -35,9 +44,29 @@ using namespace rapidxml;
 
 #define ABB_CMD_POSITION 0               /* Send a position, command will be x,y,z (floats). */
 #define ABB_CMD_IO 1                     /* We want to toggle an io port, command will be: port-num, on/off. */
+#define ABB_CMD_RESET 2                  /* Resets the number of packets the ABB has drawn, which it sends with ABB_REPLY_PROGRESS. Sent at the start of a message. */
 #define ABB_CMD_DRAW 3                   /* When the robot receives this it will start moving all the received positions / commands. */ 
 #define ABB_CMD_GET_STATE 4              /* Get the state of the ABB. */
 #define ABB_CMD_HOME 5                   /* Move the tcp back to it's original home position. */
+#define ABB_CMD_ARC 6                    /* Move along an arc, command will be via x,y,z and end x,y,z (floats). Executed with MoveC. */
+#define ABB_CMD_ZONE 7                   /* Set the zone for the next moves, command will be the zone radius in mm (u8); 0 is `fine`. */
+#define ABB_CMD_DRAW_BANKED 8            /* Draw the current bank while we send the next one, command will be 1 for the last bank of a message, otherwise 0 (u8). */
+#define ABB_CMD_FRAME 9                  /* Not a real command but the header of a frame, followed by the size of the payload (u16). Everything we send is framed. */
+#define ABB_CMD_POSITION_DELTA 10        /* Send a position relative to the previous position, command will be dx,dy,dz in 1/ABB_DELTA_SCALE mm (int16). Stored as a ABB_CMD_POSITION. */
+
+#define ABB_DELTA_SCALE 10.0f            /* The number of ABB_CMD_POSITION_DELTA units per millimeter. */
+#define ABB_KEYFRAME_INTERVAL 16         /* The default number of delta positions we send before we send an absolute position again. */
+
+#define ABB_FRAME_HEADER_SIZE 3          /* ABB_CMD_FRAME + the size. */
+#define ABB_MAX_FRAME_PAYLOAD 1000       /* RAPID reads a frame into a rawbytes of 1024 bytes, together with the start of a command which didn't fit in the previous frame (at most 24 bytes). */
+
+#define ABB_ZONE_FINE 0                  /* The robot stops in the point. */
+
+#define ABB_WORD_CACHE_SIZE 1024         /* The number of word widths we keep in the KankerAbbWordCache. */
+
+#define ABB_SIMPLIFY_MIN_DIST 0          /* Only remove points that are closer then `min_point_dist` to the previous point. */
+#define ABB_SIMPLIFY_DOUGLAS_PEUCKER 1   /* Ramer-Douglas-Peucker; the simplified segment deviates at most `simplify_tolerance` from the original. */
+#define ABB_SIMPLIFY_VISVALINGAM 2       /* Visvalingam-Whyatt; removes the points with the smallest area first, as long as the deviation stays below `simplify_tolerance`. */
 
 #define ABB_STATE_UNKNOWN -1             /* Default, uninitialized state. */
 #define ABB_STATE_READY 1                /* The ABB is ready to receive commands. */
@@ -55,6 +84,113 @@ class KankerAbbGlyph {
  public:
   KankerGlyph glyph;
   std::vector<std::vector<vec3> > segments;
+  float pen_x;                                                                       /* The pen position at which the glyph was written; the glyph is translated by the pen position + offset. */
+  float pen_y;                                                                       /* The pen position at which the glyph was written. */
+  int word;                                                                          /* Index of the word in the message; used by the stroke optimizer. */
+};
+
+/* ---------------------------------------------------------------------- */
+
+/* 
+   One decoded command that we send to the ABB. Positions are in robot 
+   coordinates. For ABB_CMD_IO, position.x is the port and position.y 
+   the on/off value.
+*/
+class KankerAbbCommand {
+ public:
+  KankerAbbCommand();
+
+ public:
+  uint8_t type;                                                                      /* ABB_CMD_POSITION, ABB_CMD_ARC, ABB_CMD_IO, ABB_CMD_DRAW or ABB_CMD_HOME. */
+  vec3 position;                                                                     /* The position to move to; the end point of an arc. */
+  vec3 via;                                                                          /* The via point of an arc. */
+  float rot_z;                                                                       /* The rotation of joint 6 after a ABB_CMD_POSITION, in degrees. */
+  uint8_t zone;                                                                      /* The zone of a position or arc: ABB_ZONE_FINE or the radius in mm in which the robot blends to the next move. Sent with ABB_CMD_ZONE when it changes. */
+};
+
+/* ---------------------------------------------------------------------- */
+
+/* The state of the pen while we write a message, word by word. */
+class KankerAbbPen {
+ public:
+  KankerAbbPen();
+
+ public:
+  float x;                                                                           /* Where the next glyph is written. */
+  float y;                                                                           /* The baseline of the current line. */
+  float width_available;                                                             /* The width that is left on the current line. */
+  int word;                                                                          /* The number of words written so far. */
+};
+
+/* ---------------------------------------------------------------------- */
+
+/* 
+   A glyph that has been normalized, flipped, aligned, scaled and simplified 
+   for the current settings of the KankerAbb. Only needs to be translated 
+   to the pen position when we write a message.
+*/
+class KankerAbbPreparedGlyph {
+ public:
+  KankerAbbPreparedGlyph();
+
+ public:
+  KankerGlyph glyph;                                                                 /* The glyph with all transformations applied, except the translation. */
+  KankerGlyph simplified;                                                            /* The simplified segments of `glyph`; segments which had no points left are removed. */
+  bool is_prepared;                                                                  /* Is set to true once we've prepared the glyph. */
+};
+
+/* ---------------------------------------------------------------------- */
+
+/* 
+   Cache with the prepared glyphs of one font. The cache is indexed by the
+   index of the glyph in the font. It's cleared automatically when the 
+   font, the x-height of the font, `char_scale` or one of the simplify 
+   settings change.
+*/
+class KankerAbbGlyphCache {
+ public:
+  KankerAbbGlyphCache();
+  void clear();                                                                      /* Removes all prepared glyphs. */
+  bool isValid(KankerFont& font, float xHeight, float charScale, float minPointDist, int simplifyMode, float simplifyTolerance); /* Returns true when the cached glyphs were prepared with the given font and settings. */
+  void reset(KankerFont& font, float xHeight, float charScale, float minPointDist, int simplifyMode, float simplifyTolerance);  /* Clears the cache and stores the font and settings we're going to prepare the glyphs with. */
+  void updateAdvances();                                                             /* Calculates the normalized advances for the glyphs we don't have yet; uses only the metrics so no points are loaded. */
+
+ public:
+  std::vector<KankerAbbPreparedGlyph> glyphs;                                        /* The prepared glyphs, indexed by the glyph index of the font. */
+  std::vector<float> advances;                                                       /* The normalized (not scaled) advance_x of each glyph, indexed by the glyph index of the font. */
+  KankerFont* font;                                                                  /* The font for which we've cached the glyphs. */
+  uint32_t font_revision;                                                            /* The `revision` of the font when we started caching. */
+  float x_height;                                                                    /* The x-height that was used to normalize. */
+  float char_scale;                                                                  /* The char_scale that was used to scale. */
+  float min_point_dist;                                                              /* The min_point_dist that was used to simplify. */
+  int simplify_mode;                                                                 /* The simplify_mode that was used to simplify. */
+  float simplify_tolerance;                                                          /* The simplify_tolerance that was used to simplify. */
+};
+
+/* ---------------------------------------------------------------------- */
+
+/* 
+   Caches the width of words. We store the sum of the normalized advances
+   so a change of `char_scale` doesn't invalidate the cache. When the cache 
+   is full we remove the least recently used word. The cache is cleared when 
+   the font or its x-height change.
+*/
+class KankerAbbWordCache {
+ public:
+  KankerAbbWordCache();
+  void clear();                                                                      /* Removes all words. */
+  bool isValid(KankerFont& font, float xHeight);                                     /* Returns true when the cached widths were measured with the given font. */
+  void reset(KankerFont& font, float xHeight);                                       /* Clears the cache and stores the font we're going to measure with. */
+  bool find(const std::string& word, float& width);                                  /* Returns true and sets `width` when we know the word; the word becomes the most recently used one. */
+  void insert(const std::string& word, float width);                                 /* Adds the word; removes the least recently used word when we have more than `capacity` words. */
+
+ public:
+  std::list<std::pair<std::string, float> > words;                                  /* The words and their widths, most recently used first. */
+  std::map<std::string, std::list<std::pair<std::string, float> >::iterator> lookup; /* Maps a word onto its entry in `words`. */
+  size_t capacity;                                                                   /* The maximum number of words, ABB_WORD_CACHE_SIZE by default. */
+  KankerFont* font;                                                                  /* The font for which we've cached the widths. */
+  uint32_t font_revision;                                                            /* The `revision` of the font when we started caching. */
+  float x_height;                                                                    /* The x-height that was used to normalize. */
 };
 
 /* ---------------------------------------------------------------------- */
@@ -66,18 +202,30 @@ class KankerAbbListener {
   virtual void onAbbConnected() {}                                                   /* Gets called when we're connected to the abb. */
   virtual void onAbbDisconnected() {}                                                /* Gets called when the socket connection with the ABB is lost. The KankerAbb object will try to reconnect so you don't have to call handle reconnecting yourself. */
   virtual void onAbbMessageReady() {}                                                /* Gets called when a complete message has been drawn with the abb. */
+  virtual void onAbbProgress(size_t, size_t) {}                                      /* Gets called while the abb draws a message, with the number of packets that were drawn and the number of packets of the message. */
+  virtual void onAbbError(int) {}                                                    /* Gets called when the abb reports an error, see ABB_ERROR_*. */
 };
 
 /* ---------------------------------------------------------------------- */
 
+int kanker_abb_decode_commands(const uint8_t* data, size_t nbytes, std::vector<KankerAbbCommand>& out); /* Appends the commands in the given bytes, as created by Buffer, to `out`. Returns 0 on success, < 0 on error. */
+int kanker_abb_get_command_size(const uint8_t* data, size_t nbytes);                /* Returns the number of bytes of the command at `data`, or < 0 when it's unknown or there are not enough bytes. */
+int kanker_abb_get_command_packets(uint8_t cmd);                                    /* Returns the number of packets the ABB uses to store the given command. */
+int kanker_abb_count_packets(const uint8_t* data, size_t nbytes);                   /* Returns the number of packets the ABB uses to store the given commands, or < 0 when the data is invalid. */
+int kanker_abb_write_frames(const uint8_t* data, size_t nbytes, Buffer& out);       /* Appends the given commands as frames of at most ABB_MAX_FRAME_PAYLOAD bytes to `out`; a command can be split between two frames. Returns 0 on success, < 0 on error. */
+
+/* ---------------------------------------------------------------------- */
+
 class KankerAbb : public SocketListener {
 
  public:
   KankerAbb();
   ~KankerAbb();
 
-  int connect();                                                                     /* Connects to the robot. The user can call this or use the `auto connect` feature by calling `update()` often. */
-  int update();                                                                      /* This must be called often. It will check the current state and acts upon that. E.g. when writing a message to the robot it will send each character at the correct time (when we received an ready event from the robot). */
+  int connect();                                                                     /* Starts to connect to the robot without blocking; update() finishes the connect. The user can call this or use the `auto connect` feature by calling `update()` often. */
+  int update();                                                                      /* This must be called often. It will check the current state and acts upon that. E.g. when writing a message to the robot it will send each character at the correct time (when we received an ready event from the robot). Doesn't block, so you can call it from a frame loop. */
+  int poll(int timeoutMillis);                                                       /* Sleeps until the Abb sent data or one of our timers is due, but at most `timeoutMillis` (< 0 = no limit), then calls update(). Use this in a loop when you don't have a frame loop. */
+  uint64_t getNextTimeout();                                                         /* Returns the time (rx_hrtime()) when update() needs to check the state, reconnect or give up connecting. */
   void print();                                                                      /* Prints some information about the object. */
 
   int write(KankerFont& font,                                                        /* Write a message using this font. */
@@ -85,22 +233,45 @@ class KankerAbb : public SocketListener {
             std::vector<KankerAbbGlyph>& out,                                        /* We will fill this vector with glyphs that can be passed into `save()`. */
             std::vector<std::vector<vec3> >& segmentsOut);                           /* Contains only the line segments, used to draw. */
 
+  int writeWord(KankerFont& font,                                                    /* Writes one word of a message at the given pen position, wrapping to the next line when necessary; is used by write(). */
+                std::string& word,                                                   /* The word to write. */
+                KankerAbbPen& pen,                                                   /* The pen, is updated. Set `width_available` to getRangeWidth() for the first word. */
+                std::vector<KankerAbbGlyph>& out,                                    /* The glyphs of the word are appended. */
+                std::vector<std::vector<vec3> >& segmentsOut);                       /* The segments of the word are appended. Returns 0 on success, -1 when there is no space left for another line. */
+  int positionGlyph(KankerAbbPreparedGlyph& prepared, float penX, float penY, KankerAbbGlyph& out); /* Sets `out` to the prepared glyph moved to the given pen position + offset. */
   std::vector<vec3> simplify(std::vector<vec3>& in, float minDist);                  /* Simplifies the given points by making sure none of the points in the segment is closer then `minDist`. */
-  float getWordWidth(KankerFont& font, std::string word);                            /* Returns the width of the given word in milimeters. */
+  int simplifySegment(std::vector<vec3>& in, std::vector<vec3>& out);                /* Simplifies the given segment with the current `simplify_mode`, `simplify_tolerance` and `min_point_dist`. */
+  int simplifyDouglasPeucker(std::vector<vec3>& in, float tolerance, float minDist, std::vector<vec3>& out); /* Ramer-Douglas-Peucker; none of the input points is further away then `tolerance` from the result. Points closer then `minDist` are merged when that stays within the tolerance. */
+  int simplifyVisvalingam(std::vector<vec3>& in, float tolerance, float minDist, std::vector<vec3>& out);    /* Visvalingam-Whyatt, limited so none of the input points is further away then `tolerance` from the result. Points closer then `minDist` are merged when that stays within the tolerance. */
+  KankerAbbPreparedGlyph* getPreparedGlyph(KankerFont& font, int charcode);          /* Returns the glyph for the given charcode, prepared for the current settings, or NULL when not found. Make sure to call updateGlyphCache() first. */
+  int updateGlyphCache(KankerFont& font);                                            /* Clears the glyph and word caches when the font or one of the settings they depend on changed. Is called by write() and getWordWidth(). */
+  int getGlyphAdvance(KankerFont& font, int charcode, float& advance);               /* Sets `advance` to the normalized (not scaled) advance of the glyph. Returns 0 on success, < 0 when not found. Make sure to call updateGlyphCache() first. */
+  float getWordWidth(KankerFont& font, const std::string& word);                    /* Returns the width of the given word in milimeters. */
   int saveSettings(std::string filepath);                                            /* Save the current state of the font. */ 
   int loadSettings(std::string filepath);                                            /* Load the current state of the font. */ 
   vec3 convertFontPointToAbbPoint(vec3& v);                                          /* This makes sure that the input position can be used by the robot. */
   float getRangeWidth();                                                             /* Get the available width that can be used by the robot. */
   float getRangeHeight();                                                            /* Get the available height that can be used by the robot. */
   int setAbbListener(KankerAbbListener* lis);                                        /* Set the listener which will receive events from this object. */
-  int sendText(std::vector<KankerAbbGlyph>& glyphs);                                 /* Send a complete text to the Abb. Make sure to call `update()` often because we send each glyph one at a time. */ 
-  int sendNextGlyph();                                                               /* Is called internally when writing a message. This is called by `update()` when you issues a `writeText()` */
+  int sendText(std::vector<KankerAbbGlyph>& glyphs);                                 /* Send a complete text to the Abb. Make sure to call `update()` often because we send the glyphs in batches, one batch per draw. */ 
+  int packMessage(std::vector<KankerAbbGlyph>& message, std::vector<KankerAbbBatch>& out); /* Creates the commands for the message, including the swipe, and packs them into batches. Returns 0 on success, < 0 on error. */
+  int packSegment(std::vector<vec3>& points, size_t glyph);                          /* Adds the commands of a stroke to `packer`; a stroke that doesn't fit in a batch is split. Returns 0 on success, < 0 on error. */
+  int writeSegment(std::vector<vec3>& points);                                       /* Writes the (optimized) commands of a stroke into `buffer`. */
+  int addSegmentCommands(std::vector<vec3>& points, std::vector<KankerAbbCommand>& out); /* Appends the commands to draw the given segment (font coordinates) to `out`; fits arcs when enabled. */
+  int writeCommands(std::vector<KankerAbbCommand>& cmds, Buffer& buf);               /* Serializes the given commands into `buf`. */
+  int estimateMessage(std::vector<KankerAbbGlyph>& message, KankerAbbMotionEstimate& result); /* Estimates how long it takes to write the given message. Returns 0 on success, < 0 on error. */
+  int estimateBatches(std::vector<KankerAbbBatch>& batches, KankerAbbMotionEstimate& result); /* Estimates how long it takes to draw the given packed batches, e.g. `curr_batches`. Returns 0 on success, < 0 on error. */
+  int sendCommands(const uint8_t* data, size_t nbytes);                              /* Frames the given commands and sends them with one call; all data we send to the Abb goes through this function. */
+  int sendNextGlyph();                                                               /* Is called internally when writing a message; sends the next batch of glyphs. This is called by `update()` when you issues a `writeText()` */
   int sendCheckState();                                                              /* Sends the check state command to the Abb; used to get the state but also to detect if the abb is offline. */
   int sendTestPositions();                                                           /* Sends some test positions that shows you the range in which the ABB is moving. */  
   int sendSwipePositions();                                                          /* After writing a text message we want to generate an awesome swipe in the background. This function generates this swipe. */ 
   int addSwipeToBuffer();                                                            /* Fills the buffer with the swipe data. */
+  void handleReply(KankerAbbReply& reply);                                           /* Acts upon a reply of the Abb; is called by update(). */
   void onSocketConnected();                                                          /* Gets called by the `sock` member when we're connected with the Abb. */
   void onSocketDisconnected();                                                       /* Gets called by the `sock` member when we get disconnected. */   
+  void onSocketHighWater(size_t nbytes);                                             /* Gets called by the `sock` member when too much data is queued; we hold back the next batch. */
+  void onSocketDrained();                                                            /* Gets called by the `sock` member when the queue is empty again; we send the batch we held back. */
 
   /* quickfixes */
   void writeAbbPositionWithAngle(float x, float y, float z, float rotationZ = 0.0f); /* Write x (left-right), y (top-bottom), z (depth), rotation. */
@@ -114,6 +285,12 @@ class KankerAbb : public SocketListener {
   float word_spacing;                                                                /* How many space between words? */ 
   float line_height;                                                                 /* Line height for multi line messages (baseline) */
   float min_point_dist;                                                              /* Mininum distance in pixels between two points; used to simplify the font because when points are too close ABB may get into trouble. */
+  int simplify_mode;                                                                 /* How we simplify the segments of the glyphs: ABB_SIMPLIFY_MIN_DIST (default), ABB_SIMPLIFY_DOUGLAS_PEUCKER or ABB_SIMPLIFY_VISVALINGAM. */
+  float simplify_tolerance;                                                          /* The maximum distance in pixels between the original and simplified segment; not used with ABB_SIMPLIFY_MIN_DIST. */
+  int zone_max;                                                                      /* The biggest zone (z1 - z10) used for the points inside a stroke; 0 makes every point `fine`. */
+  bool delta_positions;                                                              /* When true we send the positions as ABB_CMD_POSITION_DELTA when possible: 7 instead of 17 bytes. */
+  int keyframe_interval;                                                             /* The maximum number of delta positions after an absolute position. */
+  bool optimize_commands;                                                            /* When true we remove the redundant commands of a stroke or swipe with `peephole` before we send them. */
   int min_x;                                                                         /* Min X position of the ABB, e.g. -680. X is from left to right. */
   int max_x;                                                                         /* Max X position of the ABB, e.g. 680, X is from left to right. */ 
   int min_y;                                                                         /* Min Y position of the ABB, e.g. -300 (bottom). Y is from top to bottom. */
@@ -121,16 +298,40 @@ class KankerAbb : public SocketListener {
   int abb_port;                                                                      /* The port of ABB to which we connect. */ 
   std::string abb_host;                                                              /* The ip of ABB to which we will send commands. */
   Socket sock;                                                                       /* Socket that we use to connect to the Abb. */
+  SocketReactor reactor;                                                             /* Used by poll() to wait for the socket. */
   Buffer buffer;                                                                     /* Buffer to write binary data that is sent to the Abb */
+  Buffer frame_buffer;                                                               /* The framed data of `buffer` that we send, see sendCommands(). */
   char read_buffer[1024];                                                            /* Buffer that we used to read from the socket. */  
+  KankerAbbReplyParser reply_parser;                                                 /* Splits what we read into replies. */
+  std::vector<KankerAbbReply> replies;                                               /* The replies of the last read. */
   uint64_t check_abb_state_timeout;                                                  /* When we will check the state of the Abb again. */  
   uint64_t check_abb_state_delay;                                                    /* Delay between the checks. */
   uint64_t abb_reconnect_timeout;                                                    /* When we will try to connect again when disconnected from Abb. */
-  uint64_t abb_reconnect_delay;                                                      /* Delay between reconnect checks. */   
+  uint64_t abb_reconnect_delay;                                                      /* Delay between reconnect checks. */
+  uint64_t abb_connect_timeout;                                                      /* When we give up on the connect we started. */
+  uint64_t abb_connect_delay;                                                        /* How long we wait for a connect to finish, in ns; `abb_connect_timeout` in the settings is in ms. */   
   uint8_t abb_state;                                                                 /* Robot state. */       
   KankerAbbListener* abb_listener;                                                   /* The listener that will be called when e.g. a glyph has been draw, connected, disconnected etc.. */ 
   std::vector<KankerAbbGlyph> curr_message;                                          /* Copy of the message that is given ito `sendText()` */
-  size_t curr_glyph_index;                                                           /* When we're writing the curr_message this is the index of the glyph that is sent to the Abb. */
+  size_t curr_glyph_index;                                                           /* When we're writing the curr_message this is the index of the next glyph that will be sent to the Abb. */
+  std::vector<KankerAbbBatch> curr_batches;                                          /* The batches of `curr_message`. */
+  size_t curr_batch_index;                                                           /* The index of the next batch we send. */
+  size_t curr_packets_drawn;                                                         /* The number of packets of the current message the Abb has drawn. */
+  size_t curr_packets_total;                                                         /* The number of packets of the current message. */
+  bool is_batch_deferred;                                                            /* True when we didn't send the next batch because the send queue of `sock` is above its high water mark. */
+  KankerAbbPacker packer;                                                            /* Plans which glyphs we send per draw; set `packer.batch_glyphs` to false to send one glyph per draw. */
+  KankerAbbPeephole peephole;                                                        /* Removes redundant commands, see `optimize_commands`; `peephole.stats` holds the numbers of the last packed message. */
+  KankerAbbMotionModel motion_model;                                                 /* Estimates how long it takes to write a message. */
+  KankerAbbMotionEstimate message_estimate;                                          /* The estimate for `curr_message`. */
+  uint64_t message_start_time;                                                       /* When we started sending `curr_message`; used to add a sample to the motion model when it's ready. */
+  uint64_t swipe_count;                                                              /* Used to alternate the leds of the swipes. */
+  uint64_t swipe_type;                                                               /* The type of the next swipe. */
+  KankerAbbGlyphCache glyph_cache;                                                   /* The glyphs prepared by write() so we don't have to transform and simplify them again. */
+  KankerAbbWordCache word_cache;                                                     /* The widths of the words we've measured with getWordWidth(). */
+  KankerArcFitter arc_fitter;                                                        /* Replaces runs of points that lie on a circle with arcs; set `arc_fitter.tolerance` to 0 to send only lines. */
+  std::vector<KankerArcSpan> arc_spans;                                              /* The spans of the segment that we're sending. */
+  std::vector<KankerAbbCommand> commands;                                            /* The commands of the segment that we're sending. */
+  KankerStrokeOptimizer stroke_optimizer;                                            /* Reorders the strokes of a message to minimize the pen-up travel; see KankerAbbController::writeText(). */
 };
 
 inline float KankerAbb::getRangeWidth() {
@@ -10,6 +10,17 @@
   running on the ABB.  We poll the ABB to check if the state 
   changed. 
 
+  By default everything runs on the thread that calls update(), e.g.
+  the frame loop of the app; a slow frame then delays the next batch
+  we send to the ABB. When you set `use_thread` in the settings, the
+  controller starts an I/O thread that owns `kanker_abb`: writeText()
+  passes the text to this thread over a LockFreeQueue and the listener
+  events come back over a second queue, which update() drains on the
+  thread that calls it. Don't use `kanker_abb` directly in this mode.
+  The I/O thread sleeps in the reactor of `kanker_abb` until the ABB
+  sends something, a timer is due or writeText() wakes it up; poll()
+  sleeps in `event_reactor` until the I/O thread queued an event.
+
 
   Make sure to link with the following libraries:
   ----------------------------------------------
@@ -28,16 +39,61 @@
 
 #include <kanker/KankerFont.h>
 #include <kanker/KankerAbb.h>
+#include <kanker/LockFreeQueue.h>
+#include <kanker/Thread.h>
 #include <rapidxml.hpp>
 
 using namespace rapidxml;
 
+#define KC_COMMAND_QUEUE_SIZE 16                      /* The number of commands we can queue for the I/O thread. */
+#define KC_EVENT_QUEUE_SIZE 256                       /* The number of events we can queue for update(). */
+
+#define KC_COMMAND_NONE 0
+#define KC_COMMAND_WRITE_TEXT 1                       /* Write the `text` of the command. */
+
+#define KC_EVENT_NONE 0
+#define KC_EVENT_READY_TO_DRAW 1
+#define KC_EVENT_DRAWING 2
+#define KC_EVENT_CONNECTED 3
+#define KC_EVENT_DISCONNECTED 4
+#define KC_EVENT_MESSAGE_READY 5
+#define KC_EVENT_PROGRESS 6
+#define KC_EVENT_ERROR 7
+
 /* ----------------------------------------------------------------- */
 
 class KankerAbbControllerSettings {
+ public:
+  KankerAbbControllerSettings();
+
  public:
   std::string font_file;
   std::string settings_file;
+  bool use_thread;                                    /* When true we talk to the ABB on our own I/O thread, see above. Default false. */
+};
+
+/* ----------------------------------------------------------------- */
+
+class KankerAbbControllerCommand {
+ public:
+  KankerAbbControllerCommand();
+
+ public:
+  int type;                                           /* One of the KC_COMMAND_* values. */
+  std::string text;                                   /* The text for KC_COMMAND_WRITE_TEXT. */
+};
+
+/* ----------------------------------------------------------------- */
+
+class KankerAbbControllerEvent {
+ public:
+  KankerAbbControllerEvent();
+
+ public:
+  int type;                                           /* One of the KC_EVENT_* values. */
+  size_t packets_drawn;                               /* For KC_EVENT_PROGRESS. */
+  size_t packets_total;                               /* For KC_EVENT_PROGRESS. */
+  int code;                                           /* For KC_EVENT_ERROR. */
 };
 
 /* ----------------------------------------------------------------- */
@@ -58,22 +114,36 @@ class KankerAbbControllerListener {
 
 /* ----------------------------------------------------------------- */
 
-class KankerAbbController {
+class KankerAbbController : public KankerAbbListener {
 
  public:
   KankerAbbController();
   ~KankerAbbController();
   int init(KankerAbbControllerSettings cfg, KankerAbbListener* listener);                       /* Initialize the controller. */
+  int shutdown();                                                                               /* Stops the I/O thread when we started one; is called by the destructor. */
   int writeText(int64_t id, std::string text);                                                  /* This make sure that the ABB will draw the given text */  
-  void update();                                                                                /* Call this often to make sure that we can read/update the remote state. */
+  int estimateText(std::string text, KankerAbbMotionEstimate& result);                          /* Estimates how long it takes to write the given text, without sending it; e.g. to schedule queued messages. Not available with `use_thread`, because `kanker_abb` is used by the I/O thread. */
+  void update();                                                                                /* Call this often to make sure that we can read/update the remote state. With `use_thread` this calls the listener for the events of the I/O thread. */
+  void poll(int timeoutMillis);                                                                 /* Like update() but sleeps until the ABB sent something or a timer is due, at most `timeoutMillis`; for processes without a frame loop. */
   //void switchState(int st);                                                                     /* Used internally to switch between states based on the ABBs state. */ 
 
-  /* KankerAbbListener */
+  /* KankerAbbListener; we forward the events to `listener`. With `use_thread` these are called on the I/O thread and we queue them for update(). */
   void onAbbReadyToDraw();
   void onAbbDrawing();
   void onAbbConnected();
   void onAbbDisconnected();
   void onAbbMessageReady();
+  void onAbbProgress(size_t packetsDrawn, size_t packetsTotal);
+  void onAbbError(int code);
+
+ private:
+  int processText(std::string& text);                                                           /* Lays out, optimizes and sends the text; runs on the I/O thread with `use_thread`. */
+  void runThread();                                                                             /* The loop of the I/O thread. */
+  void processCommands();                                                                       /* Handles the commands that writeText() queued; I/O thread. */
+  void processEvents();                                                                         /* Calls the listener for the queued events; is called by update(). */
+  void handleEvent(KankerAbbControllerEvent& event);                                            /* Calls dispatchEvent(), or with `use_thread` queues the event for update(). */
+  void dispatchEvent(KankerAbbControllerEvent& event);                                          /* Calls the listener for the event. */
+  static void threadMain(void* user);                                                           /* Entry point of the I/O thread. */
                                                                                                 
  public:                                                                                        
   KankerAbbListener* listener;
@@ -85,40 +155,11 @@ class KankerAbbController {
   int is_init;                                                                                  
   int state;                                                                                    /* The current state of the controller. */
   int64_t last_message_id;                                                                      
+  Thread thread;                                                                                /* The I/O thread, when `settings.use_thread` is set. */
+  LockFreeQueue<KankerAbbControllerCommand> commands;                                           /* From writeText() to the I/O thread. */
+  LockFreeQueue<KankerAbbControllerEvent> events;                                               /* From the I/O thread to update(). */
+  volatile size_t must_stop;                                                                    /* Set to 1 by shutdown() to stop the I/O thread; use thread_atomic_load/store(). */
+  SocketReactor event_reactor;                                                                  /* With `use_thread`, poll() waits on this and handleEvent() wakes it up. */
 }; 
 
-inline void KankerAbbController::onAbbReadyToDraw() {
-
-  if (NULL != listener) {
-    listener->onAbbReadyToDraw();
-  }
-}
-
-inline void KankerAbbController::onAbbDrawing() {
-
-  if (NULL != listener) {
-    listener->onAbbDrawing();
-  }
-}
-
-inline void KankerAbbController::onAbbConnected() {
-
-  if (NULL != listener) {
-    listener->onAbbConnected();
-  }
-}
-
-inline void KankerAbbController::onAbbDisconnected() {
-
-  if (NULL != listener) {
-    listener->onAbbDisconnected();
-  }
-}
-
-inline void KankerAbbController::onAbbMessageReady() {
-  if (NULL != listener) {
-    listener->onAbbMessageReady();
-  }
-}
-
 #endif
@@ -0,0 +1,117 @@
+/*
+
+  KankerAbbMotionModel
+  --------------------
+
+  Estimates how long the ABB needs to execute a list of commands, so
+  we know how long a message will take before we send it. We simulate
+  what FreeWriting.mod does with the packets:
+
+     - ABB_CMD_POSITION   `MoveL`: the robot accelerates, moves at most
+                          `tcp_speed` and stops in a `fine` point. Moves
+                          with a zone are blended into the next move, so
+                          we treat a run of them as one move. When rot_z
+                          is set, joint 6 is rotated with a `MoveAbsJ`
+                          after the move.
+     - ABB_CMD_ARC        `MoveC`, along the arc.
+     - ABB_CMD_IO         `SetDO`.
+     - ABB_CMD_DRAW       The robot executes the packets and tells us it's
+                          ready; this costs a network round trip.
+     - ABB_CMD_DRAW_BANKED
+                          The robot draws a bank while we upload the next
+                          one; only the last bank of a message costs a
+                          round trip.
+     - ABB_CMD_HOME       `MoveAbsJ` to the home joints + `MoveJ`.
+
+  The defaults for the speeds are the `speeddata [700,500,500,15]` of
+  FreeWriting.mod. The acceleration, the time to settle in a fine point
+  and the other costs are not documented, so we can calibrate them:
+  add the estimate and the measured time of a message with addSample()
+  and call calibrate(). This fits the `motion_scale`, `stop_time`,
+  `io_time`, `draw_time` and `home_time` with least squares. KankerAbb
+  adds a sample for every message it writes and calls calibrate() when
+  needsCalibration() returns true, i.e. after `calibrate_interval` new
+  samples.
+
+ */
+#ifndef KANKER_ABB_MOTION_MODEL_H
+#define KANKER_ABB_MOTION_MODEL_H
+
+#include <stdint.h>
+#include <vector>
+
+#define ROXLU_USE_MATH
+#define ROXLU_USE_LOG
+#include <tinylib.h>
+
+#define ABB_MOTION_NUM_FEATURES 5                          /* The number of values we fit when calibrating. */
+#define ABB_MOTION_MAX_SAMPLES 256                         /* The number of measured messages we keep for calibrating. */
+
+class KankerAbbCommand;
+
+/* ---------------------------------------------------------------------- */
+
+class KankerAbbMotionEstimate {
+ public:
+  KankerAbbMotionEstimate();
+  void clear();                                            /* Resets all counters to zero. */
+
+ public:
+  double motion_time;                                      /* The time we spend moving, in seconds; from the speeds and accelerations. */
+  double distance;                                         /* The distance the tcp travels, in millimeters. */
+  uint32_t num_stops;                                      /* The number of times the robot stops in a fine point. */
+  uint32_t num_io;                                         /* The number of I/O changes. */
+  uint32_t num_draws;                                      /* The number of draw commands. */
+  uint32_t num_homes;                                      /* The number of times we move home. */
+  double seconds;                                          /* The estimated total time, set by KankerAbbMotionModel::finish(). */
+};
+
+/* ---------------------------------------------------------------------- */
+
+class KankerAbbMotionSample {
+ public:
+  KankerAbbMotionSample();
+
+ public:
+  KankerAbbMotionEstimate estimate;                        /* What we estimated. */
+  double measured;                                         /* How long it really took, in seconds. */
+};
+
+/* ---------------------------------------------------------------------- */
+
+class KankerAbbMotionModel {
+ public:
+  KankerAbbMotionModel();
+  void reset();                                            /* Starts a new simulation with the tcp at the home position. */
+  int add(std::vector<KankerAbbCommand>& cmds, KankerAbbMotionEstimate& result); /* Simulates the given commands and adds them to `result`. */
+  void finish(KankerAbbMotionEstimate& result);            /* Finishes the last move and calculates `result.seconds`. */
+  double getMoveTime(double dist, double speed, double accel); /* The time it takes to move `dist` with a trapezoidal speed profile. */
+  void stop(KankerAbbMotionEstimate& result);              /* Ends the current run of blended moves; the robot stops. */
+  int addSample(KankerAbbMotionEstimate& estimate, double measured); /* Stores a measured run which is used by calibrate(). */
+  int calibrate();                                         /* Fits the costs to the samples. Returns 0 on success, < 0 when we couldn't fit (the costs are not changed). */
+  bool needsCalibration();                                 /* Returns true when we added `calibrate_interval` samples since the last calibrate(). */
+
+ public:
+  float tcp_speed;                                         /* The maximum speed of the tcp in mm/s (v_tcp of the speeddata). */
+  float tcp_accel;                                         /* The acceleration of the tcp in mm/s^2. */
+  float ori_speed;                                         /* The maximum speed of a reorientation in degrees/s (v_ori of the speeddata). */
+  float ori_accel;                                         /* The acceleration of a reorientation in degrees/s^2. */
+  float motion_scale;                                      /* The motion time is multiplied by this; calibrated. */
+  float stop_time;                                         /* The time it takes to settle in a fine point; calibrated. */
+  float io_time;                                           /* The time a SetDO takes; calibrated. */
+  float draw_time;                                         /* The time between a draw command and the next glyph, without the moves; calibrated. */
+  float home_time;                                         /* The time it takes to move home; calibrated. */
+  vec3 position;                                           /* The simulated tcp position, in robot coordinates. */
+  double run_distance;                                     /* The distance of the moves since the robot stopped. */
+  std::vector<KankerAbbMotionSample> samples;              /* The measured runs. */
+  int calibrate_interval;                                  /* The number of new samples after which needsCalibration() returns true; 0 disables the automatic calibration. */
+  size_t num_new_samples;                                  /* The number of samples we added since the last calibrate(). */
+};
+
+/* ---------------------------------------------------------------------- */
+
+inline bool KankerAbbMotionModel::needsCalibration() {
+  return 0 < calibrate_interval && num_new_samples >= (size_t)calibrate_interval;
+}
+
+#endif
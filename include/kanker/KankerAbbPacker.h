@@ -0,0 +1,91 @@
+/*
+
+  KankerAbbPacker
+  ---------------
+
+  Plans which commands we send to the ABB per ABB_CMD_DRAW. Each draw
+  costs a network round trip: we send the commands, the ABB executes
+  them and tells us when it's ready for the next ones. Sending one
+  glyph per draw makes long messages slow, so the packer puts as many
+  whole glyphs as possible into one draw.
+
+  Networking.mod stores the commands in `packets{500}`; an arc uses
+  two packets, a draw and a get state none. When the 500th packet is
+  written the write index wraps around to 1 and FreeWriting.mod draws
+  nothing, therefore we use at most 499 packets per draw. The number of
+  bytes doesn't matter: KankerAbb::sendCommands() splits them in frames.
+
+  With `use_banks` the batches end with ABB_CMD_DRAW_BANKED instead of
+  ABB_CMD_DRAW. The robot splits `packets` into two banks of 250
+  packets, of which we use 249 for the same reason. It draws one bank
+  while it receives the next batch into the other one, so we don't
+  have to wait for the robot before we upload. The last batch of a
+  message is flagged so the robot tells us when everything has been
+  drawn.
+
+  You add units with add(): the bytes of a stroke or the swipe which
+  must be drawn in one go, together with the index of the glyph they
+  belong to. pack() then creates the batches: a glyph which doesn't fit
+  in the current batch starts a new one, and a glyph with more packets
+  than a batch can hold is split between its strokes.
+
+ */
+#ifndef KANKER_ABB_PACKER_H
+#define KANKER_ABB_PACKER_H
+
+#include <stdint.h>
+#include <vector>
+
+#define ROXLU_USE_LOG
+#include <tinylib.h>
+
+#define ABB_MAX_PACKETS 499                                /* The number of packets we can store on the ABB, one less than `packets{500}`. */
+#define ABB_BANK_PACKETS 249                               /* The number of packets per bank when we use banks, one less than `bank_size` in the RAPID modules. */
+
+/* ---------------------------------------------------------------------- */
+
+class KankerAbbPackerUnit {
+ public:
+  KankerAbbPackerUnit();
+
+ public:
+  std::vector<uint8_t> data;                               /* The commands, as created by Buffer. */
+  size_t num_packets;                                      /* The number of packets the ABB needs to store the commands. */
+  size_t glyph;                                            /* The index of the glyph in the message. */
+};
+
+/* ---------------------------------------------------------------------- */
+
+class KankerAbbBatch {
+ public:
+  KankerAbbBatch();
+  void clear();                                            /* Removes all data. */
+
+ public:
+  std::vector<uint8_t> data;                               /* The commands, ending with ABB_CMD_DRAW or ABB_CMD_DRAW_BANKED. */
+  size_t num_packets;                                      /* The number of packets the ABB needs to store the commands. */
+  size_t first_glyph;                                      /* The index of the first glyph in this batch. */
+  size_t last_glyph;                                       /* The index of the last glyph in this batch; can be the same glyph as the first glyph of the next batch when we had to split it. */
+};
+
+/* ---------------------------------------------------------------------- */
+
+class KankerAbbPacker {
+ public:
+  KankerAbbPacker();
+  void clear();                                            /* Removes all units. */
+  int add(const uint8_t* data, size_t nbytes, size_t glyph); /* Adds the commands of a stroke (or swipe) which belongs to the given glyph. Returns 0 on success, < 0 when the data is invalid or needs more than `max_packets` packets. */
+  int pack(std::vector<KankerAbbBatch>& out);              /* Creates the batches for the units we've added; `out` is cleared first. Returns 0 on success, < 0 on error. */
+  size_t getPacketLimit();                                 /* Returns the maximum number of packets per batch; `max_packets` or the bank size when we use banks. */
+
+ private:
+  void finishBatch(KankerAbbBatch& batch, std::vector<KankerAbbBatch>& out); /* Adds the draw command and appends the batch to `out`. */
+
+ public:
+  std::vector<KankerAbbPackerUnit> units;                  /* The strokes we need to send. */
+  size_t max_packets;                                      /* The maximum number of packets per draw, ABB_MAX_PACKETS by default. */
+  bool batch_glyphs;                                       /* When false, each glyph gets its own draw. */
+  bool use_banks;                                          /* When true we end the batches with ABB_CMD_DRAW_BANKED so the robot draws while we upload. */
+};
+
+#endif
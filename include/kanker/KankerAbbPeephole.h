@@ -0,0 +1,72 @@
+/*
+
+  KankerAbbPeephole
+  -----------------
+
+  Removes redundant commands from a list of commands before we
+  serialize them. The commands we generate contain a couple of
+  patterns that cost packets but don't change what the robot does:
+
+     - Zero-length moves  A stroke starts with a move to the first point,
+                          the lamp is switched on and then we move to the
+                          same point again. A move to the position where
+                          we already are is removed; when the removed
+                          move was a `fine` point, the move before it
+                          becomes `fine` so the robot still stops there.
+     - I/O toggles        The swipe switches a led off and on again
+                          between two points. Only the last change of a
+                          port between two moves is visible, and a change
+                          to the value the port already has is removed.
+                          FreeWriting switches off all ports after a draw
+                          so we know their state after ABB_CMD_DRAW.
+
+  The statistics are added up over all calls of optimize(); clear them
+  with `stats.clear()`.
+
+ */
+#ifndef KANKER_ABB_PEEPHOLE_H
+#define KANKER_ABB_PEEPHOLE_H
+
+#include <vector>
+#include <map>
+
+#define ROXLU_USE_MATH
+#define ROXLU_USE_LOG
+#include <tinylib.h>
+
+class KankerAbbCommand;
+
+/* ---------------------------------------------------------------------- */
+
+class KankerAbbPeepholeStats {
+ public:
+  KankerAbbPeepholeStats();
+  void clear();                                            /* Resets all counters to zero. */
+  void print();                                            /* Logs the counters. */
+
+ public:
+  size_t commands_in;                                      /* The number of commands we received. */
+  size_t commands_out;                                     /* The number of commands we kept. */
+  size_t packets_in;                                       /* The number of packets the received commands need on the ABB. */
+  size_t packets_out;                                      /* The number of packets the kept commands need on the ABB. */
+  size_t moves_removed;                                    /* The number of zero-length positions and arcs we removed. */
+  size_t io_removed;                                       /* The number of I/O commands we removed. */
+};
+
+/* ---------------------------------------------------------------------- */
+
+class KankerAbbPeephole {
+ public:
+  KankerAbbPeephole();
+  int optimize(std::vector<KankerAbbCommand>& cmds);       /* Removes the redundant commands from `cmds`. Returns 0 on success, < 0 on error. */
+
+ private:
+  void flushIO(std::vector<KankerAbbCommand>& pending, std::map<int, int>& state, std::vector<KankerAbbCommand>& out); /* Appends the pending I/O changes which change the state of a port to `out`. */
+  bool isSamePosition(const vec3& a, const vec3& b);       /* Returns true when `a` and `b` are closer than `epsilon`. */
+
+ public:
+  float epsilon;                                           /* Positions that are closer than this, in millimeters, are the same. */
+  KankerAbbPeepholeStats stats;                            /* What we removed. */
+};
+
+#endif
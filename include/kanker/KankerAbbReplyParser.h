@@ -0,0 +1,70 @@
+/*
+
+  KankerAbbReplyParser
+  --------------------
+
+  Splits the bytes we receive from the ABB into replies. The ABB sends
+  its state as one character and some replies with a value, which is
+  written as decimal digits and ends with a ';':
+
+     r              ABB_REPLY_READY       Ready to receive commands.
+     d              ABB_REPLY_DRAWING     Drawing.
+     b              ABB_REPLY_BANK_FREE   A bank is free, we can send the next batch.
+     n              ABB_REPLY_STARTING    Networking.mod just started.
+     c              ABB_REPLY_CONNECTED   A client just connected.
+     p<packets>;    ABB_REPLY_PROGRESS    The number of packets drawn since ABB_CMD_RESET.
+     e<code>;       ABB_REPLY_ERROR       Something went wrong, see ABB_ERROR_*.
+
+  One read can contain several replies and a reply can be split
+  between two reads, so we keep the reply we're parsing between calls
+  of parse(). Bytes we don't understand are skipped.
+
+ */
+#ifndef KANKER_ABB_REPLY_PARSER_H
+#define KANKER_ABB_REPLY_PARSER_H
+
+#include <stdint.h>
+#include <vector>
+
+#define ROXLU_USE_LOG
+#include <tinylib.h>
+
+#define ABB_REPLY_NONE 0                                   /* We're not parsing a reply. */
+#define ABB_REPLY_READY 'r'
+#define ABB_REPLY_DRAWING 'd'
+#define ABB_REPLY_BANK_FREE 'b'
+#define ABB_REPLY_STARTING 'n'
+#define ABB_REPLY_CONNECTED 'c'
+#define ABB_REPLY_PROGRESS 'p'
+#define ABB_REPLY_ERROR 'e'
+#define ABB_REPLY_END ';'                                  /* Ends a reply with a value. */
+#define ABB_REPLY_MAX_DIGITS 9                             /* The maximum number of digits of a value. */
+
+#define ABB_ERROR_INVALID_FRAME 1                          /* Networking.mod received a frame with an invalid header. */
+#define ABB_ERROR_UNKNOWN_COMMAND 2                        /* Networking.mod received a command it doesn't know and dropped the rest of the frame. */
+
+/* ---------------------------------------------------------------------- */
+
+class KankerAbbReply {
+ public:
+  KankerAbbReply();
+
+ public:
+  uint8_t type;                                            /* One of the ABB_REPLY_* values. */
+  int32_t value;                                           /* The value of ABB_REPLY_PROGRESS and ABB_REPLY_ERROR, otherwise 0. */
+};
+
+/* ---------------------------------------------------------------------- */
+
+class KankerAbbReplyParser {
+ public:
+  KankerAbbReplyParser();
+  void reset();                                            /* Forgets the reply we're parsing; call this when we (re)connect. */
+  int parse(const char* data, size_t nbytes, std::vector<KankerAbbReply>& out); /* Appends the replies that are complete to `out`, in the order we received them. Returns 0 on success, < 0 when we had to skip invalid bytes. */
+
+ public:
+  KankerAbbReply reply;                                    /* The reply with a value we're parsing. */
+  int num_digits;                                          /* The number of digits of `reply.value` we've parsed. */
+};
+
+#endif
@@ -12,6 +12,7 @@
 #include <kanker/KankerDrawer.h>
 #include <kanker/KankerAbb.h>
 #include <kanker/KankerAbbController.h>
+#include <kanker/KankerLayout.h>
 
 #define REMOXLY_USE_OPENGL
 #include <gui/Remoxly.h>
@@ -87,6 +88,7 @@ class KankerApp : public KankerAbbListener {
   KankerDrawer preview_drawer;                                                  /* Used to draw the preview of the character. */
   KankerAbbController controller;                                               /* Used to test the controller. */
   std::string test_message;                                                     /* Text that we use to upload to the ABB. */
+  KankerLayout test_layout;                                                     /* The layout of the test message; only updated when the message or settings change. */
 
   bool is_mouse_pressed;                                                        /* Is set to true when the user pressed the mouse */
   int gui_width;                                                                /* The width of the gui, used to position some graphical elements */ 
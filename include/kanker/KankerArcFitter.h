@@ -0,0 +1,62 @@
+/*
+
+  KankerArcFitter
+  ---------------
+
+  The robot stops at every point we send (`MoveL` with `fine`), so a
+  round letter like `o` becomes a lot of short, stop-and-go moves. The
+  arc fitter replaces runs of points that lie on a circle by one arc
+  which is sent as a single ABB_CMD_ARC and executed with `MoveC`.
+
+  We walk over the points of a segment and grow an arc from the current
+  point as long as all points of the run are within `tolerance` of the
+  circle, turn in the same direction and the arc doesn't sweep more
+  than `max_sweep` degrees. Runs that are (almost) straight are kept as
+  lines because the robot can't move along a circle with an infinite
+  radius. The circle is fitted in the x/y plane; z is taken from the
+  points.
+
+  The result is a list of KankerArcSpan: each span moves from the end
+  of the previous span (or the first point) to `points[end]`, either
+  along a line or along an arc through `via`.
+
+ */
+#ifndef KANKER_ARC_FITTER_H
+#define KANKER_ARC_FITTER_H
+
+#include <vector>
+
+#define ROXLU_USE_MATH
+#define ROXLU_USE_LOG
+#include <tinylib.h>
+
+/* ---------------------------------------------------------------------- */
+
+class KankerArcSpan {
+ public:
+  KankerArcSpan();
+
+ public:
+  size_t start;                                              /* Index of the point where the span starts. */
+  size_t end;                                                /* Index of the point where the span ends. */
+  bool is_arc;                                               /* True when we move along an arc, false for a line. */
+  vec3 via;                                                  /* A point halfway the arc; only used when `is_arc` is true. */
+};
+
+/* ---------------------------------------------------------------------- */
+
+class KankerArcFitter {
+ public:
+  KankerArcFitter();
+  int fit(std::vector<vec3>& points, std::vector<KankerArcSpan>& out); /* Fits arcs to the given points; `out` is cleared first. Returns 0 on success, < 0 on error. */
+
+ private:
+  bool fitArc(std::vector<vec3>& points, size_t start, size_t end, KankerArcSpan& arc, bool& isStraight); /* Tries to fit one arc through `points[start]` till `points[end]`. */
+
+ public:
+  float tolerance;                                           /* The maximum distance between a point and the arc; 0 disables arc fitting. */
+  float max_sweep;                                           /* The maximum angle, in degrees, of one arc; `MoveC` can't do full circles. */
+  float max_step;                                            /* The maximum angle, in degrees, between two succeeding points of an arc. */
+};
+
+#endif
@@ -2,6 +2,8 @@
 #define KANKER_FONT_H
 
 #include <kanker/KankerGlyph.h>
+#include <kanker/KankerFontFile.h>
+#include <stdint.h>
 #include <map>
 #include <vector>
 #include <fstream>
@@ -11,26 +13,103 @@
 #define ROXLU_USE_LOG
 #include <tinylib.h>
 
+/* ---------------------------------------------------------------------- */
+
+#define KANKER_FONT_FORMAT_XML 0                                        /* Save the font as xml, this is the format which is used by the editor. */
+#define KANKER_FONT_FORMAT_BINARY 1                                     /* Save the font as a compiled font file, see KankerFontFile.h */
+
+#define KANKER_FONT_LOAD_EAGER 0                                        /* Parse all glyphs while loading the font. */
+#define KANKER_FONT_LOAD_LAZY 1                                         /* Only index the xml while loading; a glyph is parsed when it's used for the first time. */
+
+#define KANKER_GLYPH_LOADED 0                                           /* The points of the glyph are loaded. */
+#define KANKER_GLYPH_IN_FONT_FILE 1                                     /* The points of the glyph still need to be read from the mapped font file. */
+#define KANKER_GLYPH_IN_XML 2                                           /* The points of the glyph still need to be parsed from the xml source. */
+
+#define KANKER_MAX_CODEPOINT 0x10FFFF                                   /* The last valid unicode code point. */
+#define KANKER_PAGE_BITS 8                                              /* Number of bits of a code point that index into a page of the glyph table. */
+#define KANKER_PAGE_SIZE (1 << KANKER_PAGE_BITS)                        /* Number of code points per page. */
+#define KANKER_NUM_PAGES ((KANKER_MAX_CODEPOINT + 1) >> KANKER_PAGE_BITS) /* Number of pages we need to cover all of unicode. */
+
+/* 
+   Two level page table that maps a code point onto an index into 
+   the `KankerFont::glyphs` vector. The `directory` has one entry for 
+   each page of 256 code points. All pages that don't contain a glyph
+   point to page 0, which is shared and only contains -1. This means 
+   that a lookup is always two array reads, without branches, and we 
+   only allocate pages for the ranges that are actually used.
+*/
+class KankerGlyphTable {
+
+ public:
+  KankerGlyphTable();
+  void clear();                                                          /* Removes all entries. */
+  int find(int charcode);                                                /* Returns the index of the glyph for the given code point or -1 when not found. */
+  int insert(int charcode, int dx);                                      /* Stores the index `dx` for the given code point. Returns 0 on success else < 0. */
+
+ public:
+  std::vector<uint16_t> directory;                                       /* Page number for each block of KANKER_PAGE_SIZE code points; 0 means "no glyphs in this block". */
+  std::vector<int32_t> pages;                                            /* KANKER_PAGE_SIZE entries per page with the index into the glyphs or -1. */
+};
+
+inline int KankerGlyphTable::find(int charcode) {
+
+  if (charcode < 0 || charcode > KANKER_MAX_CODEPOINT) {
+    return -1;
+  }
+
+  return pages[(directory[charcode >> KANKER_PAGE_BITS] << KANKER_PAGE_BITS) | (charcode & (KANKER_PAGE_SIZE - 1))];
+}
+
+/* ---------------------------------------------------------------------- */
+
+class KankerGlyphSource {
+ public:
+  KankerGlyphSource():begin(0),end(0) {}
+
+ public:
+  size_t begin;                                                          /* Byte offset into `KankerFont::xml_source` where the contents of the <glyph> element start. */
+  size_t end;                                                            /* Byte offset of the closing </glyph> tag. */
+};
+
+/* ---------------------------------------------------------------------- */
+
 class KankerFont {
 
  public:
   KankerFont();
   ~KankerFont();
-  int save(std::string filepath);                                        /* Save the current font as xml. */
-  int load(std::string filepath);                                        /* Load the font from the given xml file path. */
+  int save(std::string filepath, int format = KANKER_FONT_FORMAT_XML);   /* Save the current font as xml or as a compiled font file. */
+  int load(std::string filepath, int mode = KANKER_FONT_LOAD_EAGER);     /* Load the font from the given xml or compiled font file path. With KANKER_FONT_LOAD_LAZY we only index the xml and parse glyphs on first use. */
+  int loadCompiled(std::string filepath);                                /* Is called by load() when the file is a compiled font; maps the file and reads the glyph index. */
+  int loadIndex();                                                       /* Is called by load() in lazy mode; scans `xml_source` once and stores the byte range of each glyph. */
   void clear();                                                          /* Removes all added glyphs. */
   size_t size();                                                         /* Returns the number of elements in the glyphs member. */
   void write(std::string str, std::vector<std::vector<vec3> >& lines);   /* Fill the `lines` argument with the points with the correct positions to write the string. */
-  int getBaseHeight(float& height);                                      /* Sets the 'x-height', so the x, u, v, w or z characters must be added. Is used to normalize the characters. Returns 0 on success else < 0*/
-  KankerGlyph* getGlyphByCharCode(int charcode);                         /* Get the glyph for the given character code. */
+  int getBaseHeight(float& height);                                      /* Sets the 'x-height', so the x, u, v, w or z characters must be added. Is used to normalize the characters. For an unchanged compiled font we use the x-height that was stored when compiling. Returns 0 on success else < 0*/
+  KankerGlyph* getGlyphByCharCode(int charcode);                         /* Get the glyph for the given character code; when it doesn't exist yet we create a new, empty one. Creating a glyph invalidates previously returned glyph pointers. */
   KankerGlyph* getGlyphByIndex(size_t dx);                               /* Get the glyph for the given index. */ 
+  KankerGlyph* findGlyph(int charcode);                                  /* Returns the glyph for the given character code or NULL when it's not found. This never allocates or creates a glyph. */
+  int findGlyphIndex(int charcode);                                      /* Returns the index into `glyphs` for the given character code or -1 when not found. */
   bool hasGlyph(int charcode);                                           /* Returns true when the given char code exists in the font. */
+  int loadGlyph(size_t dx);                                              /* Makes sure the points of the glyph at the given index are loaded; is called by the getters. */
   void setOrigin(float originX, float originY);                          /* Sets the origin x/y that are used when editing glyphs. These origins are using to "normalize" and align characters int their own bounding boxes. */
+  void markChanged();                                                    /* Must be called when you changed a glyph through a pointer you got earlier; gives the font a new `revision`. */
+
+ private:
+  KankerFont(const KankerFont& other);                                   /* Not copyable; `font_file` owns the mapping of a compiled font. */
+  KankerFont& operator=(const KankerFont& other);
 
  public:
-  std::vector<KankerGlyph*> glyphs;                                      /* KankerFont is owner of the glyphs and it will free allocated memory. */
+  std::vector<KankerGlyph> glyphs;                                       /* The glyphs, stored by value in contiguous memory. */
+  KankerGlyphTable glyph_table;                                          /* Maps a code point onto an index into `glyphs`. */
+  std::vector<uint8_t> glyph_state;                                      /* KANKER_GLYPH_LOADED or where we still need to read the points from, one entry per glyph. */
+  KankerFontFile font_file;                                              /* When we loaded a compiled font this is the mapped file; points are read from it on first use. */
+  std::string xml_source;                                                /* When loading lazily we keep the xml in memory, glyphs are parsed from it on first use. */
+  std::vector<KankerGlyphSource> glyph_sources;                          /* When loading lazily this contains the byte range of each glyph in `xml_source`. */
   float origin_x;                                                        /* The origin_x is the x-offset that was used to draw the character on screen so we can nicely reposition it when editing. This is the origin point. */
   float origin_y;                                                        /* The origin_y is the y-offset that was used to draw the character on screen so we can nicely reposition it when editing. This is the origin point. */
+  uint32_t revision;                                                     /* Changes whenever the font is (or may have been) modified; unique over all fonts. Used by caches of prepared glyphs, see KankerAbb. */
+  uint32_t font_file_revision;                                           /* The `revision` right after we loaded a compiled font; while they are equal the x-height in the header of `font_file` is valid. */
 };
 
 inline void KankerFont::setOrigin(float x, float y) {
@@ -39,9 +118,11 @@ inline void KankerFont::setOrigin(float x, float y) {
   origin_y = y;
   RX_VERBOSE("Origin set: %f, %f", x, y);
 
+  markChanged();
+
   for (size_t i = 0; i < glyphs.size(); ++i) {
-    glyphs[i]->origin_x = origin_x;
-    glyphs[i]->origin_y = origin_y;
+    glyphs[i].origin_x = origin_x;
+    glyphs[i].origin_y = origin_y;
   }
 }
 
@@ -56,18 +137,33 @@ inline KankerGlyph* KankerFont::getGlyphByIndex(size_t dx) {
     return NULL;
   }
 
-  return glyphs[dx];
+  if (KANKER_GLYPH_LOADED != glyph_state[dx]) {
+    loadGlyph(dx);
+  }
+
+  return &glyphs[dx];
 }
 
-inline bool KankerFont::hasGlyph(int charcode) {
+inline int KankerFont::findGlyphIndex(int charcode) {
+  return glyph_table.find(charcode);
+}
 
-  for (size_t i = 0; i < glyphs.size(); ++i) {
-    if (glyphs[i]->charcode == charcode) {
-      return true;
-    }
+inline KankerGlyph* KankerFont::findGlyph(int charcode) {
+
+  int dx = glyph_table.find(charcode);
+  if (-1 == dx) {
+    return NULL;
   }
 
-  return false;
+  if (KANKER_GLYPH_LOADED != glyph_state[dx]) {
+    loadGlyph(dx);
+  }
+
+  return &glyphs[dx];
+}
+
+inline bool KankerFont::hasGlyph(int charcode) {
+  return -1 != glyph_table.find(charcode);
 }
 
 #endif
@@ -0,0 +1,154 @@
+/*
+
+  KankerFontFile
+  --------------
+
+  Compiled, binary representation of a `KankerFont`. Parsing the xml
+  fonts is slow because every point is stored as text. A compiled font
+  file contains a glyph index with precomputed metrics and one packed
+  array with all the points. The file is memory mapped so opening a
+  font only means reading the header and glyph index.
+
+  The points of a glyph are copied from the mapping into its
+  KankerGlyph when the glyph is used for the first time; one memcpy-like
+  pass over a contiguous range. We don't hand out pointers into the
+  mapping because a KankerGlyph is mutable (the editor adds points, the
+  transforms are baked into the points by applyTransform()) and its
+  consumers work with `vec3*`, of which the layout and alignment are
+  not guaranteed to match three packed floats. Use getSegmentPoints()
+  below when you only need to read the points of a compiled font.
+
+  Layout of a .kfnt file. All values are stored in the native byte
+  order of the machine that compiled the font; the `endian` field is
+  used to detect files that were compiled on a machine with a
+  different byte order.
+
+     +-------------------------------+
+     | KankerFontFileHeader          |  64 bytes
+     +-------------------------------+
+     | KankerFontFileGlyph[n]        |  sorted on charcode
+     +-------------------------------+
+     | uint32_t[num_segments + 1]    |  index of the first point of each segment, the last one is num_points
+     +-------------------------------+
+     | float[num_points * 3]         |  x, y, z for each point
+     +-------------------------------+
+
+  You can compile a font with `KankerFont::save(path, KANKER_FONT_FORMAT_BINARY)`
+  or with the `kankerfontc` tool. `KankerFont::load()` detects compiled
+  fonts automatically.
+
+ */
+#ifndef KANKER_FONT_FILE_H
+#define KANKER_FONT_FILE_H
+
+#if defined(_WIN32)
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h>
+#endif
+
+#include <stdint.h>
+#include <string>
+
+#define ROXLU_USE_LOG
+#include <tinylib.h>
+
+#define KANKER_FONT_FILE_VERSION 1                        /* Bump this whenever the layout of the file changes. */
+#define KANKER_FONT_FILE_ENDIAN 0x01020304                /* Written in native byte order, used to detect a byte order mismatch. */
+
+class KankerFont;
+
+/* ---------------------------------------------------------------------- */
+
+struct KankerFontFileHeader {
+  char magic[4];                                          /* "KFNT" */
+  uint32_t version;                                       /* KANKER_FONT_FILE_VERSION */
+  uint32_t endian;                                        /* KANKER_FONT_FILE_ENDIAN */
+  uint32_t file_size;                                     /* Total size of the file in bytes. */
+  uint32_t num_glyphs;                                    /* Number of KankerFontFileGlyph entries. */
+  uint32_t num_segments;                                  /* Total number of segments (lines) of all glyphs. */
+  uint32_t num_points;                                    /* Total number of points of all glyphs. */
+  uint32_t glyphs_offset;                                 /* Byte offset of the glyph index. */
+  uint32_t segments_offset;                               /* Byte offset of the segment offsets. */
+  uint32_t points_offset;                                 /* Byte offset of the points. */
+  float origin_x;                                         /* The origin of the font; see KankerFont::origin_x */
+  float origin_y;                                         /* The origin of the font; see KankerFont::origin_y */
+  float x_height;                                         /* The x-height as returned by KankerFont::getBaseHeight(), or -1 when the font doesn't have the necessary glyphs. Returned by getBaseHeight() for a loaded, unchanged font. */
+  uint32_t reserved[3];
+};
+
+struct KankerFontFileGlyph {
+  int32_t charcode;
+  uint32_t first_segment;                                 /* Index into the segment offsets. */
+  uint32_t num_segments;                                  /* Number of segments of this glyph. */
+  float advance_x;
+  float min_x;
+  float min_y;
+  float max_x;
+  float max_y;
+  float width;
+  float height;
+};
+
+/* ---------------------------------------------------------------------- */
+
+int kanker_font_file_is_compiled(std::string filepath);   /* Returns 0 when the given file is a compiled font file, otherwise < 0. */
+
+/* ---------------------------------------------------------------------- */
+
+class KankerFontFile {
+
+ public:
+  KankerFontFile();
+  ~KankerFontFile();
+  int open(std::string filepath);                         /* Memory maps the given file and validates the header and glyph index. */
+  int close();                                            /* Unmaps the file. */
+  int save(std::string filepath, KankerFont& font);       /* Compiles the given font into `filepath`. */
+  bool isOpen();                                          /* Returns true when we have mapped a file. */
+  KankerFontFileGlyph* getGlyphByIndex(size_t dx);        /* Returns the glyph info at the given index or NULL. */
+  KankerFontFileGlyph* findGlyph(int charcode);           /* Binary search for the given charcode; returns NULL when not found. */
+  size_t getSegmentSize(KankerFontFileGlyph* glyph, size_t segment); /* Number of points of the given segment of the glyph. */
+  const float* getSegmentPoints(KankerFontFileGlyph* glyph, size_t segment); /* Pointer into the mapped file to the first point (x, y, z) of the segment. */
+
+ private:
+  KankerFontFile(const KankerFontFile& other);            /* Not copyable; a copy would unmap the file of the original when it's destroyed. */
+  KankerFontFile& operator=(const KankerFontFile& other);
+
+ public:
+  KankerFontFileHeader* header;                           /* Points into the mapped memory. */
+  KankerFontFileGlyph* glyphs;                            /* Points into the mapped memory. */
+  uint32_t* segments;                                     /* Points into the mapped memory. */
+  float* points;                                          /* Points into the mapped memory. */
+  uint8_t* data;                                          /* The mapped memory. */
+  size_t nbytes;                                          /* The size of the mapped memory. */
+#if defined(_WIN32)
+  HANDLE file_handle;
+  HANDLE map_handle;
+#endif
+};
+
+/* ---------------------------------------------------------------------- */
+
+inline bool KankerFontFile::isOpen() {
+  return NULL != data;
+}
+
+inline KankerFontFileGlyph* KankerFontFile::getGlyphByIndex(size_t dx) {
+
+  if (NULL == header || dx >= header->num_glyphs) {
+    return NULL;
+  }
+
+  return &glyphs[dx];
+}
+
+inline size_t KankerFontFile::getSegmentSize(KankerFontFileGlyph* glyph, size_t segment) {
+
+  size_t dx = glyph->first_segment + segment;
+  return segments[dx + 1] - segments[dx];
+}
+
+inline const float* KankerFontFile::getSegmentPoints(KankerFontFileGlyph* glyph, size_t segment) {
+  return points + (segments[glyph->first_segment + segment] * 3);
+}
+
+#endif
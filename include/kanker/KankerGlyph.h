@@ -4,12 +4,39 @@
 #define ROXLU_USE_MATH
 #include <tinylib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <vector>
 
 #define ROXLU_USE_MATH
 #define ROXLU_USE_LOG
 #include <tinylib.h>
 
+/*
+
+  KankerGlyph
+  -----------
+
+  The points of all segments (lines) of a glyph are stored in one
+  contiguous array, `points`. `segment_offsets` contains the index
+  of the first point of each segment; the last segment ends at
+  `points.size()`. Use the segment functions below to iterate over
+  the points of one segment:
+
+     for (size_t i = 0; i < glyph.getNumSegments(); ++i) {
+       vec3* p = glyph.getSegmentPoints(i);
+       for (size_t j = 0; j < glyph.getSegmentSize(i); ++j) {
+         ... p[j] ...
+       }
+     }
+
+  The transforms (translate, scale, normalize, ...) update the metrics
+  right away but don't touch the points. They are combined into one 
+  2D affine `transform` that is applied to all points in one pass when
+  the points are needed: getSegmentPoints(), getSegment(), addPoint() 
+  and applyTransform() do this. When you access `points` directly, call 
+  applyTransform() first. Copying a glyph copies two arrays.
+
+ */
 class KankerGlyph {
 
  public:
@@ -19,8 +46,18 @@ class KankerGlyph {
   ~KankerGlyph();
   void addPoint(vec3& v);
   void addPoint(float x, float y, float z = 0.0);
+  void addPoints(const vec3* p, size_t num);          /* Adds `num` points to the current segment and updates the metrics once for all of them. */
+  void recomputeBounds();                             /* Recalculates min/max/width/height from the points. */
   void onStartLine();                                 /* Must be called in input mode, when the user starts drawing a line. A glyph can contain multiple lines. */
   void onEndLine();                                   /* Must be called in input mode, when the user ends drawing a line. A glyph can contain multiple lines. */
+  void addSegment(const vec3* p, size_t num);         /* Adds a new segment with the given points; the metrics are updated. */
+  void addSegment(const std::vector<vec3>& p);        /* Adds a new segment with the given points; the metrics are updated. */
+  size_t getNumSegments() const;                      /* Returns the number of segments (lines). */
+  size_t getSegmentSize(size_t dx) const;             /* Returns the number of points of the given segment. */
+  vec3* getSegmentPoints(size_t dx);                  /* Returns a pointer to the first point of the given segment; there are getSegmentSize() points. */
+  void getSegment(size_t dx, std::vector<vec3>& result); /* Copies the points of the given segment into `result`. */
+  void addTransform(float a, float b, float c, float d, float tx, float ty); /* Combines the given affine transform with the pending `transform`; (a, b) is the first column, (c, d) the second column. */
+  void applyTransform();                              /* Applies the pending transform to all points and resets it. */
   void clear();                                       /* Removes all line segments / points, normalized points and segments .. */
   void print();                                       /* Prints out some info about the glyph. */
 
@@ -35,7 +72,8 @@ class KankerGlyph {
   void alignBottom();
 
  public:
-  std::vector<std::vector<vec3> > segments;
+  std::vector<vec3> points;                           /* The points of all segments. */
+  std::vector<uint32_t> segment_offsets;              /* The index into `points` of the first point of each segment. */
   int charcode;
   float min_x; 
   float min_y;
@@ -46,6 +84,8 @@ class KankerGlyph {
   float advance_x;
   float origin_x; 
   float origin_y; /* @todo use this to align the font. */
+  float transform[6];                                 /* Pending transform that still needs to be applied to `points`: x' = t[0] * x + t[2] * y + t[4], y' = t[1] * x + t[3] * y + t[5]. */
+  bool has_transform;                                 /* Is true when `transform` isn't the identity. */
 };
 
 inline void KankerGlyph::addPoint(vec3& v) {
@@ -55,6 +95,10 @@ inline void KankerGlyph::addPoint(vec3& v) {
 
 inline void KankerGlyph::addPoint(float x, float y, float z) {
 
+  if (has_transform) {
+    applyTransform();
+  }
+
   if (x > max_x) {
     max_x = x;
     width = max_x - min_x;
@@ -72,13 +116,35 @@ inline void KankerGlyph::addPoint(float x, float y, float z) {
     height = max_y - min_y;
   }
 
-  if (0 == segments.size()) {
+  if (0 == segment_offsets.size()) {
     RX_VERBOSE("No segments found yet, not supposed to happen be we will create one.");
-    std::vector<vec3> segment;
-    segments.push_back(segment);
+    segment_offsets.push_back(points.size());
+  }
+
+  points.push_back(vec3(x, y, z));
+}
+
+inline size_t KankerGlyph::getNumSegments() const {
+  return segment_offsets.size();
+}
+
+inline size_t KankerGlyph::getSegmentSize(size_t dx) const {
+
+  size_t end = (dx + 1 < segment_offsets.size()) ? segment_offsets[dx + 1] : points.size();
+  return end - segment_offsets[dx];
+}
+
+inline vec3* KankerGlyph::getSegmentPoints(size_t dx) {
+
+  if (0 == points.size()) {
+    return NULL;
+  }
+
+  if (has_transform) {
+    applyTransform();
   }
 
-  segments.back().push_back(vec3(x, y, z));
+  return &points[0] + segment_offsets[dx];
 }
 
 #endif
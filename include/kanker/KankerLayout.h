@@ -0,0 +1,84 @@
+/*
+
+  KankerLayout
+  ------------
+
+  Keeps the result of KankerAbb::write() for a message and only does
+  the work that is necessary when you call update() again. The font
+  test screen of the editor lays out the same message every frame:
+
+     - When the text, the font and the settings didn't change we do
+       nothing and `has_changed` is false.
+     - When only `offset_x` or `offset_y` changed we move the glyphs 
+       we already have; nothing is laid out again.
+     - When the text changed we continue from the first word that is 
+       different, using the pen position we stored for that word.
+     - When another setting or the font changed we lay out everything. 
+
+  Check `has_changed` after calling update() to see if you need to 
+  upload the `segments` again.
+
+ */
+#ifndef KANKER_LAYOUT_H
+#define KANKER_LAYOUT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <kanker/KankerAbb.h>
+#include <kanker/KankerFont.h>
+
+/* ---------------------------------------------------------------------- */
+
+class KankerLayoutWord {
+ public:
+  KankerLayoutWord();
+
+ public:
+  std::string text;                                                   /* The word. */
+  KankerAbbPen pen;                                                   /* The pen before we wrote the word. */
+  size_t glyph_start;                                                 /* Index into KankerLayout::glyphs of the first glyph of this word. */
+  size_t segment_start;                                               /* Index into KankerLayout::segments of the first segment of this word. */
+};
+
+/* ---------------------------------------------------------------------- */
+
+class KankerLayout {
+ public:
+  KankerLayout();
+  int update(KankerAbb& abb, KankerFont& font, std::string text);     /* Lays out the given text like KankerAbb::write(), but only redoes what changed since the last call. Returns 0 on success, < 0 on error. */
+  void clear();                                                       /* Removes the current result so the next update() lays out everything. */
+
+ private:
+  bool hasSettingsChanged(KankerAbb& abb, KankerFont& font);          /* Returns true when a setting changed that influences the position of all words. */
+  void storeSettings(KankerAbb& abb, KankerFont& font);               /* Remembers the settings we used for the current result. */
+  int applyOffset(KankerAbb& abb, KankerFont& font);                  /* Moves all glyphs to the current offset of the abb. */
+
+ public:
+  std::vector<KankerAbbGlyph> glyphs;                                 /* The result, as you would get from KankerAbb::write(). */
+  std::vector<std::vector<vec3> > segments;                           /* The result, as you would get from KankerAbb::write(). */
+  std::vector<KankerLayoutWord> words;                                /* The words that we've written. */
+  std::vector<std::string> new_words;                                 /* The words of the text that is passed into update(); member so we reuse the memory. */
+  KankerAbbPen pen;                                                   /* The pen after the last word. */
+  bool is_full;                                                       /* True when the last word didn't leave space for another line. */
+  bool has_changed;                                                   /* Is set by update(); true when `glyphs` and `segments` changed. */
+
+  /* The settings and font we used to create the current result. */
+  std::string text;
+  KankerFont* font;
+  uint32_t font_revision;
+  float char_scale;
+  float min_point_dist;
+  int simplify_mode;
+  float simplify_tolerance;
+  float word_spacing;
+  float line_height;
+  float offset_x;
+  float offset_y;
+  int min_x;
+  int max_x;
+  int min_y;
+  int max_y;
+};
+
+#endif
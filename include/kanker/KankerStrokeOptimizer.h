@@ -0,0 +1,126 @@
+/*
+
+  KankerStrokeOptimizer
+  ---------------------
+
+  The robot moves with the lamp off from the end of one stroke to the
+  start of the next one. We write with light, so the order in which
+  the strokes are drawn doesn't matter for the result but it does
+  matter for the time it takes to write a message.
+
+  The optimizer reorders, and optionally reverses, the strokes of a
+  message as returned by `KankerAbb::write()` to minimize this pen-up
+  travel. We first build a route with a nearest neighbour search and
+  then improve it with 2-opt (reversing a part of the route) and
+  Or-opt (moving a chain of 1-3 strokes to another place in the route).
+
+  With `order` you set which strokes may be swapped:
+
+     KANKER_STROKE_ORDER_NONE      Keep the order of the font.
+     KANKER_STROKE_ORDER_GLYPH     Only the strokes of one glyph; the glyphs are written in order.
+     KANKER_STROKE_ORDER_WORD      All strokes of a word; the words are written in order.
+     KANKER_STROKE_ORDER_MESSAGE   All strokes of the message.
+
+  Reordering keeps the number of glyphs and the number of segments of
+  each glyph; the reordered strokes are distributed over the glyphs in
+  their new order, so with the word and message orders a segment may
+  end up in another KankerAbbGlyph than the one it belongs to. Joining
+  (see below) can then remove segments from a glyph, or all of them.
+  KankerAbbPacker decides afterwards which glyphs are sent together in
+  one draw command.
+
+  After reordering we join strokes: when a stroke starts within
+  `join_tolerance` of where the previous stroke ends, and both are in
+  the same word, we append its points to the previous stroke. The
+  robot then keeps the lamp on and blends through the join instead of
+  switching the lamp off, stopping in a `fine` point and switching it
+  on again. The joined stroke can belong to the previous glyph, so a
+  glyph may lose segments or end up without any. We don't join when
+  the joined stroke could need more than `join_max_packets` packets on
+  the ABB, so it still fits in one bank. A point can need two packets:
+  the move and the ABB_CMD_ZONE before it, see getMaxStrokePackets().
+
+  The travel before and after optimizing is stored in `travel_before`
+  and `travel_after`.
+
+ */
+#ifndef KANKER_STROKE_OPTIMIZER_H
+#define KANKER_STROKE_OPTIMIZER_H
+
+#include <vector>
+
+#define ROXLU_USE_MATH
+#define ROXLU_USE_LOG
+#include <tinylib.h>
+
+#define KANKER_STROKE_ORDER_NONE 0
+#define KANKER_STROKE_ORDER_GLYPH 1
+#define KANKER_STROKE_ORDER_WORD 2
+#define KANKER_STROKE_ORDER_MESSAGE 3
+
+class KankerAbbGlyph;
+
+/* ---------------------------------------------------------------------- */
+
+class KankerStroke {
+ public:
+  KankerStroke();
+
+ public:
+  size_t glyph;                                              /* Index of the KankerAbbGlyph that contains the stroke. */
+  size_t segment;                                            /* Index of the segment in the glyph. */
+  size_t group;                                              /* Strokes can only be reordered inside the same group. */
+  bool is_reversed;                                          /* When true, the stroke is drawn from the last to the first point. */
+  vec3 start;                                                /* The first point of the stroke (not reversed). */
+  vec3 end;                                                  /* The last point of the stroke (not reversed). */
+};
+
+/* ---------------------------------------------------------------------- */
+
+class KankerStrokeOptimizer {
+ public:
+  KankerStrokeOptimizer();
+  int optimize(std::vector<KankerAbbGlyph>& glyphs);         /* Reorders the strokes of the message to minimize the pen-up travel. Returns 0 on success, < 0 on error. */
+  float getTravel(std::vector<KankerAbbGlyph>& glyphs);      /* Returns the total distance the pen moves between strokes, in the order they will be sent. */
+  int join(std::vector<KankerAbbGlyph>& glyphs);             /* Joins the strokes that start where the previous one ends; called by optimize(). Returns 0 on success, < 0 on error. */
+  size_t getMaxStrokePackets(size_t numPoints);             /* Returns the maximum number of packets KankerAbb::addSegmentCommands() creates for a stroke with the given number of points. */
+
+ private:
+  void optimizeGroup(size_t first, size_t last);             /* Optimizes the route of `strokes[first]` till `strokes[last - 1]`. */
+  void nearestNeighbour(size_t first, size_t last);          /* Builds an initial route with a nearest neighbour search. */
+  bool twoOpt(size_t first, size_t last);                    /* Reverses parts of the route when that shortens it; returns true when it improved the route. */
+  bool orOpt(size_t first, size_t last);                     /* Moves chains of 1-3 strokes to a better position; returns true when it improved the route. */
+  float getGroupTravel(size_t first, size_t last);           /* The pen-up travel of a route, including the move from the previous group. */
+  float getArrival(size_t first, size_t dx);                 /* The distance the pen travels to the start of the stroke at `dx`. */
+  vec3& getStart(size_t dx);                                 /* The position where the stroke at the given position in the route starts, taking reversing into account. */
+  vec3& getEnd(size_t dx);                                   /* The position where the stroke at the given position in the route ends, taking reversing into account. */
+  void reverseRange(size_t a, size_t b);                     /* Reverses the order and direction of the strokes a till b (inclusive). */
+
+ public:
+  int order;                                                 /* Which strokes may be swapped, KANKER_STROKE_ORDER_GLYPH by default. */
+  bool allow_reverse;                                        /* When true we may draw a stroke from the last to the first point; also needed for 2-opt. */
+  int max_passes;                                            /* The maximum number of 2-opt / Or-opt passes per group. */
+  float travel_before;                                       /* The pen-up travel of the last message before we optimized it. */
+  float travel_after;                                        /* The pen-up travel of the last message after we optimized it. */
+  float join_tolerance;                                      /* Strokes which start closer than this to the end of the previous stroke are joined, in the same units as the points; 0 disables joining. */
+  size_t join_max_packets;                                   /* The maximum number of packets a joined stroke may need, ABB_BANK_PACKETS by default so it fits in a bank and in a draw. */
+  size_t num_joins;                                          /* The number of joins in the last message. */
+  std::vector<KankerStroke> strokes;                         /* The strokes of the message, in route order. */
+  std::vector<KankerStroke> scratch;                         /* Used while moving strokes. */
+  std::vector<std::vector<vec3> > segments;                  /* Used to rebuild the segments of the glyphs in route order. */
+  std::vector<char> is_used;                                 /* Used by the nearest neighbour search. */
+  vec3 group_start;                                          /* The end of the previous group, where the pen is when we start with a group. */
+  bool has_group_start;                                      /* False for the first group. */
+};
+
+/* ---------------------------------------------------------------------- */
+
+inline vec3& KankerStrokeOptimizer::getStart(size_t dx) {
+  return (strokes[dx].is_reversed) ? strokes[dx].end : strokes[dx].start;
+}
+
+inline vec3& KankerStrokeOptimizer::getEnd(size_t dx) {
+  return (strokes[dx].is_reversed) ? strokes[dx].start : strokes[dx].end;
+}
+
+#endif
@@ -0,0 +1,114 @@
+/*
+  LockFreeQueue
+  -------------
+
+  Fixed size ring buffer that hands over items from one thread to
+  another without locks. There must be exactly one thread that calls
+  push() (the producer) and one thread that calls pop() (the consumer).
+
+  The producer only writes `tail` and the consumer only writes `head`.
+  The item is written before `tail` is stored and read before `head`
+  is stored, so the other thread never sees a half written item. We
+  keep `head` and `tail` on their own cache line so the two threads
+  don't invalidate each others cache when they update them.
+
+  The capacity is rounded up to a power of two; push() fails when the
+  queue is full, it never allocates.
+
+*/
+#ifndef ROXLU_LOCK_FREE_QUEUE_H
+#define ROXLU_LOCK_FREE_QUEUE_H
+
+#include <kanker/Thread.h>
+
+#define LOCK_FREE_QUEUE_CACHE_LINE 64                                         /* We keep `head` and `tail` this far apart. */
+
+/* ------------------------------------------------------------------------- */
+
+template<class T>
+class LockFreeQueue {
+ public:
+  LockFreeQueue(size_t capacity);
+  ~LockFreeQueue();
+  int push(const T& item);                                                    /* Producer only. Copies the item into the queue. Returns 0 on success, -1 when the queue is full. */
+  int pop(T& item);                                                           /* Consumer only. Moves the oldest item into `item`. Returns 0 on success, -1 when the queue is empty. */
+  size_t size();                                                              /* The number of items in the queue; only exact when called by the producer or consumer while the other one is idle. */
+
+ private:
+  LockFreeQueue(const LockFreeQueue& other);                                  /* Not copyable; the threads use the same instance. */
+  LockFreeQueue& operator=(const LockFreeQueue& other);
+
+ public:
+  T* items;                                                                   /* The slots of the ring buffer. */
+  size_t capacity;                                                            /* The number of slots, a power of two. */
+  size_t mask;                                                                /* `capacity - 1`, to get the slot of a position. */
+  char padding_head[LOCK_FREE_QUEUE_CACHE_LINE];
+  volatile size_t head;                                                       /* The position we pop next; written by the consumer. */
+  char padding_tail[LOCK_FREE_QUEUE_CACHE_LINE - sizeof(size_t)];
+  volatile size_t tail;                                                       /* The position we push next; written by the producer. */
+  char padding_end[LOCK_FREE_QUEUE_CACHE_LINE - sizeof(size_t)];
+};
+
+/* ------------------------------------------------------------------------- */
+
+template<class T>
+LockFreeQueue<T>::LockFreeQueue(size_t cap)
+  :items(NULL)
+  ,capacity(1)
+  ,mask(0)
+  ,head(0)
+  ,tail(0)
+{
+  while (capacity < cap) {
+    capacity <<= 1;
+  }
+
+  mask = capacity - 1;
+  items = new T[capacity];
+}
+
+template<class T>
+LockFreeQueue<T>::~LockFreeQueue() {
+  delete[] items;
+  items = NULL;
+}
+
+/* The positions only grow; because the capacity is a power of two `tail - head` is correct when they wrap around. */
+template<class T>
+int LockFreeQueue<T>::push(const T& item) {
+
+  size_t t = tail;
+
+  if (t - thread_atomic_load(&head) >= capacity) {
+    return -1;
+  }
+
+  items[t & mask] = item;
+  thread_atomic_store(&tail, t + 1);
+
+  return 0;
+}
+
+template<class T>
+int LockFreeQueue<T>::pop(T& item) {
+
+  size_t h = head;
+
+  if (h == thread_atomic_load(&tail)) {
+    return -1;
+  }
+
+  /* We reset the slot so it doesn't hold on to e.g. the memory of a string. */
+  item = items[h & mask];
+  items[h & mask] = T();
+  thread_atomic_store(&head, h + 1);
+
+  return 0;
+}
+
+template<class T>
+size_t LockFreeQueue<T>::size() {
+  return thread_atomic_load(&tail) - thread_atomic_load(&head);
+}
+
+#endif
@@ -4,6 +4,19 @@
 
   Client socket implementation we use to connect to the ABB. 
 
+  connect() blocks until we're connected or the timeout expired. To
+  connect without blocking, call startConnect() and then updateConnect()
+  until isConnecting() returns false; the listener gets
+  onSocketConnected() when the connection is made. The address of the
+  host is resolved once and cached, because resolving can block. We
+  set TCP_NODELAY and SO_KEEPALIVE by default.
+
+  The socket is non-blocking once connected. send() appends the data to
+  a queue of Buffers and writes as much as the socket accepts; call
+  flush() when the socket is writable to send the rest. When more than
+  `high_water` bytes are queued the listener gets onSocketHighWater(),
+  and onSocketDrained() once everything has been sent.
+
 */
 #ifndef ROXLU_SOCKET_H
 #define ROXLU_SOCKET_H
@@ -28,10 +41,20 @@
 
 #include <stdint.h>
 #include <string>
+#include <deque>
+#include <vector>
+#include <kanker/Buffer.h>
 
 #define ROXLU_USE_LOG
 #include <tinylib.h>
 
+#define SOCKET_MAX_IOV 16                                                     /* The maximum number of queued buffers we write with one call. */
+#define SOCKET_DEFAULT_HIGH_WATER (64 * 1024)                                 /* The default for `Socket::high_water`. */
+#define SOCKET_DEFAULT_CONNECT_TIMEOUT 3000                                   /* The default timeout of connect(), in milliseconds. */
+#define SOCKET_DEFAULT_KEEPALIVE_IDLE 10                                      /* The default for `Socket::keepalive_idle`, in seconds. */
+#define SOCKET_DEFAULT_KEEPALIVE_INTERVAL 5                                   /* The default for `Socket::keepalive_interval`, in seconds. */
+#define SOCKET_KEEPALIVE_PROBES 3                                             /* The number of keepalive probes without answer before the connection is dropped. */
+
 /* ------------------------------------------------------------------------- */
 
 int socket_init();                                                           /* Must be called by user once to initialize the socket library. */
@@ -45,6 +68,19 @@ class SocketListener {
  public:
   virtual void onSocketConnected() {}                                        /* Gets called when the socket is connected. */
   virtual void onSocketDisconnected() {}                                     /* Gets called when the socket is disconnected. */   
+  virtual void onSocketHighWater(size_t) {}                                  /* Gets called when the number of queued bytes grows above `high_water`. */
+  virtual void onSocketDrained() {}                                          /* Gets called when all queued bytes have been sent after we reached the high water mark. */
+};
+
+/* ------------------------------------------------------------------------- */
+
+class SocketAddress {
+ public:
+  struct sockaddr_storage addr;                                               /* The address, as returned by getaddrinfo(). */
+  socklen_t length;                                                           /* The size of `addr` we use. */
+  int family;
+  int socktype;
+  int protocol;
 };
 
 /* ------------------------------------------------------------------------- */
@@ -53,21 +89,52 @@ class Socket {
  public:
   Socket();
   ~Socket();
-  int connect(std::string host, uint16_t port);                               /* Connect to the HOST and PORT. Make sure to set the listener before calling init() if you want to handle disconnect events. */  
+  int connect(std::string host, uint16_t port, int timeoutMillis = SOCKET_DEFAULT_CONNECT_TIMEOUT); /* Connect to the HOST and PORT; blocks at most `timeoutMillis`. Make sure to set the listener before calling init() if you want to handle disconnect events. */  
+  int startConnect(std::string host, uint16_t port);                          /* Starts to connect without blocking. Returns 0 when we're connecting or connected, < 0 on error. */
+  int updateConnect(int waitMillis);                                          /* Waits at most `waitMillis` for the connect we started. Returns 0 when connected or still connecting (see isConnecting()), < 0 when we couldn't connect to any address. */
+  bool isConnecting();                                                        /* Returns true while a connect we started hasn't finished yet. */
   int close();                                                                /* Close the socket when it's created. */
-  int send(const char* data, int nbytes);                                     /* Send the given data. */                          
+  int send(const char* data, int nbytes);                                     /* Queues a copy of the given data and sends as much as possible. Returns 0 on success (also when data is left in the queue), < 0 on error. */
+  int send(Buffer& buffer);                                                   /* Queues the data of the buffer without copying it; `buffer` is empty afterwards. */
   int send(const std::string& data);                                          /* Send the given string. */
   int send(const char* data);                                                 /* Send the given string (must be null terminated). */
   int send(const uint8_t* data, int nbytes);                                  /* Send the given buffer of `nbytes`. */
   int read(char* buffer, int nbytes);                                         /* Read bytes into the given buffer of `nbytes` size. */
   int canRead(int sec, int usec);                                             /* Check if there is data available on the socket but timeout after `sec` and/or `usec` */ 
   int isConnected();                                                          /* Returns `0` when the socket is connected to the remote host. */
+  int flush();                                                                /* Sends as much of the queued data as the socket accepts. Returns 0 on success (also when data is left in the queue), < 0 on error. */
+  size_t getQueuedBytes();                                                    /* Returns the number of bytes that still need to be sent. */
+  bool hasQueuedData();                                                       /* Returns true when there is data in the send queue. */
+  bool isAboveHighWater();                                                    /* Returns true from the moment we reached `high_water` until the queue is empty again. */
 
   int setListener(SocketListener* listener);
+
+ private:
+  int setNonBlocking();                                                       /* Makes the socket non-blocking, is done before connecting. */
+  int setOptions();                                                           /* Sets TCP_NODELAY and keepalive, when enabled. */
+  int resolve(std::string host, uint16_t port);                               /* Fills `addresses` unless we already resolved this host and port. */
+  int connectNextAddress();                                                   /* Starts to connect to `addresses[address_index]` or the next one that works. */
+  int finishConnect();                                                        /* Is called when we're connected. */
+  int closeHandle();                                                          /* Closes the handle, but keeps the send queue. */
+  void queue(Buffer& buffer);                                                 /* Appends the buffer to the queue and checks the high water mark. */
                                                                               
  public:                                                                      
   SOCKET_HANDLE handle;                                                       /* Reference to the OS specific socket handle, e.g. int on Posix and SOCKET on windows. */
   SocketListener* listener;
+  std::deque<Buffer> send_queue;                                              /* The data we still need to send. */
+  size_t send_offset;                                                         /* The number of bytes of the first buffer in the queue we've already sent. */
+  size_t queued_bytes;                                                        /* The number of bytes in the queue we still need to send. */
+  size_t high_water;                                                          /* When more bytes are queued we call onSocketHighWater(). */
+  bool is_above_high_water;                                                   /* True after we reached `high_water` until the queue is empty. */
+  std::string cached_host;                                                    /* The host we resolved into `addresses`. */
+  uint16_t cached_port;                                                       /* The port we resolved into `addresses`. */
+  std::vector<SocketAddress> addresses;                                       /* The addresses of `cached_host`. */
+  size_t address_index;                                                       /* The address we're connecting to. */
+  bool is_connecting;                                                         /* True while a non-blocking connect is in progress. */
+  bool use_nodelay;                                                           /* When true (default) we disable Nagle's algorithm, so small frames are sent right away. */
+  bool use_keepalive;                                                         /* When true (default) the OS detects a peer that went away without closing the connection. */
+  int keepalive_idle;                                                         /* The seconds without data before we send the first keepalive probe; where the OS supports it. */
+  int keepalive_interval;                                                     /* The seconds between the keepalive probes; where the OS supports it. */
 }; 
 
 /* ------------------------------------------------------------------------- */
@@ -84,7 +151,23 @@ inline int Socket::setListener(SocketListener* lis) {
 }
 
 inline int Socket::isConnected() {
-  return (handle >= 0) ? 0 : -1;
+  return (handle >= 0 && false == is_connecting) ? 0 : -1;
+}
+
+inline bool Socket::isConnecting() {
+  return is_connecting;
+}
+
+inline size_t Socket::getQueuedBytes() {
+  return queued_bytes;
+}
+
+inline bool Socket::hasQueuedData() {
+  return 0 != queued_bytes;
+}
+
+inline bool Socket::isAboveHighWater() {
+  return is_above_high_water;
 }
 
 inline int Socket::send(const std::string& data) {
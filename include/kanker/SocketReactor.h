@@ -0,0 +1,62 @@
+/*
+  SocketReactor
+  -------------
+
+  Sleeps until a socket is readable or writable, until another thread
+  calls wakeup(), or until a timeout expires. Used by KankerAbb::poll()
+  so a headless process doesn't have to spin on update(). On Linux we
+  use epoll, on other platforms we fall back to select().
+
+  The socket we watch can change, e.g. after a reconnect; pass the
+  current handle to wait() and we update the registration. With an
+  invalid handle (-1) wait() only waits for wakeup() or the timeout.
+
+  wakeup() may be called from any thread, also when nobody is waiting;
+  the next wait() returns right away then. We use an eventfd on Linux,
+  a pipe on other POSIX systems and a connected pair of loopback sockets
+  on Windows, where select() only accepts sockets. Call init() before
+  you share the reactor with another thread.
+
+*/
+#ifndef ROXLU_SOCKET_REACTOR_H
+#define ROXLU_SOCKET_REACTOR_H
+
+#include <kanker/Socket.h>
+
+#define SOCKET_EVENT_NONE   0x00
+#define SOCKET_EVENT_READ   0x01                                              /* Wait until the socket is readable (or closed by the remote). */
+#define SOCKET_EVENT_WRITE  0x02                                              /* Wait until we can write to the socket. */
+#define SOCKET_EVENT_ERROR  0x04                                              /* Returned by wait() when the socket has an error or was hung up. */
+#define SOCKET_EVENT_WAKEUP 0x08                                              /* Returned by wait() when wakeup() was called. */
+
+/* ------------------------------------------------------------------------- */
+
+class SocketReactor {
+ public:
+  SocketReactor();
+  ~SocketReactor();
+  int init();                                                                 /* Creates the epoll instance and the wakeup handle; wait() calls this when needed. Returns 0 on success, < 0 on error. */
+  int shutdown();                                                             /* Closes the epoll instance and the wakeup handle. */
+  int wait(SOCKET_HANDLE fd, int events, int timeoutMillis);                  /* Waits at most `timeoutMillis` (< 0 = forever) for `events` on `fd` or for wakeup(). Returns the SOCKET_EVENT_* flags that are set, 0 on timeout or when interrupted by a signal, < 0 on error. */
+  int wakeup();                                                               /* Makes the current or next wait() return with SOCKET_EVENT_WAKEUP; thread safe. Returns 0 on success, < 0 on error. */
+
+ private:
+  SocketReactor(const SocketReactor& other);                                  /* Not copyable; we own the epoll instance and the wakeup handle. */
+  SocketReactor& operator=(const SocketReactor& other);
+  void drainWakeup();                                                         /* Resets the wakeup handle after wait() saw it. */
+
+#if defined(__linux)
+  int watch(SOCKET_HANDLE fd, int events);                                    /* Adds or updates the registration of `fd`. */
+
+ public:
+  int epoll_fd;                                                               /* The epoll instance. */
+  SOCKET_HANDLE watched_fd;                                                   /* The socket that was registered last. */
+  int wake_fd;                                                                /* The eventfd that wakeup() writes to. */
+#else
+
+ public:
+  SOCKET_HANDLE wake_fds[2];                                                  /* wait() reads from [0], wakeup() writes to [1]. */
+#endif
+};
+
+#endif
@@ -0,0 +1,90 @@
+/*
+  Thread
+  ------
+
+  Minimal wrapper around pthreads and Win32 threads; used by
+  KankerAbbController to run the communication with the ABB on its own
+  thread. We also define the atomic load and store that LockFreeQueue
+  uses to hand over data between two threads.
+
+*/
+#ifndef ROXLU_THREAD_H
+#define ROXLU_THREAD_H
+
+#if defined(_WIN32)
+#  if !defined(WIN32_LEAN_AND_MEAN)
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#  include <intrin.h>
+#else
+#  include <pthread.h>
+#endif
+
+#include <stddef.h>
+
+#define ROXLU_USE_LOG
+#include <tinylib.h>
+
+typedef void(*thread_function)(void* user);
+
+/* ------------------------------------------------------------------------- */
+
+size_t thread_atomic_load(volatile size_t* value);                           /* Reads a value that is written by another thread; what was written before the matching store is visible after this load (acquire). */
+void thread_atomic_store(volatile size_t* value, size_t v);                  /* Writes a value that is read by another thread, after everything we wrote before (release). */
+void thread_sleep_millis(int millis);                                        /* Sleeps the calling thread. */
+
+/* ------------------------------------------------------------------------- */
+
+class Thread {
+ public:
+  Thread();
+  ~Thread();
+  int create(thread_function func, void* user);                               /* Starts a thread that calls `func(user)`. Returns 0 on success, < 0 on error. */
+  int join();                                                                 /* Waits until the thread function returned. */
+  bool isRunning();                                                           /* Returns true between create() and join(). */
+
+ public:
+  thread_function function;                                                   /* The function the thread runs. */
+  void* user;                                                                 /* Is passed into `function`. */
+  bool is_running;                                                            /* True between create() and join(). */
+#if defined(_WIN32)
+  HANDLE handle;
+#else
+  pthread_t handle;
+#endif
+};
+
+/* ------------------------------------------------------------------------- */
+
+inline bool Thread::isRunning() {
+  return is_running;
+}
+
+#if defined(_MSC_VER)
+
+/* On x86 a load is never reordered with the loads after it and a store never with the stores before it; we only have to stop the compiler from doing so. */
+inline size_t thread_atomic_load(volatile size_t* value) {
+  size_t v = *value;
+  _ReadWriteBarrier();
+  return v;
+}
+
+inline void thread_atomic_store(volatile size_t* value, size_t v) {
+  _ReadWriteBarrier();
+  *value = v;
+}
+
+#else
+
+inline size_t thread_atomic_load(volatile size_t* value) {
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+inline void thread_atomic_store(volatile size_t* value, size_t v) {
+  __atomic_store_n(value, v, __ATOMIC_RELEASE);
+}
+
+#endif
+
+#endif
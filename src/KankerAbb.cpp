@@ -1,11 +1,26 @@
+#include <float.h>
 #include <kanker/KankerAbb.h>
 
 /* ---------------------------------------------------------------------- */
 template <class T> int read_xml(xml_node<>* node, std::string name, T defaultval, T& result);
 /* ---------------------------------------------------------------------- */
 
+static float kanker_abb_segment_distance(const vec3& p, const vec3& a, const vec3& b);
+static float kanker_abb_removal_area(std::vector<vec3>& points, size_t a, size_t b, size_t c, float tolerance);
+static bool kanker_abb_is_within_tolerance(std::vector<vec3>& points, size_t a, size_t c, float tolerance);
+static void kanker_abb_merge_close_points(std::vector<vec3>& points, std::vector<char>& keep, float minDist, float tolerance);
+static float kanker_abb_read_float(const uint8_t* data);
+static uint8_t kanker_abb_get_zone(const vec3& from, const vec3& corner, const vec3& to, int zoneMax);
+static bool kanker_abb_get_delta(const vec3& from, const vec3& to, int16_t* delta);
+static int16_t kanker_abb_read_s16(const uint8_t* data);
+
+/* ---------------------------------------------------------------------- */
+
 KankerAbbGlyph::KankerAbbGlyph() 
   :glyph(0)
+  ,pen_x(0.0f)
+  ,pen_y(0.0f)
+  ,word(0)
 {
 }
 
@@ -15,6 +30,163 @@ KankerAbbGlyph::~KankerAbbGlyph() {
 
 /* ---------------------------------------------------------------------- */
 
+KankerAbbCommand::KankerAbbCommand()
+  :type(ABB_CMD_POSITION)
+  ,rot_z(0.0f)
+  ,zone(ABB_ZONE_FINE)
+{
+}
+
+/* ---------------------------------------------------------------------- */
+
+KankerAbbPen::KankerAbbPen()
+  :x(0.0f)
+  ,y(0.0f)
+  ,width_available(0.0f)
+  ,word(0)
+{
+}
+
+/* ---------------------------------------------------------------------- */
+
+KankerAbbPreparedGlyph::KankerAbbPreparedGlyph()
+  :glyph(0)
+  ,simplified(0)
+  ,is_prepared(false)
+{
+}
+
+/* ---------------------------------------------------------------------- */
+
+KankerAbbGlyphCache::KankerAbbGlyphCache()
+  :font(NULL)
+  ,font_revision(0)
+  ,x_height(0.0f)
+  ,char_scale(0.0f)
+  ,min_point_dist(0.0f)
+  ,simplify_mode(ABB_SIMPLIFY_MIN_DIST)
+  ,simplify_tolerance(0.0f)
+{
+}
+
+void KankerAbbGlyphCache::clear() {
+  glyphs.clear();
+  advances.clear();
+  font = NULL;
+  font_revision = 0;
+}
+
+bool KankerAbbGlyphCache::isValid(KankerFont& f, float xHeight, float charScale, float minPointDist, int simplifyMode, float simplifyTolerance) {
+  return font == &f
+    && font_revision == f.revision
+    && x_height == xHeight
+    && char_scale == charScale
+    && min_point_dist == minPointDist
+    && simplify_mode == simplifyMode
+    && simplify_tolerance == simplifyTolerance;
+}
+
+void KankerAbbGlyphCache::reset(KankerFont& f, float xHeight, float charScale, float minPointDist, int simplifyMode, float simplifyTolerance) {
+
+  glyphs.clear();
+  glyphs.resize(f.size());
+  advances.clear();
+
+  font = &f;
+  font_revision = f.revision;
+  x_height = xHeight;
+  char_scale = charScale;
+  min_point_dist = minPointDist;
+  simplify_mode = simplifyMode;
+  simplify_tolerance = simplifyTolerance;
+
+  updateAdvances();
+}
+
+void KankerAbbGlyphCache::updateAdvances() {
+
+  /* This is the same as KankerGlyph::normalize(). */
+  float inv = 1.0f / x_height;
+
+  for (size_t i = advances.size(); i < font->glyphs.size(); ++i) {
+    advances.push_back(font->glyphs[i].advance_x * inv);
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
+KankerAbbWordCache::KankerAbbWordCache()
+  :capacity(ABB_WORD_CACHE_SIZE)
+  ,font(NULL)
+  ,font_revision(0)
+  ,x_height(0.0f)
+{
+}
+
+void KankerAbbWordCache::clear() {
+  words.clear();
+  lookup.clear();
+  font = NULL;
+  font_revision = 0;
+}
+
+bool KankerAbbWordCache::isValid(KankerFont& f, float xHeight) {
+  return font == &f
+    && font_revision == f.revision
+    && x_height == xHeight;
+}
+
+void KankerAbbWordCache::reset(KankerFont& f, float xHeight) {
+
+  words.clear();
+  lookup.clear();
+
+  font = &f;
+  font_revision = f.revision;
+  x_height = xHeight;
+}
+
+bool KankerAbbWordCache::find(const std::string& word, float& width) {
+
+  std::map<std::string, std::list<std::pair<std::string, float> >::iterator>::iterator it = lookup.find(word);
+  if (it == lookup.end()) {
+    return false;
+  }
+
+  /* Move to the front, this is now the most recently used word. */
+  if (it->second != words.begin()) {
+    words.splice(words.begin(), words, it->second);
+  }
+
+  width = it->second->second;
+
+  return true;
+}
+
+void KankerAbbWordCache::insert(const std::string& word, float width) {
+
+  if (0 == capacity) {
+    return;
+  }
+
+  std::map<std::string, std::list<std::pair<std::string, float> >::iterator>::iterator it = lookup.find(word);
+  if (it != lookup.end()) {
+    it->second->second = width;
+    words.splice(words.begin(), words, it->second);
+    return;
+  }
+
+  words.push_front(std::pair<std::string, float>(word, width));
+  lookup[word] = words.begin();
+
+  while (words.size() > capacity) {
+    lookup.erase(words.back().first);
+    words.pop_back();
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
 KankerAbb::KankerAbb() 
   :offset_x(0.0f)
   ,offset_y(0.0f)
@@ -26,20 +198,35 @@ KankerAbb::KankerAbb()
   ,min_y(0)
   ,max_y(0)
   ,min_point_dist(3.0)
+  ,simplify_mode(ABB_SIMPLIFY_MIN_DIST)
+  ,simplify_tolerance(1.0f)
+  ,zone_max(10)
+  ,delta_positions(false)
+  ,keyframe_interval(ABB_KEYFRAME_INTERVAL)
+  ,optimize_commands(true)
   ,check_abb_state_timeout(0)
   ,check_abb_state_delay(10e9)
   ,abb_reconnect_timeout(0)
   ,abb_reconnect_delay(10e9)
+  ,abb_connect_timeout(0)
+  ,abb_connect_delay(3e9)
   ,abb_state(ABB_STATE_DISCONNECTED)
   ,abb_listener(NULL)
   ,curr_glyph_index(0)
+  ,curr_batch_index(0)
+  ,curr_packets_drawn(0)
+  ,curr_packets_total(0)
+  ,is_batch_deferred(false)
+  ,message_start_time(0)
+  ,swipe_count(0)
+  ,swipe_type(0)
 {
   memset(read_buffer, 0x00, sizeof(read_buffer));
 }
 
 KankerAbb::~KankerAbb() {
 
-  if (0 == sock.isConnected()) {
+  if (0 == sock.isConnected() || sock.isConnecting()) {
     sock.close();
   }
 }
@@ -51,13 +238,9 @@ int KankerAbb::write(KankerFont& font,
 {
   std::stringstream ss;
   std::string word;
-  bool has_newline = false;
-  float pen_x = 0;
-  float pen_y = 0;
-  float word_width = 0;
+  KankerAbbPen pen;
   float width_available = getRangeWidth();
   float height_available = getRangeHeight();
-  float x_height = 0.0f;
 
   if (0.0f == width_available) { RX_ERROR("Range width not yet set, call init() first.");  return -1;  }
   if (0.0f == height_available) { RX_ERROR("Range height not yet set, call init() first.");  return -2;  }
@@ -68,81 +251,106 @@ int KankerAbb::write(KankerFont& font,
     result.clear();
   }
 
-  if (0 != font.getBaseHeight(x_height)) {
-    RX_ERROR("Failed to retrieve the base height for the font so we cannot normalize it.");
+  if (0 != updateGlyphCache(font)) {
     return -4;
   }
 
+  pen.width_available = width_available;
   ss << str;
 
   while (ss >> word) {
+    if (0 != writeWord(font, word, pen, result, segmentsOut)) {
+      break;
+    }
+  }
+
+  return 0;
+}
+
+int KankerAbb::writeWord(KankerFont& font,
+                         std::string& word,
+                         KankerAbbPen& pen,
+                         std::vector<KankerAbbGlyph>& result,
+                         std::vector<std::vector<vec3> >& segmentsOut)
+{
+  /* Does this word fit on the current line? */
+  float word_width = getWordWidth(font, word);
+  float left = pen.width_available - word_width;
 
-    /* Does this word fit on the current line? */
-    word_width = getWordWidth(font, word);
-    float left = width_available - word_width;
+  if (left > 0) {
+    pen.width_available -= word_width;
+  }
+  else {
+    pen.x = 0;
+    pen.y += line_height;
+    pen.width_available = getRangeWidth() - word_width;
+  }
 
-    if (left > 0) {
-      width_available -= word_width;
+  /* Generate vertices for this word. */
+  for (size_t i = 0; i < word.size(); ++i) {
+      
+    KankerAbbPreparedGlyph* prepared = getPreparedGlyph(font, word[i]);
+    if (NULL == prepared) {
+      RX_ERROR("Cannot find the glyph for `%c`.", word[i]);
+      continue;
     }
-    else {
-      has_newline = true;
-      pen_x = 0;
-      pen_y += line_height;
-      width_available = getRangeWidth() - word_width;
+
+    result.push_back(KankerAbbGlyph());
+    KankerAbbGlyph& abb_glyph = result.back();
+    positionGlyph(*prepared, pen.x, pen.y, abb_glyph);
+    abb_glyph.word = pen.word;
+
+    for (size_t k = 0; k < abb_glyph.segments.size(); ++k) {
+      segmentsOut.push_back(abb_glyph.segments[k]);
     }
 
-    /* Generate vertices for this word. */
-    for (size_t i = 0; i < word.size(); ++i) {
-      
-      KankerGlyph* glyph_ptr = font.getGlyphByCharCode(word[i]);
-      if (NULL == glyph_ptr) {
-        RX_ERROR("Cannot find the glyph for `%c`, not supposed to happen.", word[i]);
-        continue;
-      }
+    pen.x += abb_glyph.glyph.advance_x;
+  }
+
+  pen.word++;
+
+  /* Do we need to start the next wordt on a new line? */
+  if (pen.width_available < word_spacing) {
+    pen.x = 0;
+    pen.y += line_height;
+    pen.width_available = getRangeWidth();
+  }
+  else {
+    pen.x += word_spacing;
+    pen.width_available -= word_spacing;
+  }
 
-      KankerAbbGlyph abb_glyph;
-      abb_glyph.glyph = *glyph_ptr;
-      abb_glyph.glyph.normalize(x_height);
-      abb_glyph.glyph.flipHorizontal();     
-      abb_glyph.glyph.alignLeft();
-      abb_glyph.glyph.scale(char_scale);
-      abb_glyph.glyph.translate(pen_x + offset_x, pen_y + offset_y);
+  /* Do we still have enough space for a next line? */
+  if ((getRangeHeight() - (pen.y + line_height)) < 0) {
+    RX_ERROR("Message is to big to fit in the available space. Stopping with writing now.\n");
+    return -1;
+  }
 
-      /* Copy the simplified version into our abb_glyph copy before adding it to the result. */
-      for (size_t k = 0; k < abb_glyph.glyph.segments.size(); ++k) {
+  return 0;
+}
 
-        std::vector<vec3> simplified_segment = simplify(abb_glyph.glyph.segments[k], min_point_dist);
-        if (0 == simplified_segment.size()) {
-          RX_VERBOSE("After simplifying the segment we haven't got anythin left.");
-          continue;
-        }
+int KankerAbb::positionGlyph(KankerAbbPreparedGlyph& prepared, float penX, float penY, KankerAbbGlyph& out) {
 
-        abb_glyph.segments.push_back(simplified_segment);
-        segmentsOut.push_back(simplified_segment);
-      }
+  /* The cached glyph is already transformed and simplified; we only have to move it to the pen position. */
+  float tx = penX + offset_x;
+  float ty = penY + offset_y;
+  KankerGlyph& simplified = prepared.simplified;
 
-      result.push_back(abb_glyph);
-      pen_x += abb_glyph.glyph.advance_x;
-    }
+  out.pen_x = penX;
+  out.pen_y = penY;
+  out.glyph = prepared.glyph;
+  out.glyph.translate(tx, ty);
+  out.segments.resize(simplified.getNumSegments());
 
-    /* Do we need to start the next wordt on a new line? */
-    if (width_available < word_spacing) {
-      has_newline = true;
-      pen_x = 0;
-      pen_y += line_height;
-      width_available = getRangeWidth();
-    }
-    else {
-      pen_x += word_spacing;
-      width_available -= word_spacing;
-    }
+  for (size_t k = 0; k < simplified.getNumSegments(); ++k) {
 
-    has_newline = false;
-    
-    /* Do we still have enough space for a next line? */
-    if ((height_available - (pen_y + line_height)) < 0) {
-      RX_ERROR("Message is to big to fit in the available space. Stopping with writing now.\n");
-      break;
+    vec3* points = simplified.getSegmentPoints(k);
+    std::vector<vec3>& segment = out.segments[k];
+
+    segment.resize(simplified.getSegmentSize(k));
+
+    for (size_t j = 0; j < segment.size(); ++j) {
+      segment[j].set(points[j].x + tx, points[j].y + ty, points[j].z);
     }
   }
 
@@ -185,178 +393,547 @@ std::vector<vec3> KankerAbb::simplify(std::vector<vec3>& points, float minDist)
   return new_points;
 }
 
-float KankerAbb::getWordWidth(KankerFont& font, std::string word) {
-
-  float width = 0.0f;
-  float x_height = 0.0f;
+int KankerAbb::simplifySegment(std::vector<vec3>& in, std::vector<vec3>& out) {
 
-  if (0 == word.size()) {
-    return 0.0f;
-  }
+  out.clear();
 
-  if (0 != font.getBaseHeight(x_height)) {
-    RX_ERROR("Failed to retrieve the base height for the font so we cannot normalize it.");
-    return -4;
+  if (ABB_SIMPLIFY_MIN_DIST == simplify_mode) {
+    out = simplify(in, min_point_dist);
+    return 0;
   }
 
-  for (size_t i = 0; i < word.size(); ++i) {
-
-    if (!font.hasGlyph(word[i])) {
-      RX_ERROR("Glyph not found: %c", word[i]);
-      continue;
+  if (ABB_SIMPLIFY_DOUGLAS_PEUCKER == simplify_mode) {
+    if (0 != simplifyDouglasPeucker(in, simplify_tolerance, min_point_dist, out)) {
+      return -1;
     }
-
-    KankerGlyph* g = font.getGlyphByCharCode(word[i]);
-    if (NULL == g) {
-      RX_ERROR("Cannot get glyph by char code... not supposed to happen.");
-      continue;
+  }
+  else if (ABB_SIMPLIFY_VISVALINGAM == simplify_mode) {
+    if (0 != simplifyVisvalingam(in, simplify_tolerance, min_point_dist, out)) {
+      return -2;
     }
-
-    KankerGlyph glyph = *g;
-    glyph.normalize(x_height);
-    width += glyph.advance_x;
+  }
+  else {
+    RX_ERROR("Invalid simplify mode: %d", simplify_mode);
+    return -3;
   }
 
-  width *= char_scale;
-
-  return width;
+  return 0;
 }
 
-int KankerAbb::saveSettings(std::string filepath) {
-
-  if (0 == filepath.size()) {
-    RX_ERROR("Invalid filepath (empty).");
-    return -1;
-  }
+/*
+  Ramer-Douglas-Peucker. We keep the first and last point and split 
+  the segment at the point that is furthest away from the line between
+  them, until all points are closer then `tolerance`. We use a stack
+  instead of recursion. Points closer then `minDist` to the previous
+  point are merged afterwards, within the same tolerance.
+*/
+int KankerAbb::simplifyDouglasPeucker(std::vector<vec3>& in, float tolerance, float minDist, std::vector<vec3>& out) {
 
-  std::ofstream ofs(filepath.c_str(), std::ios::out);
-  if (!ofs.is_open()) {
-    RX_ERROR("Failed to open: %s", filepath.c_str());
-    return -2;
-  }
-  
-  ofs << "<config>" << std::endl
-      << "  <offset_x>" << offset_x << "</offset_x>" << std::endl
-      << "  <offset_y>" << offset_y << "</offset_y>" << std::endl 
-      << "  <char_scale>" << char_scale << "</char_scale>" << std::endl
-      << "  <word_spacing>" << word_spacing << "</word_spacing>" << std::endl
-      << "  <line_height>" << line_height << "</line_height>" << std::endl
-      << "  <abb_host>" << abb_host << "</abb_host>" << std::endl
-      << "  <abb_port>" << abb_port << "</abb_port>" << std::endl
-      << "  <min_x>" << min_x << "</min_x>" << std::endl
-      << "  <max_x>" << max_x << "</max_x>" << std::endl
-      << "  <min_y>" << min_y << "</min_y>" << std::endl
-      << "  <max_y>" << max_y << "</max_y>" << std::endl
-      << "  <min_point_dist>" << min_point_dist << "</min_point_dist>" << std::endl
-      << "</config>";
+  std::vector<char> keep;
+  std::vector<std::pair<size_t, size_t> > stack;
 
-  ofs.close();
-  
-  return 0;
-}
+  out.clear();
 
-int KankerAbb::loadSettings(std::string filepath) {
-  
-  if (!rx_file_exists(filepath)) {
-    RX_ERROR("Cannot find %s", filepath.c_str());
+  if (0 > tolerance) {
+    RX_ERROR("Invalid tolerance: %f", tolerance);
     return -1;
   }
 
-  std::ifstream ifs(filepath.c_str(), std::ios::in);
-  if(!ifs.is_open()) {
-    RX_ERROR("Cannot open the settings file.");
-    return -2;
+  if (3 > in.size()) {
+    out = in;
+    return 0;
   }
- 
-  std::string xml_str;
-  xml_str.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
 
-  if (0 == xml_str.size()) {
-    RX_ERROR("Settings file is empty.");
-    return -3;
-  }
+  keep.assign(in.size(), 0);
+  keep.front() = 1;
+  keep.back() = 1;
+  stack.push_back(std::pair<size_t, size_t>(0, in.size() - 1));
 
-  xml_document<> doc;
+  while (0 != stack.size()) {
 
-  try {
+    size_t first = stack.back().first;
+    size_t last = stack.back().second;
+    size_t furthest = first;
+    float max_dist = 0.0f;
 
-    doc.parse<0>((char*)xml_str.c_str());
-    
-    xml_node<>* cfg = doc.first_node("config");
-    read_xml<float>(cfg, "offset_x", 0, offset_x);
-    read_xml<float>(cfg, "offset_y", 0, offset_y);
-    read_xml<float>(cfg, "char_scale", 15.0f, char_scale);
-    read_xml<float>(cfg, "word_spacing", 40.0f, word_spacing);
-    read_xml<float>(cfg, "line_height", 35.0f, line_height);
-    read_xml<int>(cfg, "abb_port", 1025, abb_port);
-    read_xml<std::string>(cfg, "abb_host", "127.0.0.1", abb_host);
-    read_xml<int>(cfg, "min_x", 0, min_x);
-    read_xml<int>(cfg, "max_x", 0, max_x);
-    read_xml<int>(cfg, "min_y", 0, min_y);
-    read_xml<int>(cfg, "max_y", 0, max_y);
-    read_xml<float>(cfg, "min_point_dist", 0, min_point_dist);
+    stack.pop_back();
 
-    print();
+    for (size_t i = first + 1; i < last; ++i) {
+      float dist = kanker_abb_segment_distance(in[i], in[first], in[last]);
+      if (dist > max_dist) {
+        max_dist = dist;
+        furthest = i;
+      }
+    }
+
+    if (max_dist > tolerance) {
+      keep[furthest] = 1;
+      stack.push_back(std::pair<size_t, size_t>(first, furthest));
+      stack.push_back(std::pair<size_t, size_t>(furthest, last));
+    }
   }
-  catch (...) {
-    RX_ERROR("Caught xml exception.");
-    return -4;
+
+  kanker_abb_merge_close_points(in, keep, minDist, tolerance);
+
+  for (size_t i = 0; i < in.size(); ++i) {
+    if (keep[i]) {
+      out.push_back(in[i]);
+    }
   }
+
   return 0;
 }
 
-void KankerAbb::print() {
-
-  RX_VERBOSE("abb.offset_x: %f", offset_x);
-  RX_VERBOSE("abb.offset_y: %f", offset_y);
-  RX_VERBOSE("abb.range width: %f", getRangeWidth());
-  RX_VERBOSE("abb.range height: %f", getRangeHeight());
-  RX_VERBOSE("abb.char_scale: %f", char_scale);
-  RX_VERBOSE("abb.word_spacing: %f", word_spacing);
-  RX_VERBOSE("abb.line_height: %f", line_height);
-  RX_VERBOSE("abb.abb_host: %s", abb_host.c_str());
-  RX_VERBOSE("abb.abb_port: %u", abb_port);
-  RX_VERBOSE("abb.min_x: %d", min_x);
-  RX_VERBOSE("abb.max_x: %d", max_x);
-  RX_VERBOSE("abb.min_y: %d", min_y);
-  RX_VERBOSE("abb.max_y: %d", max_y);
-}
+/*
+  Visvalingam-Whyatt. We repeatedly remove the point that forms the 
+  triangle with the smallest area with its neighbours. The area alone 
+  doesn't tell us how far the result is from the original, so a point 
+  is only removed when all the original points between its neighbours 
+  stay within `tolerance` of the new line. Points closer then `minDist`
+  to the previous point are merged afterwards, within the same
+  tolerance.
+*/
+int KankerAbb::simplifyVisvalingam(std::vector<vec3>& in, float tolerance, float minDist, std::vector<vec3>& out) {
 
-/* ---------------------------------------------------------------------- */
+  std::vector<size_t> prev;
+  std::vector<size_t> next;
+  std::vector<float> area;
+  std::vector<char> keep;
+  size_t n = in.size();
 
-int KankerAbb::connect() {
+  out.clear();
 
-  if (0 == abb_host.size()) {
-    RX_ERROR("Cannot connect to abb because the `abb_host` member is not set.");
+  if (0 > tolerance) {
+    RX_ERROR("Invalid tolerance: %f", tolerance);
     return -1;
   }
 
-  if (0 == abb_port) {
-    RX_ERROR("Cannot connect to abb because the `abb_port` is not set.");
-    return -2;
+  if (3 > n) {
+    out = in;
+    return 0;
   }
 
-  if (0 != sock.setListener(this)) {
-    RX_ERROR("Couldn't set the socket listener.");
-    return -2;
+  prev.resize(n);
+  next.resize(n);
+  area.assign(n, FLT_MAX);
+  keep.assign(n, 1);
+
+  for (size_t i = 0; i < n; ++i) {
+    prev[i] = (0 == i) ? 0 : i - 1;
+    next[i] = i + 1;
   }
 
-  if (0 != sock.connect(abb_host, abb_port)) {
-    RX_ERROR("Couldn't connect to the ABB");
-    return -1;
+  /* The area is FLT_MAX for the end points and for points we can't remove. */
+  for (size_t i = 1; i < n - 1; ++i) {
+    area[i] = kanker_abb_removal_area(in, prev[i], i, next[i], tolerance);
   }
 
-  return 0;
-}
+  while (true) {
 
-int KankerAbb::update() {
+    size_t dx = 0;
+    float min_area = FLT_MAX;
 
-  /* When disconnected we try to reconnect every abb_reconnect_delay ns. */
-  if (ABB_STATE_DISCONNECTED == abb_state) {
-    uint64_t n = rx_hrtime();
-    if (n > abb_reconnect_timeout) {
-      if (0 != connect()) {
-        RX_ERROR("After being disconnected we couldn't reconnect");
+    for (size_t i = next[0]; i < n - 1; i = next[i]) {
+      if (area[i] < min_area) {
+        min_area = area[i];
+        dx = i;
+      }
+    }
+
+    if (0 == dx) {
+      break;
+    }
+
+    keep[dx] = 0;
+    next[prev[dx]] = next[dx];
+    prev[next[dx]] = prev[dx];
+
+    if (0 != prev[dx]) {
+      area[prev[dx]] = kanker_abb_removal_area(in, prev[prev[dx]], prev[dx], next[dx], tolerance);
+    }
+
+    if (n - 1 != next[dx]) {
+      area[next[dx]] = kanker_abb_removal_area(in, prev[dx], next[dx], next[next[dx]], tolerance);
+    }
+  }
+
+  kanker_abb_merge_close_points(in, keep, minDist, tolerance);
+
+  for (size_t i = 0; i < n; ++i) {
+    if (keep[i]) {
+      out.push_back(in[i]);
+    }
+  }
+
+  return 0;
+}
+
+float KankerAbb::getWordWidth(KankerFont& font, const std::string& word) {
+
+  float width = 0.0f;
+
+  if (0 == word.size()) {
+    return 0.0f;
+  }
+
+  if (0 != updateGlyphCache(font)) {
+    return -4;
+  }
+
+  if (false == word_cache.find(word, width)) {
+
+    for (size_t i = 0; i < word.size(); ++i) {
+
+      float advance = 0.0f;
+      if (0 != getGlyphAdvance(font, word[i], advance)) {
+        RX_ERROR("Glyph not found: %c", word[i]);
+        continue;
+      }
+
+      width += advance;
+    }
+
+    word_cache.insert(word, width);
+  }
+
+  width *= char_scale;
+
+  return width;
+}
+
+int KankerAbb::updateGlyphCache(KankerFont& font) {
+
+  float x_height = 0.0f;
+
+  if (0 != font.getBaseHeight(x_height)) {
+    RX_ERROR("Failed to retrieve the base height for the font so we cannot normalize it.");
+    return -1;
+  }
+
+  if (false == glyph_cache.isValid(font, x_height, char_scale, min_point_dist, simplify_mode, simplify_tolerance)) {
+    glyph_cache.reset(font, x_height, char_scale, min_point_dist, simplify_mode, simplify_tolerance);
+  }
+
+  if (false == word_cache.isValid(font, x_height)) {
+    word_cache.reset(font, x_height);
+  }
+
+  return 0;
+}
+
+int KankerAbb::getGlyphAdvance(KankerFont& font, int charcode, float& advance) {
+
+  if (&font != glyph_cache.font) {
+    RX_ERROR("The glyph cache was created for another font, call updateGlyphCache() first.");
+    return -1;
+  }
+
+  int dx = font.findGlyphIndex(charcode);
+  if (-1 == dx) {
+    return -2;
+  }
+
+  /* Glyphs may have been added when the font was loaded lazily. */
+  if ((size_t)dx >= glyph_cache.advances.size()) {
+    glyph_cache.updateAdvances();
+  }
+
+  advance = glyph_cache.advances[dx];
+
+  return 0;
+}
+
+KankerAbbPreparedGlyph* KankerAbb::getPreparedGlyph(KankerFont& font, int charcode) {
+
+  std::vector<vec3> segment;
+  std::vector<vec3> simplified_segment;
+
+  if (&font != glyph_cache.font) {
+    RX_ERROR("The glyph cache was created for another font, call updateGlyphCache() first.");
+    return NULL;
+  }
+
+  int dx = font.findGlyphIndex(charcode);
+  if (-1 == dx) {
+    return NULL;
+  }
+
+  /* Glyphs may have been added when the font was loaded lazily. */
+  if ((size_t)dx >= glyph_cache.glyphs.size()) {
+    glyph_cache.glyphs.resize(font.size());
+  }
+
+  KankerAbbPreparedGlyph& prepared = glyph_cache.glyphs[dx];
+  if (prepared.is_prepared) {
+    return &prepared;
+  }
+
+  KankerGlyph* glyph_ptr = font.getGlyphByIndex(dx);
+  if (NULL == glyph_ptr) {
+    return NULL;
+  }
+
+  prepared.glyph = *glyph_ptr;
+  prepared.glyph.normalize(glyph_cache.x_height);
+  prepared.glyph.flipHorizontal();
+  prepared.glyph.alignLeft();
+  prepared.glyph.scale(glyph_cache.char_scale);
+
+  prepared.simplified = KankerGlyph(prepared.glyph.charcode);
+
+  for (size_t k = 0; k < prepared.glyph.getNumSegments(); ++k) {
+
+    prepared.glyph.getSegment(k, segment);
+
+    if (0 != simplifySegment(segment, simplified_segment)) {
+      RX_ERROR("Failed to simplify a segment of `%c`.", prepared.glyph.charcode);
+      continue;
+    }
+
+    if (0 == simplified_segment.size()) {
+      RX_VERBOSE("After simplifying the segment we haven't got anythin left.");
+      continue;
+    }
+
+    prepared.simplified.addSegment(simplified_segment);
+  }
+
+  prepared.is_prepared = true;
+
+  return &prepared;
+}
+
+int KankerAbb::saveSettings(std::string filepath) {
+
+  if (0 == filepath.size()) {
+    RX_ERROR("Invalid filepath (empty).");
+    return -1;
+  }
+
+  std::ofstream ofs(filepath.c_str(), std::ios::out);
+  if (!ofs.is_open()) {
+    RX_ERROR("Failed to open: %s", filepath.c_str());
+    return -2;
+  }
+  
+  ofs << "<config>" << std::endl
+      << "  <offset_x>" << offset_x << "</offset_x>" << std::endl
+      << "  <offset_y>" << offset_y << "</offset_y>" << std::endl 
+      << "  <char_scale>" << char_scale << "</char_scale>" << std::endl
+      << "  <word_spacing>" << word_spacing << "</word_spacing>" << std::endl
+      << "  <line_height>" << line_height << "</line_height>" << std::endl
+      << "  <abb_host>" << abb_host << "</abb_host>" << std::endl
+      << "  <abb_port>" << abb_port << "</abb_port>" << std::endl
+      << "  <abb_connect_timeout>" << (abb_connect_delay / 1000000ull) << "</abb_connect_timeout>" << std::endl
+      << "  <min_x>" << min_x << "</min_x>" << std::endl
+      << "  <max_x>" << max_x << "</max_x>" << std::endl
+      << "  <min_y>" << min_y << "</min_y>" << std::endl
+      << "  <max_y>" << max_y << "</max_y>" << std::endl
+      << "  <min_point_dist>" << min_point_dist << "</min_point_dist>" << std::endl
+      << "  <simplify_mode>" << simplify_mode << "</simplify_mode>" << std::endl
+      << "  <simplify_tolerance>" << simplify_tolerance << "</simplify_tolerance>" << std::endl
+      << "  <arc_tolerance>" << arc_fitter.tolerance << "</arc_tolerance>" << std::endl
+      << "  <zone_max>" << zone_max << "</zone_max>" << std::endl
+      << "  <delta_positions>" << (delta_positions ? 1 : 0) << "</delta_positions>" << std::endl
+      << "  <keyframe_interval>" << keyframe_interval << "</keyframe_interval>" << std::endl
+      << "  <optimize_commands>" << (optimize_commands ? 1 : 0) << "</optimize_commands>" << std::endl
+      << "  <batch_glyphs>" << (packer.batch_glyphs ? 1 : 0) << "</batch_glyphs>" << std::endl
+      << "  <use_banks>" << (packer.use_banks ? 1 : 0) << "</use_banks>" << std::endl
+      << "  <motion_tcp_speed>" << motion_model.tcp_speed << "</motion_tcp_speed>" << std::endl
+      << "  <motion_tcp_accel>" << motion_model.tcp_accel << "</motion_tcp_accel>" << std::endl
+      << "  <motion_ori_speed>" << motion_model.ori_speed << "</motion_ori_speed>" << std::endl
+      << "  <motion_ori_accel>" << motion_model.ori_accel << "</motion_ori_accel>" << std::endl
+      << "  <motion_scale>" << motion_model.motion_scale << "</motion_scale>" << std::endl
+      << "  <motion_stop_time>" << motion_model.stop_time << "</motion_stop_time>" << std::endl
+      << "  <motion_io_time>" << motion_model.io_time << "</motion_io_time>" << std::endl
+      << "  <motion_draw_time>" << motion_model.draw_time << "</motion_draw_time>" << std::endl
+      << "  <motion_home_time>" << motion_model.home_time << "</motion_home_time>" << std::endl
+      << "  <motion_calibrate_interval>" << motion_model.calibrate_interval << "</motion_calibrate_interval>" << std::endl
+      << "  <stroke_order>" << stroke_optimizer.order << "</stroke_order>" << std::endl
+      << "  <stroke_reverse>" << (stroke_optimizer.allow_reverse ? 1 : 0) << "</stroke_reverse>" << std::endl
+      << "  <stroke_join_tolerance>" << stroke_optimizer.join_tolerance << "</stroke_join_tolerance>" << std::endl
+      << "</config>";
+
+  ofs.close();
+  
+  return 0;
+}
+
+int KankerAbb::loadSettings(std::string filepath) {
+  
+  if (!rx_file_exists(filepath)) {
+    RX_ERROR("Cannot find %s", filepath.c_str());
+    return -1;
+  }
+
+  std::ifstream ifs(filepath.c_str(), std::ios::in);
+  if(!ifs.is_open()) {
+    RX_ERROR("Cannot open the settings file.");
+    return -2;
+  }
+ 
+  std::string xml_str;
+  xml_str.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+
+  if (0 == xml_str.size()) {
+    RX_ERROR("Settings file is empty.");
+    return -3;
+  }
+
+  xml_document<> doc;
+
+  try {
+
+    doc.parse<0>((char*)xml_str.c_str());
+    
+    xml_node<>* cfg = doc.first_node("config");
+    read_xml<float>(cfg, "offset_x", 0, offset_x);
+    read_xml<float>(cfg, "offset_y", 0, offset_y);
+    read_xml<float>(cfg, "char_scale", 15.0f, char_scale);
+    read_xml<float>(cfg, "word_spacing", 40.0f, word_spacing);
+    read_xml<float>(cfg, "line_height", 35.0f, line_height);
+    read_xml<int>(cfg, "abb_port", 1025, abb_port);
+    read_xml<std::string>(cfg, "abb_host", "127.0.0.1", abb_host);
+
+    int connect_timeout = 3000;
+    read_xml<int>(cfg, "abb_connect_timeout", 3000, connect_timeout);
+    abb_connect_delay = (uint64_t)connect_timeout * 1000000ull;
+    read_xml<int>(cfg, "min_x", 0, min_x);
+    read_xml<int>(cfg, "max_x", 0, max_x);
+    read_xml<int>(cfg, "min_y", 0, min_y);
+    read_xml<int>(cfg, "max_y", 0, max_y);
+    read_xml<float>(cfg, "min_point_dist", 0, min_point_dist);
+    read_xml<int>(cfg, "simplify_mode", ABB_SIMPLIFY_MIN_DIST, simplify_mode);
+    read_xml<float>(cfg, "simplify_tolerance", 1.0f, simplify_tolerance);
+    read_xml<int>(cfg, "zone_max", 10, zone_max);
+    read_xml<int>(cfg, "keyframe_interval", ABB_KEYFRAME_INTERVAL, keyframe_interval);
+
+    int delta = 0;
+    read_xml<int>(cfg, "delta_positions", 0, delta);
+    delta_positions = (0 != delta);
+
+    int optimize = 1;
+    read_xml<int>(cfg, "optimize_commands", 1, optimize);
+    optimize_commands = (0 != optimize);
+
+    read_xml<float>(cfg, "arc_tolerance", 1.0f, arc_fitter.tolerance);
+
+    int batch_glyphs = 1;
+    read_xml<int>(cfg, "batch_glyphs", 1, batch_glyphs);
+    packer.batch_glyphs = (0 != batch_glyphs);
+
+    int use_banks = 0;
+    read_xml<int>(cfg, "use_banks", 0, use_banks);
+    packer.use_banks = (0 != use_banks);
+
+    read_xml<float>(cfg, "motion_tcp_speed", 700.0f, motion_model.tcp_speed);
+    read_xml<float>(cfg, "motion_tcp_accel", 5000.0f, motion_model.tcp_accel);
+    read_xml<float>(cfg, "motion_ori_speed", 500.0f, motion_model.ori_speed);
+    read_xml<float>(cfg, "motion_ori_accel", 2000.0f, motion_model.ori_accel);
+    read_xml<float>(cfg, "motion_scale", 1.0f, motion_model.motion_scale);
+    read_xml<float>(cfg, "motion_stop_time", 0.05f, motion_model.stop_time);
+    read_xml<float>(cfg, "motion_io_time", 0.01f, motion_model.io_time);
+    read_xml<float>(cfg, "motion_draw_time", 0.15f, motion_model.draw_time);
+    read_xml<float>(cfg, "motion_home_time", 2.5f, motion_model.home_time);
+    read_xml<int>(cfg, "motion_calibrate_interval", 8, motion_model.calibrate_interval);
+    read_xml<int>(cfg, "stroke_order", KANKER_STROKE_ORDER_GLYPH, stroke_optimizer.order);
+
+    int stroke_reverse = 1;
+    read_xml<int>(cfg, "stroke_reverse", 1, stroke_reverse);
+    stroke_optimizer.allow_reverse = (0 != stroke_reverse);
+
+    read_xml<float>(cfg, "stroke_join_tolerance", 0.0f, stroke_optimizer.join_tolerance);
+
+    print();
+  }
+  catch (...) {
+    RX_ERROR("Caught xml exception.");
+    return -4;
+  }
+  return 0;
+}
+
+void KankerAbb::print() {
+
+  RX_VERBOSE("abb.offset_x: %f", offset_x);
+  RX_VERBOSE("abb.offset_y: %f", offset_y);
+  RX_VERBOSE("abb.range width: %f", getRangeWidth());
+  RX_VERBOSE("abb.range height: %f", getRangeHeight());
+  RX_VERBOSE("abb.char_scale: %f", char_scale);
+  RX_VERBOSE("abb.word_spacing: %f", word_spacing);
+  RX_VERBOSE("abb.line_height: %f", line_height);
+  RX_VERBOSE("abb.abb_host: %s", abb_host.c_str());
+  RX_VERBOSE("abb.abb_port: %u", abb_port);
+  RX_VERBOSE("abb.abb_connect_timeout: %llu ms", (unsigned long long)(abb_connect_delay / 1000000ull));
+  RX_VERBOSE("abb.min_x: %d", min_x);
+  RX_VERBOSE("abb.max_x: %d", max_x);
+  RX_VERBOSE("abb.min_y: %d", min_y);
+  RX_VERBOSE("abb.max_y: %d", max_y);
+  RX_VERBOSE("abb.min_point_dist: %f", min_point_dist);
+  RX_VERBOSE("abb.simplify_mode: %d", simplify_mode);
+  RX_VERBOSE("abb.simplify_tolerance: %f", simplify_tolerance);
+  RX_VERBOSE("abb.zone_max: %d", zone_max);
+  RX_VERBOSE("abb.delta_positions: %d", delta_positions);
+  RX_VERBOSE("abb.keyframe_interval: %d", keyframe_interval);
+  RX_VERBOSE("abb.optimize_commands: %d", optimize_commands);
+  RX_VERBOSE("abb.batch_glyphs: %d", packer.batch_glyphs);
+  RX_VERBOSE("abb.use_banks: %d", packer.use_banks);
+  RX_VERBOSE("abb.arc_tolerance: %f", arc_fitter.tolerance);
+  RX_VERBOSE("abb.stroke_order: %d", stroke_optimizer.order);
+  RX_VERBOSE("abb.stroke_reverse: %d", stroke_optimizer.allow_reverse);
+  RX_VERBOSE("abb.stroke_join_tolerance: %f", stroke_optimizer.join_tolerance);
+}
+
+/* ---------------------------------------------------------------------- */
+
+int KankerAbb::connect() {
+
+  if (0 == abb_host.size()) {
+    RX_ERROR("Cannot connect to abb because the `abb_host` member is not set.");
+    return -1;
+  }
+
+  if (0 == abb_port) {
+    RX_ERROR("Cannot connect to abb because the `abb_port` is not set.");
+    return -2;
+  }
+
+  if (0 != sock.setListener(this)) {
+    RX_ERROR("Couldn't set the socket listener.");
+    return -2;
+  }
+
+  /* We don't block while connecting; update() finishes the connect. */
+  if (0 != sock.startConnect(abb_host, abb_port)) {
+    RX_ERROR("Couldn't connect to the ABB");
+    return -1;
+  }
+
+  abb_connect_timeout = rx_hrtime() + abb_connect_delay;
+
+  return 0;
+}
+
+int KankerAbb::update() {
+
+  /* When disconnected we try to reconnect every abb_reconnect_delay ns. */
+  if (ABB_STATE_DISCONNECTED == abb_state) {
+    uint64_t n = rx_hrtime();
+    if (sock.isConnecting()) {
+      if (0 != sock.updateConnect(0)) {
+        RX_ERROR("Couldn't connect to the ABB, we try again in %llu ms.", (unsigned long long)(abb_reconnect_delay / 1000000ull));
+        abb_reconnect_timeout = n + abb_reconnect_delay;
+      }
+      else if (sock.isConnecting() && n > abb_connect_timeout) {
+        RX_ERROR("Connecting to the ABB timed out, we try again in %llu ms.", (unsigned long long)(abb_reconnect_delay / 1000000ull));
+        sock.close();
+        abb_reconnect_timeout = n + abb_reconnect_delay;
+      }
+      return 0;
+    }
+    if (n > abb_reconnect_timeout) {
+      if (0 != connect()) {
+        RX_ERROR("After being disconnected we couldn't reconnect");
       }
       abb_reconnect_timeout = n + abb_reconnect_delay;
     }
@@ -368,45 +945,38 @@ int KankerAbb::update() {
     return -1;
   }
   
-  /* Check if there is data on the socket. */
-  if (0 == sock.canRead(0, 100)) {
-
-    int nread = sock.read(read_buffer, sizeof(read_buffer));
+  /* Send what's left in the queue, when the socket accepts it. */
+  if (sock.hasQueuedData() && 0 != sock.flush()) {
+    RX_ERROR("Failed to send the queued data, we're probably disconnected.");
+    return -2;
+  }
 
-    if (0 > nread) {
-      RX_ERROR("Got an error while trying to read from socket, we're probably disconnected: %d", nread);
-      return -2;
-    }
-    else if (0 < nread) {
+  /* Check if there is data on the socket; we don't wait, poll() does that. */
+  if (0 == sock.canRead(0, 0)) {
 
-      RX_VERBOSE("Read: %d bytes, %c", nread, read_buffer[0]);
+    int nread = 0;
 
-      /* r = ready to accept new commands, c = client is connected, waiting for commands. */
-      if ('r' == read_buffer[0]) { 
-        if (ABB_STATE_READY != abb_state) {
+    /* We read until the socket is empty and handle every reply, in the order the Abb sent them. */
+    do {
 
-          RX_VERBOSE("Abb is ready to start drawing the next glyph.");
+      nread = sock.read(read_buffer, sizeof(read_buffer));
 
-          if (NULL != abb_listener) {
-            abb_listener->onAbbReadyToDraw();
-          }
-          else {
-            RX_VERBOSE("We're checking the Abb state but you haven't set a listener so it doesn't really make sense.");
-          }
+      if (0 > nread) {
+        RX_ERROR("Got an error while trying to read from socket, we're probably disconnected: %d", nread);
+        return -2;
+      }
 
-          abb_state = ABB_STATE_READY;
+      replies.clear();
 
-          sendNextGlyph();
-        }
+      if (0 != reply_parser.parse(read_buffer, nread, replies)) {
+        RX_WARNING("The Abb sent something we don't understand; we skipped it.");
       }
-      else if ('d' == read_buffer[0]) {
-        RX_VERBOSE("Abb is drawing");
-        if (NULL != abb_listener) {
-          abb_listener->onAbbDrawing();
-        }
-        abb_state = ABB_STATE_DRAWING;
+
+      for (size_t i = 0; i < replies.size(); ++i) {
+        handleReply(replies[i]);
       }
-    }
+
+    } while (nread == (int)sizeof(read_buffer));
   }
 
   /* Do we need to update our state? */
@@ -419,15 +989,146 @@ int KankerAbb::update() {
   uint64_t n = rx_hrtime();
   if (n > check_abb_state_timeout) {
     check_abb_state_timeout = n + check_abb_state_delay;
-    sendCheckState();
+
+    /* When the previous data wasn't sent yet, the Abb isn't reading; we don't pile up state checks. */
+    if (false == sock.hasQueuedData()) {
+      sendCheckState();
+    }
   }
 
   return 0;
 }
 
+/*
+  Waits until there is something to do for update(): the Abb sent us
+  data or it's time to check the state or to reconnect. When idle we
+  sleep in the reactor instead of spinning on update().
+*/
+int KankerAbb::poll(int timeoutMillis) {
+
+  uint64_t now = rx_hrtime();
+  uint64_t due = getNextTimeout();
+  int wait_millis = 0;
+  int events = SOCKET_EVENT_NONE;
+
+  if (due > now) {
+    uint64_t millis = (due - now) / 1000000ull + 1;
+    wait_millis = (millis > 0x7FFFFFFF) ? 0x7FFFFFFF : (int)millis;
+  }
+
+  if (0 <= timeoutMillis && wait_millis > timeoutMillis) {
+    wait_millis = timeoutMillis;
+  }
+
+  /* A non-blocking connect finished (or failed) when the socket becomes writable. */
+  if (sock.isConnecting()) {
+    events = SOCKET_EVENT_WRITE;
+  }
+  else if (ABB_STATE_DISCONNECTED != abb_state && 0 == sock.isConnected()) {
+    events = SOCKET_EVENT_READ;
+    if (sock.hasQueuedData()) {
+      events |= SOCKET_EVENT_WRITE;
+    }
+  }
+
+  if (0 < wait_millis && 0 > reactor.wait(sock.handle, events, wait_millis)) {
+    RX_ERROR("Failed to wait for the Abb.");
+    return -1;
+  }
+
+  return update();
+}
+
+uint64_t KankerAbb::getNextTimeout() {
+
+  if (sock.isConnecting()) {
+    return abb_connect_timeout;
+  }
+
+  if (ABB_STATE_DISCONNECTED == abb_state) {
+    return abb_reconnect_timeout;
+  }
+
+  return check_abb_state_timeout;
+}
+
+void KankerAbb::handleReply(KankerAbbReply& reply) {
+
+  switch (reply.type) {
+
+    /* Ready to accept new commands. */
+    case ABB_REPLY_READY: {
+
+      if (ABB_STATE_READY == abb_state) {
+        break;
+      }
+
+      RX_VERBOSE("Abb is ready to start drawing the next glyph.");
+
+      if (NULL != abb_listener) {
+        abb_listener->onAbbReadyToDraw();
+      }
+      else {
+        RX_VERBOSE("We're checking the Abb state but you haven't set a listener so it doesn't really make sense.");
+      }
+
+      abb_state = ABB_STATE_READY;
+
+      sendNextGlyph();
+      break;
+    }
+
+    case ABB_REPLY_DRAWING: {
+
+      RX_VERBOSE("Abb is drawing");
+
+      if (NULL != abb_listener) {
+        abb_listener->onAbbDrawing();
+      }
+
+      abb_state = ABB_STATE_DRAWING;
+      break;
+    }
+
+    /* The Abb has a free bank, we can send the next batch while it's drawing. */
+    case ABB_REPLY_BANK_FREE: {
+      RX_VERBOSE("Abb has a free bank.");
+      sendNextGlyph();
+      break;
+    }
+
+    case ABB_REPLY_PROGRESS: {
+
+      curr_packets_drawn = reply.value;
+
+      if (NULL != abb_listener) {
+        abb_listener->onAbbProgress(curr_packets_drawn, curr_packets_total);
+      }
+      break;
+    }
+
+    case ABB_REPLY_ERROR: {
+
+      RX_ERROR("The Abb reports error: %d", reply.value);
+
+      if (NULL != abb_listener) {
+        abb_listener->onAbbError(reply.value);
+      }
+      break;
+    }
+
+    default: {
+      RX_VERBOSE("Abb state: %c", reply.type);
+      break;
+    }
+  }
+}
+
 void KankerAbb::onSocketConnected() {
 
   RX_VERBOSE("Socket connected");
+
+  reply_parser.reset();
   
   abb_state = ABB_STATE_CONNECTED;
 
@@ -441,16 +1142,31 @@ void KankerAbb::onSocketDisconnected() {
   RX_ERROR("Disconnected from ABB");
 
   abb_state = ABB_STATE_DISCONNECTED;
+  is_batch_deferred = false;
 
   if (NULL != abb_listener) {
     abb_listener->onAbbDisconnected();
   }
 }
 
+void KankerAbb::onSocketHighWater(size_t nbytes) {
+  RX_WARNING("We have %lu bytes queued for the Abb; it doesn't keep up or the connection stalled.", nbytes);
+}
+
+void KankerAbb::onSocketDrained() {
+
+  RX_VERBOSE("The send queue is drained.");
+
+  if (is_batch_deferred) {
+    is_batch_deferred = false;
+    sendNextGlyph();
+  }
+}
+
 int KankerAbb::sendCheckState() {
   buffer.clear();
   buffer.writeU8(ABB_CMD_GET_STATE);
-  sock.send(buffer.ptr(), buffer.size());
+  sendCommands(buffer.ptr(), buffer.size());
   return 0;
 }
 
@@ -522,7 +1238,7 @@ int KankerAbb::sendTestPositions() {
   buffer.writeU8(ABB_CMD_DRAW);
 
   RX_VERBOSE("Sending test, with %lu bytes.", buffer.size());
-  sock.send(buffer.ptr(), buffer.size());
+  sendCommands(buffer.ptr(), buffer.size());
 
   return 0;
 }
@@ -539,16 +1255,13 @@ int KankerAbb::sendSwipePositions() {
   buffer.writeU8(ABB_CMD_DRAW);
 
   RX_VERBOSE("Sending test, with %lu bytes.", buffer.size());
-  sock.send(buffer.ptr(), buffer.size());
+  sendCommands(buffer.ptr(), buffer.size());
   
   return 0;
 }
 
 int KankerAbb::addSwipeToBuffer() {
 
-  static uint64_t message_count = 0;
-  static uint64_t message_type = 0;
-
   std::vector<vec3> positions;
   int num_points = 10;
   float radius = 30.0f;
@@ -566,9 +1279,9 @@ int KankerAbb::addSwipeToBuffer() {
      -  which led, 1 = BLUE, 2 = RED, 3 = not working.  
    */
 
-  int port = 1 + (int)(message_count % 2);
-  int port2 = 2 - (int)(message_count % 2);
-  int type = (int)(message_type % 7);
+  int port = 1 + (int)(swipe_count % 2);
+  int port2 = 2 - (int)(swipe_count % 2);
+  int type = (int)(swipe_type % 7);
 
   if (0 == type) {
     /* Move in a rect. */
@@ -628,141 +1341,478 @@ int KankerAbb::addSwipeToBuffer() {
   }
   else if (5 == type) {
 
-    float half_y = min_y + getRangeHeight() * 0.5;
-    float half_x = min_x + getRangeWidth() * 0.5;
+    float half_y = min_y + getRangeHeight() * 0.5;
+    float half_x = min_x + getRangeWidth() * 0.5;
+
+    writeAbbPositionWithAngle(0, 0, 0.0, 0.0);
+    writeAbbPositionWithAngle(min_x, max_y, 0.0, 0.0);                  /* bottom left */ 
+    writeAbbPositionWithAngleAndIO(half_x, half_y, 0.0, 120.0f, port);  /* bottom left */
+    writeAbbPositionWithAngleAndIO(max_x, max_y, 0.0, 120.0f, port);    /* top right */
+    writeAbbPositionWithAngleAndIO(max_x, max_y, 0.0, -120.0f, port2);  /* top right */
+    writeAbbPositionWithAngleAndIO(half_x, half_y, 0.0, 20.0f, port2);  /* bottom left */
+  }
+  else {
+
+    /* bottom line. */
+    writeAbbPositionWithAngle(0.0, 0.0, 0.0, 0.0);
+    writeAbbPositionWithAngleAndIO(min_x, min_y, 0.0, 0.0, port);
+    writeAbbPositionWithAngleAndIO(max_x, min_y, 0.0, 0.0, port);
+
+    /* top line */
+    writeAbbPositionWithAngle(max_x, max_y, 0.0, 0.0);
+    writeAbbPositionWithAngleAndIO(max_x, max_y, 0.0, 0.0, port);
+    writeAbbPositionWithAngleAndIO(min_x, max_y, 0.0, 0.0, port);
+
+    /* middle line */
+    float half_y = min_y + getRangeHeight() * 0.5 ;
+    writeAbbPositionWithAngle(min_x, half_y, 0.0, 0.0);
+    writeAbbPositionWithAngleAndIO(min_x, half_y, 0.0, 0.0, port);
+    writeAbbPositionWithAngleAndIO(max_x, half_y, 0.0, 0.0, port);
+
+    writeAbbPositionWithAngle(0.0, 0.0, 0.0, 0.0);
+  }
+
+  buffer.writeU8(ABB_CMD_HOME);
+
+  swipe_type++;
+  swipe_count++;
+
+  /* Just some safety... */
+  if (ABB_MAX_PACKETS < kanker_abb_count_packets(&buffer.data[start_offset], buffer.data.size() - start_offset)) {
+    RX_ERROR("The swipe needs more packets than we can store on the ABB.");
+    buffer.data.erase(buffer.data.begin() + start_offset, buffer.data.end());
+    return -1;
+  }
+
+  RX_VERBOSE("After adding swipe we have %lu bytes in the buffer. We're using swipe type: %d", buffer.size(), type);
+
+  return 0;
+}
+
+int KankerAbb::sendNextGlyph() {
+
+  if (curr_batch_index >= curr_batches.size()) {
+
+    /* Keep track of how long the message took so we can calibrate the motion model. */
+    if (0 != message_start_time) {
+      double measured = double(rx_hrtime() - message_start_time) / 1e9;
+      RX_VERBOSE("Writing the message took %.2f seconds, we estimated %.2f seconds.", measured, message_estimate.seconds);
+      motion_model.addSample(message_estimate, measured);
+      message_start_time = 0;
+
+      if (motion_model.needsCalibration()) {
+        motion_model.calibrate();
+      }
+    }
+
+    if (NULL != abb_listener) {
+      abb_listener->onAbbMessageReady();
+    }
+    return 0;
+  }
+
+  /* The Abb doesn't read fast enough; we send the batch when the queue is drained. */
+  if (sock.isAboveHighWater()) {
+    RX_VERBOSE("The send queue is full, we send the next batch later.");
+    is_batch_deferred = true;
+    return 0;
+  }
+
+  KankerAbbBatch& batch = curr_batches[curr_batch_index];
+
+  RX_VERBOSE("Sending glyph %lu - %lu, %lu packets, %lu bytes.", 
+             batch.first_glyph, batch.last_glyph, batch.num_packets, batch.data.size());
+
+  sendCommands(&batch.data[0], batch.data.size());
+
+  curr_glyph_index = batch.last_glyph + 1;
+  curr_batch_index++;
+
+  return 0;
+}
+
+/*
+  RAPID reads at most 1024 bytes at a time and can't parse a command 
+  that is split between two reads, therefore we send everything in 
+  frames. Networking.mod reads exactly one frame at a time and keeps
+  the start of a command which continues in the next frame.
+*/
+int KankerAbb::sendCommands(const uint8_t* data, size_t nbytes) {
+
+  frame_buffer.clear();
+
+  if (0 != kanker_abb_write_frames(data, nbytes, frame_buffer)) {
+    RX_ERROR("Failed to create the frames.");
+    return -1;
+  }
+
+  /* The socket takes the data of frame_buffer and sends it when it can. */
+  if (0 != sock.send(frame_buffer)) {
+    RX_ERROR("Failed to send the frames.");
+    return -2;
+  }
+
+  return 0;
+}
+
+/*
+  Creates the commands for all glyphs of the message; the swipe is drawn
+  before the first glyph. The packer decides which glyphs are sent
+  per draw. Note that this creates a new swipe.
+*/
+int KankerAbb::packMessage(std::vector<KankerAbbGlyph>& message, std::vector<KankerAbbBatch>& out) {
+
+  packer.clear();
+  buffer.clear();
+  peephole.stats.clear();
+
+  if (0 == addSwipeToBuffer() && 0 != buffer.size()) {
+
+    /* The swipe is written directly into the buffer, so we decode it to optimize it. */
+    if (optimize_commands) {
+      commands.clear();
+      if (0 != kanker_abb_decode_commands(buffer.ptr(), buffer.size(), commands) || 0 != peephole.optimize(commands)) {
+        RX_ERROR("Failed to optimize the swipe, we send it as is.");
+      }
+      else {
+        buffer.clear();
+        writeCommands(commands, buffer);
+      }
+    }
+
+    if (0 != packer.add(buffer.ptr(), buffer.size(), 0)) {
+      RX_ERROR("Failed to add the swipe.");
+    }
+  }
+
+  for (size_t i = 0; i < message.size(); ++i) {
+
+    /* A glyph has no segments when its strokes were joined with the previous glyph. */
+    std::vector<std::vector<vec3> >& segments = message[i].segments;
+
+    for (size_t j = 0; j < segments.size(); ++j) {
+
+      std::vector<vec3>& points = segments[j];
+      if (0 == points.size()) {
+        RX_ERROR("No points in the segment.");
+        continue;
+      }
+
+      if (0 != packSegment(points, i)) {
+        RX_ERROR("Failed to add segment %lu of glyph %lu.", j, i);
+        buffer.clear();
+        return -2;
+      }
+    }
+  }
+
+  buffer.clear();
+
+  if (optimize_commands) {
+    peephole.stats.print();
+  }
+
+  if (0 != packer.pack(out)) {
+    RX_ERROR("Failed to pack the message.");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+  Adds the commands of a stroke to the packer. A stroke which needs
+  more packets than a batch can hold is split into parts that do fit;
+  each part starts at the point where the previous one ended and
+  switches the lamp on and off again.
+*/
+int KankerAbb::packSegment(std::vector<vec3>& points, size_t glyph) {
+
+  size_t limit = packer.getPacketLimit();
+  size_t max_points = 0;
+  std::vector<vec3> part;
+
+  if (0 != writeSegment(points)) {
+    return -1;
+  }
+
+  if (kanker_abb_count_packets(buffer.ptr(), buffer.size()) <= (int)limit) {
+    return packer.add(buffer.ptr(), buffer.size(), glyph);
+  }
+
+  /* The most points of which we know they fit, see KankerStrokeOptimizer::getMaxStrokePackets(). */
+  while (stroke_optimizer.getMaxStrokePackets(max_points + 1) <= limit) {
+    max_points++;
+  }
+
+  if (2 > max_points) {
+    RX_ERROR("The packet limit %lu is too small to split a stroke.", limit);
+    return -2;
+  }
+
+  RX_VERBOSE("Splitting a stroke of %lu points into parts of at most %lu points.", points.size(), max_points);
+
+  for (size_t first = 0; first + 1 < points.size(); first += max_points - 1) {
+
+    size_t last = (first + max_points < points.size()) ? first + max_points : points.size();
+    part.assign(points.begin() + first, points.begin() + last);
+
+    if (0 != writeSegment(part)) {
+      return -3;
+    }
+
+    if (0 != packer.add(buffer.ptr(), buffer.size(), glyph)) {
+      return -4;
+    }
+  }
+
+  return 0;
+}
+
+/* Writes the optimized commands of a stroke into `buffer`. */
+int KankerAbb::writeSegment(std::vector<vec3>& points) {
+
+  buffer.clear();
+  commands.clear();
+
+  if (0 != addSegmentCommands(points, commands)) {
+    return -1;
+  }
+
+  if (optimize_commands && 0 != peephole.optimize(commands)) {
+    RX_ERROR("Failed to optimize a segment, we send it as is.");
+    commands.clear();
+    addSegmentCommands(points, commands);
+  }
+
+  return writeCommands(commands, buffer);
+}
+
+/*
+  Converts the points of a segment into the commands we send to the 
+  ABB: we move to the first point, turn on the lamp, move along the 
+  points and turn off the lamp. Runs of points that lie on a circle 
+  become one ABB_CMD_ARC when `arc_fitter.tolerance` > 0.
+*/
+int KankerAbb::addSegmentCommands(std::vector<vec3>& points, std::vector<KankerAbbCommand>& out) {
+
+  KankerAbbCommand cmd;
+
+  if (0 == points.size()) {
+    return -1;
+  }
+
+  if (0 != arc_fitter.fit(points, arc_spans)) {
+    RX_ERROR("Failed to fit arcs, we send lines.");
+    arc_spans.clear();
+  }
+
+  /* Move to the first point and power on the I/O port 0. */
+  cmd.type = ABB_CMD_POSITION;
+  cmd.position = convertFontPointToAbbPoint(points[0]);
+  out.push_back(cmd);
+
+  cmd.type = ABB_CMD_IO;
+  cmd.position.set(0, 1, 0);
+  out.push_back(cmd);
+
+  cmd.type = ABB_CMD_POSITION;
+  cmd.position = convertFontPointToAbbPoint(points[0]);
+  out.push_back(cmd);
 
-    writeAbbPositionWithAngle(0, 0, 0.0, 0.0);
-    writeAbbPositionWithAngle(min_x, max_y, 0.0, 0.0);                  /* bottom left */ 
-    writeAbbPositionWithAngleAndIO(half_x, half_y, 0.0, 120.0f, port);  /* bottom left */
-    writeAbbPositionWithAngleAndIO(max_x, max_y, 0.0, 120.0f, port);    /* top right */
-    writeAbbPositionWithAngleAndIO(max_x, max_y, 0.0, -120.0f, port2);  /* top right */
-    writeAbbPositionWithAngleAndIO(half_x, half_y, 0.0, 20.0f, port2);  /* bottom left */
+  size_t first_move = out.size();
+
+  if (0 == arc_spans.size()) {
+    for (size_t k = 1; k < points.size(); ++k) {
+      cmd.type = ABB_CMD_POSITION;
+      cmd.position = convertFontPointToAbbPoint(points[k]);
+      out.push_back(cmd);
+    }
   }
-  else {
 
-    /* bottom line. */
-    writeAbbPositionWithAngle(0.0, 0.0, 0.0, 0.0);
-    writeAbbPositionWithAngleAndIO(min_x, min_y, 0.0, 0.0, port);
-    writeAbbPositionWithAngleAndIO(max_x, min_y, 0.0, 0.0, port);
+  for (size_t k = 0; k < arc_spans.size(); ++k) {
 
-    /* top line */
-    writeAbbPositionWithAngle(max_x, max_y, 0.0, 0.0);
-    writeAbbPositionWithAngleAndIO(max_x, max_y, 0.0, 0.0, port);
-    writeAbbPositionWithAngleAndIO(min_x, max_y, 0.0, 0.0, port);
+    KankerArcSpan& span = arc_spans[k];
 
-    /* middle line */
-    float half_y = min_y + getRangeHeight() * 0.5 ;
-    writeAbbPositionWithAngle(min_x, half_y, 0.0, 0.0);
-    writeAbbPositionWithAngleAndIO(min_x, half_y, 0.0, 0.0, port);
-    writeAbbPositionWithAngleAndIO(max_x, half_y, 0.0, 0.0, port);
+    if (span.is_arc) {
+      cmd.type = ABB_CMD_ARC;
+      cmd.via = convertFontPointToAbbPoint(span.via);
+    }
+    else {
+      cmd.type = ABB_CMD_POSITION;
+    }
 
-    writeAbbPositionWithAngle(0.0, 0.0, 0.0, 0.0);
+    cmd.position = convertFontPointToAbbPoint(points[span.end]);
+    out.push_back(cmd);
   }
 
-  buffer.writeU8(ABB_CMD_HOME);
+  /* 
+     The robot blends through the points inside the stroke. The start and 
+     end stay `fine` because the lamp is switched when the robot reaches 
+     them; RAPID executes the SetDO when it enters the zone otherwise.
+  */
+  for (size_t k = first_move; k + 1 < out.size(); ++k) {
 
-  message_type++;
-  message_count++;
+    KankerAbbCommand& curr = out[k];
+    KankerAbbCommand& next = out[k + 1];
+    vec3& from = (ABB_CMD_ARC == curr.type) ? curr.via : out[k - 1].position;
+    vec3& to = (ABB_CMD_ARC == next.type) ? next.via : next.position;
 
-  /* Just some safety... */
-  if (buffer.size() > 1024) {
-    RX_ERROR("The buffer contains more then 1024 bytes. At this moment we cannot handle this. We have %lu bytes.", buffer.size());
-    buffer.data.erase(buffer.data.begin() + start_offset, buffer.data.end());
-    return -1;
+    curr.zone = kanker_abb_get_zone(from, curr.position, to, zone_max);
   }
 
-  RX_VERBOSE("After adding swipe we have %lu bytes in the buffer. We're using swipe type: %d", buffer.size(), type);
+  /* Power off the I/O port 0. */
+  cmd.type = ABB_CMD_IO;
+  cmd.position.set(0, 0, 0);
+  out.push_back(cmd);
 
   return 0;
 }
 
-int KankerAbb::sendNextGlyph() {
+/* 
+   Serializes the given commands into `buf`. With `delta_positions` we 
+   send the positions relative to the previous one. The first position 
+   and every `keyframe_interval` positions are absolute, so an error in 
+   a delta can't stay around. The deltas are relative to the position 
+   the ABB reconstructs, so the rounding errors don't add up.
+*/
+int KankerAbb::writeCommands(std::vector<KankerAbbCommand>& cmds, Buffer& buf) {
 
-  buffer.clear();
+  /* The zone is modal on the ABB and is `fine` at the start of a draw. */
+  uint8_t zone = ABB_ZONE_FINE;
+  bool has_base = false;
+  vec3 base;
+  int num_deltas = 0;
+  int16_t delta[3];
 
-  if (curr_glyph_index >= curr_message.size()) {
-    if (NULL != abb_listener) {
-      abb_listener->onAbbMessageReady();
+  for (size_t i = 0; i < cmds.size(); ++i) {
+
+    KankerAbbCommand& cmd = cmds[i];
+
+    if ((ABB_CMD_POSITION == cmd.type || ABB_CMD_ARC == cmd.type) && zone != cmd.zone) {
+      zone = cmd.zone;
+      buf.writeU8(ABB_CMD_ZONE);
+      buf.writeU8(zone);
     }
-    return 0;
-  }
 
-  /* We first draw a swipe before the first character. */
-  if (0 == curr_glyph_index) {
-    addSwipeToBuffer();
-  }
+    switch (cmd.type) {
 
-  /* get the segments that make up the glyph. */
-  KankerAbbGlyph& g = curr_message[curr_glyph_index];
-  std::vector<std::vector<vec3> >& segments = g.segments;
-  if (0 == segments.size()) {
-    RX_ERROR("No semgents in current glyph.");
-  }
+      case ABB_CMD_POSITION: {
 
-  for (size_t j = 0; j < segments.size(); ++j) {
+        bool can_use_delta = delta_positions && has_base && 0.0f == cmd.rot_z && num_deltas < keyframe_interval;
 
-    std::vector<vec3>& points = segments[j];
-    if (0 == points.size()) {
-      RX_ERROR("No points in the segment.");
-      continue;
-    }
+        if (can_use_delta && kanker_abb_get_delta(base, cmd.position, delta)) {
+          buf.writeU8(ABB_CMD_POSITION_DELTA);
+          buf.writeDelta(delta[0], delta[1], delta[2]);
+          base.x = base.x + delta[0] / ABB_DELTA_SCALE;
+          base.y = base.y + delta[1] / ABB_DELTA_SCALE;
+          base.z = base.z + delta[2] / ABB_DELTA_SCALE;
+          num_deltas++;
+          break;
+        }
 
-    for (size_t k = 0; k < points.size(); ++k) {
-      
-      vec3& v = points[k];
-      vec3 p = convertFontPointToAbbPoint(v);
-      buffer.writeU8(ABB_CMD_POSITION);
-      buffer.writePosition(p.x, p.y, p.z);
+        buf.writeU8(ABB_CMD_POSITION);
+        buf.writePosition(cmd.position.x, cmd.position.y, cmd.position.z, cmd.rot_z);
+        base = cmd.position;
+        has_base = true;
+        num_deltas = 0;
+        break;
+      }
+
+      case ABB_CMD_ARC: {
+        buf.writeU8(ABB_CMD_ARC);
+        buf.writeArc(cmd.via.x, cmd.via.y, cmd.via.z, cmd.position.x, cmd.position.y, cmd.position.z);
+        base = cmd.position;
+        has_base = true;
+        num_deltas = 0;
+        break;
+      }
+
+      case ABB_CMD_IO: {
+        buf.writeU8(ABB_CMD_IO);
+        buf.writeFloat(cmd.position.x);
+        buf.writeFloat(cmd.position.y);
+        break;
+      }
 
-      if (0 == k) {
-        /* Power on the I/O port 0 */
-        buffer.writeU8(ABB_CMD_IO);
-        buffer.writeFloat(0);
-        buffer.writeFloat(1);
+      case ABB_CMD_DRAW:
+      case ABB_CMD_HOME: {
+        buf.writeU8(cmd.type);
+        break;
+      }
 
-        buffer.writeU8(ABB_CMD_POSITION);
-        buffer.writePosition(p.x, p.y, p.z);
+      default: {
+        RX_ERROR("Cannot serialize command: %d", cmd.type);
+        return -1;
       }
     }
+  }
 
-    /* Power off the I/O port 0 */
-    buffer.writeU8(ABB_CMD_IO);
-    buffer.writeFloat(0);
-    buffer.writeFloat(0);
+  /* Make sure the moves we send after these commands are `fine` again. */
+  if (ABB_ZONE_FINE != zone) {
+    buf.writeU8(ABB_CMD_ZONE);
+    buf.writeU8(ABB_ZONE_FINE);
+  }
+
+  return 0;
+}
 
-    /* 
-       RAPID can only store 1024 bytes :/, therefore we transfer position data per segment
-       as the are most of the time less then 1024 bytes. At this moment we're not yet
-       handling buffers > 1024 in rapid. 
+/*
+  Estimates how long it takes to write the given message: we create 
+  the same batches as sendText(), including the swipe before the first
+  glyph, and pass them into the motion model. sendText() estimates the
+  batches it already packed with estimateBatches().
+*/
+int KankerAbb::estimateMessage(std::vector<KankerAbbGlyph>& message, KankerAbbMotionEstimate& result) {
 
-       @todo When we fixed handling buffers that are bigger then 1024 bytes update this comment. 
-    */
-    if (1024 < buffer.size()) {
-      RX_ERROR("The buffer contains to much bytes, %lu", buffer.size());
-    }
+  std::vector<KankerAbbBatch> batches;
+  uint64_t count = swipe_count;
+  uint64_t type = swipe_type;
+  int r = 0;
 
-    RX_VERBOSE("Sending %lu bytes", buffer.size());
+  result.clear();
 
-    sock.send(buffer.ptr(), buffer.size());
-    buffer.clear();
+  if (0 == message.size()) {
+    return -1;
   }
 
-#if 0
-  /* Add a swipe at the end of the message. */
-  if ((curr_glyph_index+1) >= curr_message.size()) {
-    addSwipeToBuffer();
+  /* Pack the message with the swipe that will be used for this message. */
+  r = packMessage(message, batches);
+  swipe_count = count;
+  swipe_type = type;
+
+  if (0 != r) {
+    return -2;
   }
-#endif
 
-  buffer.writeU8(ABB_CMD_DRAW);
-    sock.send(buffer.ptr(), buffer.size());
-  buffer.clear();
+  return estimateBatches(batches, result);
+}
+
+int KankerAbb::estimateBatches(std::vector<KankerAbbBatch>& batches, KankerAbbMotionEstimate& result) {
+
+  std::vector<KankerAbbCommand> cmds;
+
+  result.clear();
+  motion_model.reset();
+
+  for (size_t i = 0; i < batches.size(); ++i) {
+    if (0 != kanker_abb_decode_commands(&batches[i].data[0], batches[i].data.size(), cmds)) {
+      RX_ERROR("Failed to decode batch %lu.", i);
+      return -1;
+    }
+  }
+
+  if (0 != motion_model.add(cmds, result)) {
+    return -2;
+  }
 
-  curr_glyph_index++;
+  motion_model.finish(result);
+
+  return 0;
 }
 
 /*
-  We send each glyph one at a time and only after receiving 
+  We send the glyphs in batches and only after receiving 
    a ABB_STATE_READY from the ABB. After calling `sendText()` 
    you need to make sure to call `update()` often because that 
    will process the complete message. 
@@ -777,8 +1827,37 @@ int KankerAbb::sendText(std::vector<KankerAbbGlyph>& message) {
   }
 
   curr_glyph_index = 0;
+  curr_batch_index = 0;
+  is_batch_deferred = false;
   curr_message = message;
 
+  if (0 != packMessage(curr_message, curr_batches)) {
+    RX_ERROR("Failed to pack the message, not sending.");
+    curr_batches.clear();
+    return -2;
+  }
+
+  if (0 == estimateBatches(curr_batches, message_estimate)) {
+    RX_VERBOSE("Writing the message will take about %.2f seconds.", message_estimate.seconds);
+  }
+
+  RX_VERBOSE("Sending %lu glyphs in %lu draws.", curr_message.size(), curr_batches.size());
+
+  curr_packets_drawn = 0;
+  curr_packets_total = 0;
+
+  for (size_t i = 0; i < curr_batches.size(); ++i) {
+    curr_packets_total += curr_batches[i].num_packets;
+  }
+
+  /* The Abb counts the packets it draws from here, see ABB_REPLY_PROGRESS. */
+  buffer.clear();
+  buffer.writeU8(ABB_CMD_RESET);
+  sendCommands(buffer.ptr(), buffer.size());
+  buffer.clear();
+
+  message_start_time = rx_hrtime();
+
   sendNextGlyph();
 
   return 0;
@@ -846,3 +1925,381 @@ template <class T> int read_xml(xml_node<>* node, std::string name, T defaultval
     
   return 0;
 }
+
+/* ---------------------------------------------------------------------- */
+
+int kanker_abb_decode_commands(const uint8_t* data, size_t nbytes, std::vector<KankerAbbCommand>& out) {
+
+  size_t dx = 0;
+  uint8_t zone = ABB_ZONE_FINE;
+  bool has_base = false;
+  vec3 base;
+  KankerAbbCommand cmd;
+
+  if (NULL == data) {
+    RX_ERROR("Invalid data, NULL.");
+    return -1;
+  }
+
+  while (dx < nbytes) {
+
+    cmd = KankerAbbCommand();
+    cmd.type = data[dx];
+    cmd.zone = zone;
+
+    switch (cmd.type) {
+
+      /* The zone is modal; we store it with each move. */
+      case ABB_CMD_ZONE: {
+        if (dx + 2 > nbytes) {
+          RX_ERROR("Not enough bytes for a zone.");
+          return -6;
+        }
+        zone = data[dx + 1];
+        dx += 2;
+        continue;
+      }
+
+      case ABB_CMD_POSITION: {
+        if (dx + 17 > nbytes) {
+          RX_ERROR("Not enough bytes for a position.");
+          return -2;
+        }
+        cmd.position.set(kanker_abb_read_float(data + dx + 1), kanker_abb_read_float(data + dx + 5), kanker_abb_read_float(data + dx + 9));
+        cmd.rot_z = kanker_abb_read_float(data + dx + 13);
+        base = cmd.position;
+        has_base = true;
+        dx += 17;
+        break;
+      }
+
+      /* Relative to the previous position; we return it as a ABB_CMD_POSITION. */
+      case ABB_CMD_POSITION_DELTA: {
+        if (dx + 7 > nbytes) {
+          RX_ERROR("Not enough bytes for a delta position.");
+          return -8;
+        }
+        if (false == has_base) {
+          RX_ERROR("Got a delta position without a previous position.");
+          return -9;
+        }
+        base.x = base.x + kanker_abb_read_s16(data + dx + 1) / ABB_DELTA_SCALE;
+        base.y = base.y + kanker_abb_read_s16(data + dx + 3) / ABB_DELTA_SCALE;
+        base.z = base.z + kanker_abb_read_s16(data + dx + 5) / ABB_DELTA_SCALE;
+        cmd.type = ABB_CMD_POSITION;
+        cmd.position = base;
+        dx += 7;
+        break;
+      }
+
+      case ABB_CMD_ARC: {
+        if (dx + 25 > nbytes) {
+          RX_ERROR("Not enough bytes for an arc.");
+          return -3;
+        }
+        cmd.via.set(kanker_abb_read_float(data + dx + 1), kanker_abb_read_float(data + dx + 5), kanker_abb_read_float(data + dx + 9));
+        cmd.position.set(kanker_abb_read_float(data + dx + 13), kanker_abb_read_float(data + dx + 17), kanker_abb_read_float(data + dx + 21));
+        base = cmd.position;
+        has_base = true;
+        dx += 25;
+        break;
+      }
+
+      case ABB_CMD_IO: {
+        if (dx + 9 > nbytes) {
+          RX_ERROR("Not enough bytes for an io command.");
+          return -4;
+        }
+        cmd.position.set(kanker_abb_read_float(data + dx + 1), kanker_abb_read_float(data + dx + 5), 0.0f);
+        dx += 9;
+        break;
+      }
+
+      case ABB_CMD_DRAW_BANKED: {
+        if (dx + 2 > nbytes) {
+          RX_ERROR("Not enough bytes for a banked draw.");
+          return -7;
+        }
+        /* Like ABB_CMD_IO we use the position to store the value; x is 1 for the last bank. */
+        cmd.position.set(data[dx + 1], 0.0f, 0.0f);
+        dx += 2;
+        break;
+      }
+
+      case ABB_CMD_DRAW:
+      case ABB_CMD_GET_STATE:
+      case ABB_CMD_HOME: {
+        dx += 1;
+        break;
+      }
+
+      default: {
+        RX_ERROR("Unknown command: %d", cmd.type);
+        return -5;
+      }
+    }
+
+    out.push_back(cmd);
+  }
+
+  return 0;
+}
+
+int kanker_abb_get_command_size(const uint8_t* data, size_t nbytes) {
+
+  int size = -1;
+
+  if (NULL == data || 0 == nbytes) {
+    return -1;
+  }
+
+  switch (data[0]) {
+    case ABB_CMD_POSITION:       { size = 17; break; }
+    case ABB_CMD_IO:             { size = 9;  break; }
+    case ABB_CMD_ARC:            { size = 25; break; }
+    case ABB_CMD_POSITION_DELTA: { size = 7;  break; }
+    case ABB_CMD_ZONE:
+    case ABB_CMD_DRAW_BANKED:    { size = 2;  break; }
+    case ABB_CMD_RESET:
+    case ABB_CMD_DRAW:
+    case ABB_CMD_GET_STATE:
+    case ABB_CMD_HOME:           { size = 1;  break; }
+    default:                     { return -2;          }
+  }
+
+  if ((size_t)size > nbytes) {
+    return -3;
+  }
+
+  return size;
+}
+
+int kanker_abb_count_packets(const uint8_t* data, size_t nbytes) {
+
+  size_t dx = 0;
+  int num_packets = 0;
+
+  if (NULL == data) {
+    return -1;
+  }
+
+  while (dx < nbytes) {
+
+    int size = kanker_abb_get_command_size(data + dx, nbytes - dx);
+    if (0 > size) {
+      RX_ERROR("Invalid command at byte %lu.", dx);
+      return -2;
+    }
+
+    num_packets += kanker_abb_get_command_packets(data[dx]);
+    dx += size;
+  }
+
+  return num_packets;
+}
+
+int kanker_abb_write_frames(const uint8_t* data, size_t nbytes, Buffer& out) {
+
+  size_t dx = 0;
+
+  if (NULL == data && 0 != nbytes) {
+    RX_ERROR("Invalid data, NULL.");
+    return -1;
+  }
+
+  while (dx < nbytes) {
+
+    size_t size = nbytes - dx;
+    if (size > ABB_MAX_FRAME_PAYLOAD) {
+      size = ABB_MAX_FRAME_PAYLOAD;
+    }
+
+    out.writeU8(ABB_CMD_FRAME);
+    out.writeU16((uint16_t)size);
+    out.data.insert(out.data.end(), data + dx, data + dx + size);
+
+    dx += size;
+  }
+
+  return 0;
+}
+
+int kanker_abb_get_command_packets(uint8_t cmd) {
+
+  switch (cmd) {
+    case ABB_CMD_ARC:            { return 2; }
+    case ABB_CMD_POSITION:
+    case ABB_CMD_POSITION_DELTA:
+    case ABB_CMD_IO:
+    case ABB_CMD_ZONE:
+    case ABB_CMD_HOME:           { return 1; }
+    default:                     { return 0; }
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
+/* Returns the distance between `p` and the line segment from `a` to `b`. */
+static float kanker_abb_segment_distance(const vec3& p, const vec3& a, const vec3& b) {
+
+  vec3 ab = b - a;
+  vec3 ap = p - a;
+  float len_sq = dot(ab, ab);
+  float t = 0.0f;
+
+  if (0.0f < len_sq) {
+    t = dot(ap, ab) / len_sq;
+    t = (t < 0.0f) ? 0.0f : (t > 1.0f) ? 1.0f : t;
+  }
+
+  vec3 d = ap - ab * t;
+
+  return sqrtf(dot(d, d));
+}
+
+/* 
+   Returns the area of the triangle a, b, c when we can remove `b`, which is
+   when all points between `a` and `c` are within `tolerance` of the line
+   from `a` to `c`. Returns FLT_MAX when we can't remove `b`.
+*/
+static float kanker_abb_removal_area(std::vector<vec3>& points, size_t a, size_t b, size_t c, float tolerance) {
+
+  if (false == kanker_abb_is_within_tolerance(points, a, c, tolerance)) {
+    return FLT_MAX;
+  }
+
+  vec3 n = cross(points[b] - points[a], points[c] - points[a]);
+
+  return 0.5f * sqrtf(dot(n, n));
+}
+
+/* Returns true when all points between `a` and `c` are within `tolerance` of the line from `a` to `c`. */
+static bool kanker_abb_is_within_tolerance(std::vector<vec3>& points, size_t a, size_t c, float tolerance) {
+
+  for (size_t i = a + 1; i < c; ++i) {
+    if (kanker_abb_segment_distance(points[i], points[a], points[c]) > tolerance) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/*
+  Removes the kept points that are closer then `minDist` to the
+  previous kept point, but only when all original points between its
+  neighbours stay within `tolerance` of the new line. The first and
+  last point are always kept; when the last point is too close we try
+  to remove the point before it. A point we can't remove within the
+  tolerance stays, even when it's close.
+*/
+static void kanker_abb_merge_close_points(std::vector<vec3>& points, std::vector<char>& keep, float minDist, float tolerance) {
+
+  float min_dist_sq = minDist * minDist;
+  size_t n = points.size();
+  size_t prev = 0;                                         /* The last point we keep. */
+  size_t prev_prev = 0;                                    /* The point we keep before `prev`. */
+
+  if (0.0f >= minDist || 3 > n) {
+    return;
+  }
+
+  for (size_t i = 1; i < n; ++i) {
+
+    if (0 == keep[i]) {
+      continue;
+    }
+
+    vec3 d = points[i] - points[prev];
+
+    if (dot(d, d) < min_dist_sq) {
+
+      if (n - 1 != i) {
+        size_t next = i + 1;
+        while (0 == keep[next]) {
+          ++next;
+        }
+        if (kanker_abb_is_within_tolerance(points, prev, next, tolerance)) {
+          keep[i] = 0;
+          continue;
+        }
+      }
+      else if (0 != prev && kanker_abb_is_within_tolerance(points, prev_prev, i, tolerance)) {
+        keep[prev] = 0;
+      }
+    }
+
+    prev_prev = prev;
+    prev = i;
+  }
+}
+
+/* Reads a big endian float, see Buffer::writeFloat(). */
+static float kanker_abb_read_float(const uint8_t* data) {
+
+  float f;
+  uint8_t* p = (uint8_t*)&f;
+
+  p[0] = data[3];
+  p[1] = data[2];
+  p[2] = data[1];
+  p[3] = data[0];
+
+  return f;
+}
+
+/* 
+   Returns the zone for a move to `corner`, coming from `from` and going 
+   to `to`. The zone can't be bigger than half the distance to the 
+   neighbouring points. Sharp corners get the smallest zone so they stay 
+   sharp.
+*/
+static uint8_t kanker_abb_get_zone(const vec3& from, const vec3& corner, const vec3& to, int zoneMax) {
+
+  vec3 in = corner - from;
+  vec3 out = to - corner;
+  float len_in = sqrtf(dot(in, in));
+  float len_out = sqrtf(dot(out, out));
+  float zone = 0.5f * ((len_in < len_out) ? len_in : len_out);
+
+  if (0 >= zoneMax) {
+    return ABB_ZONE_FINE;
+  }
+
+  if (0.0f < len_in && 0.0f < len_out && 0.0f > dot(in, out)) {
+    return 1;
+  }
+
+  if (zone > zoneMax) {
+    zone = zoneMax;
+  }
+
+  if (zone < 1.0f) {
+    zone = 1.0f;
+  }
+
+  return (uint8_t)zone;
+}
+
+/* Sets `delta` to the difference between `from` and `to` in ABB_DELTA_SCALE units; returns false when it doesn't fit in an int16. */
+static bool kanker_abb_get_delta(const vec3& from, const vec3& to, int16_t* delta) {
+
+  float d[3] = { to.x - from.x, to.y - from.y, to.z - from.z };
+
+  for (int i = 0; i < 3; ++i) {
+
+    float v = floorf(d[i] * ABB_DELTA_SCALE + 0.5f);
+    if (v < -32768.0f || v > 32767.0f) {
+      return false;
+    }
+
+    delta[i] = (int16_t)v;
+  }
+
+  return true;
+}
+
+/* Reads a big endian int16. */
+static int16_t kanker_abb_read_s16(const uint8_t* data) {
+  return (int16_t)(((uint16_t)data[0] << 8) | data[1]);
+}
@@ -3,16 +3,41 @@
 
 using namespace rapidxml;
 
+/* ----------------------------------------------------------------- */
+
+KankerAbbControllerSettings::KankerAbbControllerSettings()
+  :use_thread(false)
+{
+}
+
+KankerAbbControllerCommand::KankerAbbControllerCommand()
+  :type(KC_COMMAND_NONE)
+{
+}
+
+KankerAbbControllerEvent::KankerAbbControllerEvent()
+  :type(KC_EVENT_NONE)
+  ,packets_drawn(0)
+  ,packets_total(0)
+  ,code(0)
+{
+}
+
+/* ----------------------------------------------------------------- */
 
 KankerAbbController::KankerAbbController() 
   :is_init(-1)
   ,state(KC_STATE_NONE)
   ,last_message_id(-1)
   ,listener(NULL)
+  ,commands(KC_COMMAND_QUEUE_SIZE)
+  ,events(KC_EVENT_QUEUE_SIZE)
+  ,must_stop(0)
 {
 }
 
 KankerAbbController::~KankerAbbController() {  
+  shutdown();
   listener = NULL;
 }
 
@@ -39,7 +64,8 @@ int KankerAbbController::init(KankerAbbControllerSettings cfg,
     return -5;
   }
 
-  if (0 != kanker_font.load(cfg.font_file)) {
+  /* We only need the glyphs of the messages we write, so parse them on first use. */
+  if (0 != kanker_font.load(cfg.font_file, KANKER_FONT_LOAD_LAZY)) {
     return -7;
   }
 
@@ -48,22 +74,58 @@ int KankerAbbController::init(KankerAbbControllerSettings cfg,
     return -8;
   }
 
-  if (0 != kanker_abb.setAbbListener(lis)) {
+  /* We forward the events of the Abb, see handleEvent(). */
+  if (0 != kanker_abb.setAbbListener(this)) {
     RX_ERROR("Failed to set the listener on KankerAbb.");
     return -9;
   }
 
-  if (0 != kanker_abb.connect()) {
+  listener = lis;
+  settings = cfg;
+
+  /* From here on only the I/O thread uses `kanker_abb`; it connects. The reactors must exist before both threads use them. */
+  if (settings.use_thread) {
+
+    if (0 != kanker_abb.reactor.init() || 0 != event_reactor.init()) {
+      RX_ERROR("Failed to create the reactors for the I/O thread.");
+      return -11;
+    }
+
+    thread_atomic_store(&must_stop, 0);
+    if (0 != thread.create(threadMain, this)) {
+      RX_ERROR("Failed to start the I/O thread.");
+      return -10;
+    }
+  }
+  else if (0 != kanker_abb.connect()) {
     RX_VERBOSE("Failed to connect to the ABB. We will retry in update().");
   }
 
-  listener = lis;
-  settings = cfg;
   is_init = 0;
 
   return 0;
 }
 
+int KankerAbbController::shutdown() {
+
+  if (false == thread.isRunning()) {
+    return 0;
+  }
+
+  thread_atomic_store(&must_stop, 1);
+  kanker_abb.reactor.wakeup();
+
+  if (0 != thread.join()) {
+    RX_ERROR("Failed to join the I/O thread.");
+    return -1;
+  }
+
+  /* Deliver what the thread reported before it stopped. */
+  processEvents();
+
+  return 0;
+}
+
 int KankerAbbController::writeText(int64_t id, std::string text) {
 
   if (0 != is_init) {
@@ -82,6 +144,27 @@ int KankerAbbController::writeText(int64_t id, std::string text) {
 
   last_message_id = id;
 
+  if (settings.use_thread) {
+
+    KankerAbbControllerCommand cmd;
+    cmd.type = KC_COMMAND_WRITE_TEXT;
+    cmd.text = text;
+
+    if (0 != commands.push(cmd)) {
+      RX_ERROR("The command queue of the I/O thread is full; cannot write: %s", text.c_str());
+      return -5;
+    }
+
+    kanker_abb.reactor.wakeup();
+
+    return 0;
+  }
+
+  return processText(text);
+}
+
+int KankerAbbController::processText(std::string& text) {
+
   abb_glyphs.clear();
   abb_points.clear();
   
@@ -90,6 +173,11 @@ int KankerAbbController::writeText(int64_t id, std::string text) {
     return -3;
   }
 
+  /* Reorder the strokes so the robot travels less with the lamp off. */
+  if (0 != kanker_abb.stroke_optimizer.optimize(abb_glyphs)) {
+    RX_WARNING("Failed to optimize the stroke order; we write the strokes in the order of the font.");
+  }
+
   if(0 != kanker_abb.sendText(abb_glyphs)) {
     RX_ERROR("Failed to send text.");
     return -4;
@@ -98,10 +186,216 @@ int KankerAbbController::writeText(int64_t id, std::string text) {
   return 0;
 }
 
+int KankerAbbController::estimateText(std::string text, KankerAbbMotionEstimate& result) {
+
+  std::vector<KankerAbbGlyph> glyphs;
+  std::vector<std::vector<vec3> > points;
+
+  if (0 != is_init) {
+    RX_ERROR("Not initialized, cannot estimate text.");
+    return -1;
+  }
+
+  if (settings.use_thread) {
+    RX_ERROR("Cannot estimate text while the I/O thread uses the ABB.");
+    return -4;
+  }
+
+  if (0 != kanker_abb.write(kanker_font, text, glyphs, points)) {
+    RX_ERROR("Failed to write the text: %s", text.c_str());
+    return -2;
+  }
+
+  if (0 != kanker_abb.stroke_optimizer.optimize(glyphs)) {
+    RX_WARNING("Failed to optimize the stroke order; we estimate the strokes in the order of the font.");
+  }
+
+  if (0 != kanker_abb.estimateMessage(glyphs, result)) {
+    RX_ERROR("Failed to estimate the text: %s", text.c_str());
+    return -3;
+  }
+
+  return 0;
+}
+
 void KankerAbbController::update() {
+
+  if (settings.use_thread) {
+    processEvents();
+    return;
+  }
+
   kanker_abb.update();
 }
 
+void KankerAbbController::poll(int timeoutMillis) {
+
+  if (settings.use_thread) {
+
+    /* handleEvent() wakes us up; we can also wake up for an event that update() already handled, so we check the queue again. */
+    uint64_t end = (0 < timeoutMillis) ? rx_hrtime() + (uint64_t)timeoutMillis * 1000000ull : 0;
+
+    while (0 == events.size() && 0 != timeoutMillis) {
+
+      if (0 > event_reactor.wait(-1, SOCKET_EVENT_NONE, timeoutMillis)) {
+        break;
+      }
+
+      if (0 < timeoutMillis) {
+        uint64_t now = rx_hrtime();
+        timeoutMillis = (now >= end) ? 0 : (int)((end - now + 999999ull) / 1000000ull);
+      }
+    }
+
+    processEvents();
+    return;
+  }
+
+  kanker_abb.poll(timeoutMillis);
+}
+
+/* ----------------------------------------------------------------- */
+
+void KankerAbbController::threadMain(void* user) {
+  KankerAbbController* controller = static_cast<KankerAbbController*>(user);
+  controller->runThread();
+}
+
+/*
+  The I/O thread. The replies of the Abb are handled as soon as they
+  arrive, so the next batch is sent without waiting for the thread
+  that calls update(). We sleep until the Abb sends something, a timer
+  of `kanker_abb` is due, or writeText() and shutdown() wake us up.
+*/
+void KankerAbbController::runThread() {
+
+  RX_VERBOSE("Started the I/O thread of the ABB.");
+
+  if (0 != kanker_abb.connect()) {
+    RX_VERBOSE("Failed to connect to the ABB. We will retry.");
+  }
+
+  while (0 == thread_atomic_load(&must_stop)) {
+    processCommands();
+    kanker_abb.poll(-1);
+  }
+
+  RX_VERBOSE("Stopped the I/O thread of the ABB.");
+}
+
+void KankerAbbController::processCommands() {
+
+  KankerAbbControllerCommand cmd;
+
+  while (0 == commands.pop(cmd)) {
+
+    switch (cmd.type) {
+
+      case KC_COMMAND_WRITE_TEXT: {
+        processText(cmd.text);
+        break;
+      }
+
+      default: {
+        RX_ERROR("Unknown command for the I/O thread: %d", cmd.type);
+        break;
+      }
+    }
+  }
+}
+
+void KankerAbbController::processEvents() {
+
+  KankerAbbControllerEvent event;
+
+  while (0 == events.pop(event)) {
+    dispatchEvent(event);
+  }
+}
+
+void KankerAbbController::handleEvent(KankerAbbControllerEvent& event) {
+
+  if (false == settings.use_thread) {
+    dispatchEvent(event);
+    return;
+  }
+
+  if (0 != events.push(event)) {
+    RX_WARNING("The event queue is full, update() isn't called often enough; dropping event: %d", event.type);
+    return;
+  }
+
+  event_reactor.wakeup();
+}
+
+void KankerAbbController::dispatchEvent(KankerAbbControllerEvent& event) {
+
+  if (NULL == listener) {
+    return;
+  }
+
+  switch (event.type) {
+    case KC_EVENT_READY_TO_DRAW:  { listener->onAbbReadyToDraw();                                      break; }
+    case KC_EVENT_DRAWING:        { listener->onAbbDrawing();                                          break; }
+    case KC_EVENT_CONNECTED:      { listener->onAbbConnected();                                        break; }
+    case KC_EVENT_DISCONNECTED:   { listener->onAbbDisconnected();                                     break; }
+    case KC_EVENT_MESSAGE_READY:  { listener->onAbbMessageReady();                                     break; }
+    case KC_EVENT_PROGRESS:       { listener->onAbbProgress(event.packets_drawn, event.packets_total); break; }
+    case KC_EVENT_ERROR:          { listener->onAbbError(event.code);                                  break; }
+    default: {
+      RX_ERROR("Unknown event: %d", event.type);
+      break;
+    }
+  }
+}
+
+/* ----------------------------------------------------------------- */
+
+void KankerAbbController::onAbbReadyToDraw() {
+  KankerAbbControllerEvent event;
+  event.type = KC_EVENT_READY_TO_DRAW;
+  handleEvent(event);
+}
+
+void KankerAbbController::onAbbDrawing() {
+  KankerAbbControllerEvent event;
+  event.type = KC_EVENT_DRAWING;
+  handleEvent(event);
+}
+
+void KankerAbbController::onAbbConnected() {
+  KankerAbbControllerEvent event;
+  event.type = KC_EVENT_CONNECTED;
+  handleEvent(event);
+}
+
+void KankerAbbController::onAbbDisconnected() {
+  KankerAbbControllerEvent event;
+  event.type = KC_EVENT_DISCONNECTED;
+  handleEvent(event);
+}
+
+void KankerAbbController::onAbbMessageReady() {
+  KankerAbbControllerEvent event;
+  event.type = KC_EVENT_MESSAGE_READY;
+  handleEvent(event);
+}
+
+void KankerAbbController::onAbbProgress(size_t packetsDrawn, size_t packetsTotal) {
+  KankerAbbControllerEvent event;
+  event.type = KC_EVENT_PROGRESS;
+  event.packets_drawn = packetsDrawn;
+  event.packets_total = packetsTotal;
+  handleEvent(event);
+}
+
+void KankerAbbController::onAbbError(int code) {
+  KankerAbbControllerEvent event;
+  event.type = KC_EVENT_ERROR;
+  event.code = code;
+  handleEvent(event);
+}
+
 /*
 void KankerAbbController::switchState(int st) {
 
@@ -0,0 +1,330 @@
+#include <math.h>
+#include <kanker/KankerAbbMotionModel.h>
+#include <kanker/KankerAbb.h>
+
+/* ---------------------------------------------------------------------- */
+
+static double motion_arc_length(const vec3& a, const vec3& b, const vec3& c);
+static int motion_solve(double* m, double* v, int n);
+
+/* ---------------------------------------------------------------------- */
+
+KankerAbbMotionEstimate::KankerAbbMotionEstimate() {
+  clear();
+}
+
+void KankerAbbMotionEstimate::clear() {
+  motion_time = 0.0;
+  distance = 0.0;
+  num_stops = 0;
+  num_io = 0;
+  num_draws = 0;
+  num_homes = 0;
+  seconds = 0.0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+KankerAbbMotionSample::KankerAbbMotionSample()
+  :measured(0.0)
+{
+}
+
+/* ---------------------------------------------------------------------- */
+
+KankerAbbMotionModel::KankerAbbMotionModel()
+  :tcp_speed(700.0f)
+  ,tcp_accel(5000.0f)
+  ,ori_speed(500.0f)
+  ,ori_accel(2000.0f)
+  ,motion_scale(1.0f)
+  ,stop_time(0.05f)
+  ,io_time(0.01f)
+  ,draw_time(0.15f)
+  ,home_time(2.5f)
+  ,run_distance(0.0)
+  ,calibrate_interval(8)
+  ,num_new_samples(0)
+{
+  reset();
+}
+
+void KankerAbbMotionModel::reset() {
+  position.set(0.0f, 0.0f, 0.0f);
+  run_distance = 0.0;
+}
+
+int KankerAbbMotionModel::add(std::vector<KankerAbbCommand>& cmds, KankerAbbMotionEstimate& result) {
+
+  for (size_t i = 0; i < cmds.size(); ++i) {
+
+    KankerAbbCommand& cmd = cmds[i];
+
+    switch (cmd.type) {
+
+      case ABB_CMD_POSITION: {
+
+        vec3 d = cmd.position - position;
+        double dist = sqrt(dot(d, d));
+
+        result.distance += dist;
+        run_distance += dist;
+        position = cmd.position;
+
+        if (ABB_ZONE_FINE == cmd.zone || 0.0f != cmd.rot_z) {
+          stop(result);
+        }
+
+        /* FreeWriting.mod rotates joint 6 after the move. */
+        if (0.0f != cmd.rot_z) {
+          result.motion_time += getMoveTime(fabs(cmd.rot_z), ori_speed, ori_accel);
+          result.num_stops++;
+        }
+        break;
+      }
+
+      case ABB_CMD_ARC: {
+
+        double dist = motion_arc_length(position, cmd.via, cmd.position);
+
+        result.distance += dist;
+        run_distance += dist;
+        position = cmd.position;
+
+        if (ABB_ZONE_FINE == cmd.zone) {
+          stop(result);
+        }
+        break;
+      }
+
+      case ABB_CMD_IO: {
+        result.num_io++;
+        break;
+      }
+
+      case ABB_CMD_DRAW: {
+        stop(result);
+        result.num_draws++;
+        break;
+      }
+
+      case ABB_CMD_DRAW_BANKED: {
+        stop(result);
+        if (1.0f == cmd.position.x) {
+          result.num_draws++;
+        }
+        break;
+      }
+
+      case ABB_CMD_GET_STATE: {
+        break;
+      }
+
+      case ABB_CMD_HOME: {
+        stop(result);
+        result.num_homes++;
+        position.set(0.0f, 0.0f, 0.0f);
+        break;
+      }
+
+      default: {
+        RX_ERROR("Cannot estimate command: %d", cmd.type);
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+void KankerAbbMotionModel::finish(KankerAbbMotionEstimate& result) {
+
+  stop(result);
+
+  result.seconds = result.motion_time * motion_scale
+    + result.num_stops * stop_time
+    + result.num_io * io_time
+    + result.num_draws * draw_time
+    + result.num_homes * home_time;
+}
+
+double KankerAbbMotionModel::getMoveTime(double dist, double speed, double accel) {
+
+  if (0.0 >= dist || 0.0 >= speed || 0.0 >= accel) {
+    return 0.0;
+  }
+
+  /* We can't reach the maximum speed; accelerate for the first half, decelerate for the second. */
+  if (dist < (speed * speed) / accel) {
+    return 2.0 * sqrt(dist / accel);
+  }
+
+  return dist / speed + speed / accel;
+}
+
+void KankerAbbMotionModel::stop(KankerAbbMotionEstimate& result) {
+
+  if (0.0 >= run_distance) {
+    return;
+  }
+
+  result.motion_time += getMoveTime(run_distance, tcp_speed, tcp_accel);
+  result.num_stops++;
+  run_distance = 0.0;
+}
+
+int KankerAbbMotionModel::addSample(KankerAbbMotionEstimate& estimate, double measured) {
+
+  if (0.0 >= measured) {
+    RX_ERROR("Invalid measured time: %f", measured);
+    return -1;
+  }
+
+  KankerAbbMotionSample sample;
+  sample.estimate = estimate;
+  sample.measured = measured;
+  samples.push_back(sample);
+  num_new_samples++;
+
+  if (samples.size() > ABB_MOTION_MAX_SAMPLES) {
+    samples.erase(samples.begin());
+  }
+
+  return 0;
+}
+
+/*
+   We minimize the squared error between the estimates and the measured
+   times. The regularization keeps the costs we can't observe (e.g. when
+   no sample moved home) at their current value.
+*/
+int KankerAbbMotionModel::calibrate() {
+
+  double m[ABB_MOTION_NUM_FEATURES * ABB_MOTION_NUM_FEATURES] = { 0 };
+  double v[ABB_MOTION_NUM_FEATURES] = { 0 };
+  double current[ABB_MOTION_NUM_FEATURES] = { motion_scale, stop_time, io_time, draw_time, home_time };
+  double lambda = 1e-3;
+
+  /* We wait for new samples before we try again, also when the fit fails. */
+  num_new_samples = 0;
+
+  if (0 == samples.size()) {
+    RX_ERROR("No samples, cannot calibrate.");
+    return -1;
+  }
+
+  for (size_t i = 0; i < samples.size(); ++i) {
+
+    KankerAbbMotionEstimate& e = samples[i].estimate;
+    double f[ABB_MOTION_NUM_FEATURES] = { e.motion_time, (double)e.num_stops, (double)e.num_io, (double)e.num_draws, (double)e.num_homes };
+
+    for (int r = 0; r < ABB_MOTION_NUM_FEATURES; ++r) {
+      for (int c = 0; c < ABB_MOTION_NUM_FEATURES; ++c) {
+        m[r * ABB_MOTION_NUM_FEATURES + c] += f[r] * f[c];
+      }
+      v[r] += f[r] * samples[i].measured;
+    }
+  }
+
+  for (int r = 0; r < ABB_MOTION_NUM_FEATURES; ++r) {
+    m[r * ABB_MOTION_NUM_FEATURES + r] += lambda;
+    v[r] += lambda * current[r];
+  }
+
+  if (0 != motion_solve(m, v, ABB_MOTION_NUM_FEATURES)) {
+    RX_ERROR("Cannot calibrate, the samples don't give a solution.");
+    return -2;
+  }
+
+  for (int r = 0; r < ABB_MOTION_NUM_FEATURES; ++r) {
+    if (0.0 > v[r]) {
+      RX_ERROR("Cannot calibrate, the fit gives a negative cost; add more samples.");
+      return -3;
+    }
+  }
+
+  motion_scale = v[0];
+  stop_time = v[1];
+  io_time = v[2];
+  draw_time = v[3];
+  home_time = v[4];
+
+  RX_VERBOSE("Calibrated with %lu samples: motion_scale: %f, stop_time: %f, io_time: %f, draw_time: %f, home_time: %f",
+             samples.size(), motion_scale, stop_time, io_time, draw_time, home_time);
+
+  return 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+/* The length of the arc from `a` through `b` to `c`; falls back to the length of the lines when the points are on one line. */
+static double motion_arc_length(const vec3& a, const vec3& b, const vec3& c) {
+
+  vec3 ab = b - a;
+  vec3 bc = c - b;
+  vec3 ac = c - a;
+  vec3 n = cross(ab, ac);
+  double len_ab = sqrt(dot(ab, ab));
+  double len_bc = sqrt(dot(bc, bc));
+  double len_ac = sqrt(dot(ac, ac));
+  double area2 = sqrt(dot(n, n));
+
+  if (1e-6 > area2) {
+    return len_ab + len_bc;
+  }
+
+  /* The radius of the circle through a, b and c. The angle at b is the inscribed angle of the chord a-c, so the arc is 2 * (pi - angle_b). */
+  double radius = (len_ab * len_bc * len_ac) / (2.0 * area2);
+  double cos_b = -dot(ab, bc) / (len_ab * len_bc);
+
+  cos_b = (cos_b < -1.0) ? -1.0 : (cos_b > 1.0) ? 1.0 : cos_b;
+
+  return radius * 2.0 * (M_PI - acos(cos_b));
+}
+
+/* Solves m * x = v with Gaussian elimination; the result is stored in `v`. */
+static int motion_solve(double* m, double* v, int n) {
+
+  for (int col = 0; col < n; ++col) {
+
+    int pivot = col;
+
+    for (int r = col + 1; r < n; ++r) {
+      if (fabs(m[r * n + col]) > fabs(m[pivot * n + col])) {
+        pivot = r;
+      }
+    }
+
+    if (1e-12 > fabs(m[pivot * n + col])) {
+      return -1;
+    }
+
+    if (pivot != col) {
+      for (int c = 0; c < n; ++c) {
+        double tmp = m[col * n + c];
+        m[col * n + c] = m[pivot * n + c];
+        m[pivot * n + c] = tmp;
+      }
+      double tmp = v[col];
+      v[col] = v[pivot];
+      v[pivot] = tmp;
+    }
+
+    for (int r = col + 1; r < n; ++r) {
+      double f = m[r * n + col] / m[col * n + col];
+      for (int c = col; c < n; ++c) {
+        m[r * n + c] -= f * m[col * n + c];
+      }
+      v[r] -= f * v[col];
+    }
+  }
+
+  for (int r = n - 1; r >= 0; --r) {
+    for (int c = r + 1; c < n; ++c) {
+      v[r] -= m[r * n + c] * v[c];
+    }
+    v[r] /= m[r * n + r];
+  }
+
+  return 0;
+}
@@ -0,0 +1,151 @@
+#include <kanker/KankerAbbPacker.h>
+#include <kanker/KankerAbb.h>
+
+/* ---------------------------------------------------------------------- */
+
+KankerAbbPackerUnit::KankerAbbPackerUnit()
+  :num_packets(0)
+  ,glyph(0)
+{
+}
+
+/* ---------------------------------------------------------------------- */
+
+KankerAbbBatch::KankerAbbBatch() {
+  clear();
+}
+
+void KankerAbbBatch::clear() {
+  data.clear();
+  num_packets = 0;
+  first_glyph = 0;
+  last_glyph = 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+KankerAbbPacker::KankerAbbPacker()
+  :max_packets(ABB_MAX_PACKETS)
+  ,batch_glyphs(true)
+  ,use_banks(false)
+{
+}
+
+void KankerAbbPacker::clear() {
+  units.clear();
+}
+
+int KankerAbbPacker::add(const uint8_t* data, size_t nbytes, size_t glyph) {
+
+  KankerAbbPackerUnit unit;
+  int num_packets = 0;
+
+  if (NULL == data || 0 == nbytes) {
+    RX_ERROR("No data given.");
+    return -1;
+  }
+
+  num_packets = kanker_abb_count_packets(data, nbytes);
+  if (0 > num_packets) {
+    RX_ERROR("Invalid commands.");
+    return -2;
+  }
+
+  unit.num_packets = num_packets;
+
+  if (unit.num_packets > getPacketLimit()) {
+    RX_ERROR("The commands need %lu packets, but we can only store %lu.", unit.num_packets, getPacketLimit());
+    return -3;
+  }
+
+  unit.data.assign(data, data + nbytes);
+  unit.glyph = glyph;
+  units.push_back(unit);
+
+  return 0;
+}
+
+int KankerAbbPacker::pack(std::vector<KankerAbbBatch>& out) {
+
+  KankerAbbBatch batch;
+  size_t limit = getPacketLimit();
+  size_t i = 0;
+
+  out.clear();
+
+  if (0 == limit) {
+    RX_ERROR("The max_packets is 0.");
+    return -1;
+  }
+
+  while (i < units.size()) {
+
+    /* Find the units of the current glyph. */
+    size_t end = i;
+    size_t glyph_packets = 0;
+
+    while (end < units.size() && units[end].glyph == units[i].glyph) {
+      glyph_packets += units[end].num_packets;
+      ++end;
+    }
+
+    /* Start a new batch when the glyph doesn't fit in the current one. */
+    if (0 != batch.data.size() && (false == batch_glyphs || batch.num_packets + glyph_packets > limit)) {
+      finishBatch(batch, out);
+    }
+
+    for (size_t k = i; k < end; ++k) {
+
+      KankerAbbPackerUnit& unit = units[k];
+
+      /* The glyph is too big for one batch; we split it between its strokes. */
+      if (0 != batch.data.size() && batch.num_packets + unit.num_packets > limit) {
+        finishBatch(batch, out);
+      }
+
+      if (0 == batch.data.size()) {
+        batch.first_glyph = unit.glyph;
+      }
+
+      batch.data.insert(batch.data.end(), unit.data.begin(), unit.data.end());
+      batch.num_packets += unit.num_packets;
+      batch.last_glyph = unit.glyph;
+    }
+
+    i = end;
+  }
+
+  if (0 != batch.data.size()) {
+    finishBatch(batch, out);
+  }
+
+  /* The robot tells us when the last bank has been drawn. */
+  if (use_banks && 0 != out.size()) {
+    out.back().data.back() = 1;
+  }
+
+  return 0;
+}
+
+void KankerAbbPacker::finishBatch(KankerAbbBatch& batch, std::vector<KankerAbbBatch>& out) {
+
+  if (use_banks) {
+    batch.data.push_back(ABB_CMD_DRAW_BANKED);
+    batch.data.push_back(0);
+  }
+  else {
+    batch.data.push_back(ABB_CMD_DRAW);
+  }
+
+  out.push_back(batch);
+  batch.clear();
+}
+
+size_t KankerAbbPacker::getPacketLimit() {
+
+  if (use_banks && max_packets > ABB_BANK_PACKETS) {
+    return ABB_BANK_PACKETS;
+  }
+
+  return max_packets;
+}
@@ -0,0 +1,169 @@
+#include <kanker/KankerAbbPeephole.h>
+#include <kanker/KankerAbb.h>
+
+/* ---------------------------------------------------------------------- */
+
+KankerAbbPeepholeStats::KankerAbbPeepholeStats() {
+  clear();
+}
+
+void KankerAbbPeepholeStats::clear() {
+  commands_in = 0;
+  commands_out = 0;
+  packets_in = 0;
+  packets_out = 0;
+  moves_removed = 0;
+  io_removed = 0;
+}
+
+void KankerAbbPeepholeStats::print() {
+  RX_VERBOSE("Peephole: commands %lu -> %lu, packets %lu -> %lu, removed %lu moves and %lu io commands.",
+             commands_in, commands_out, packets_in, packets_out, moves_removed, io_removed);
+}
+
+/* ---------------------------------------------------------------------- */
+
+KankerAbbPeephole::KankerAbbPeephole()
+  :epsilon(0.01f)
+{
+}
+
+int KankerAbbPeephole::optimize(std::vector<KankerAbbCommand>& cmds) {
+
+  std::vector<KankerAbbCommand> out;
+  std::vector<KankerAbbCommand> pending;                   /* The I/O changes since the last move. */
+  std::map<int, int> state;                                /* The value of the ports we know. */
+  vec3 position;
+  bool has_position = false;
+  int last_move = -1;                                      /* The index of the last move in `out`. */
+
+  out.reserve(cmds.size());
+
+  for (size_t i = 0; i < cmds.size(); ++i) {
+
+    KankerAbbCommand& cmd = cmds[i];
+
+    stats.commands_in++;
+    stats.packets_in += kanker_abb_get_command_packets(cmd.type);
+
+    if (ABB_CMD_IO == cmd.type) {
+
+      /* Only the last change of a port before the next move matters. */
+      int port = (int)cmd.position.x;
+      for (size_t k = 0; k < pending.size(); ++k) {
+        if ((int)pending[k].position.x == port) {
+          pending.erase(pending.begin() + k);
+          stats.io_removed++;
+          break;
+        }
+      }
+
+      pending.push_back(cmd);
+      continue;
+    }
+
+    flushIO(pending, state, out);
+
+    switch (cmd.type) {
+
+      case ABB_CMD_POSITION:
+      case ABB_CMD_ARC: {
+
+        bool is_same = has_position && isSamePosition(cmd.position, position);
+
+        if (ABB_CMD_ARC == cmd.type) {
+          is_same = is_same && isSamePosition(cmd.via, position);
+        }
+        else {
+          is_same = is_same && 0.0f == cmd.rot_z;
+        }
+
+        if (is_same && -1 != last_move) {
+
+          /* Keep the stop of a fine point; the I/O after it must happen while we stand still. */
+          KankerAbbCommand& prev = out[last_move];
+          if (cmd.zone < prev.zone) {
+            prev.zone = cmd.zone;
+          }
+
+          stats.moves_removed++;
+          break;
+        }
+
+        position = cmd.position;
+        has_position = true;
+        last_move = (int)out.size();
+        out.push_back(cmd);
+        break;
+      }
+
+      case ABB_CMD_DRAW:
+      case ABB_CMD_DRAW_BANKED: {
+
+        /* FreeWriting switches off all ports before and after it draws. */
+        std::map<int, int>::iterator it = state.begin();
+        while (it != state.end()) {
+          it->second = 0;
+          ++it;
+        }
+
+        last_move = -1;
+        out.push_back(cmd);
+        break;
+      }
+
+      case ABB_CMD_HOME: {
+        has_position = false;
+        last_move = -1;
+        out.push_back(cmd);
+        break;
+      }
+
+      case ABB_CMD_GET_STATE: {
+        out.push_back(cmd);
+        break;
+      }
+
+      default: {
+        RX_ERROR("Cannot optimize command: %d", cmd.type);
+        return -1;
+      }
+    }
+  }
+
+  flushIO(pending, state, out);
+
+  for (size_t i = 0; i < out.size(); ++i) {
+    stats.commands_out++;
+    stats.packets_out += kanker_abb_get_command_packets(out[i].type);
+  }
+
+  cmds.swap(out);
+
+  return 0;
+}
+
+void KankerAbbPeephole::flushIO(std::vector<KankerAbbCommand>& pending, std::map<int, int>& state, std::vector<KankerAbbCommand>& out) {
+
+  for (size_t i = 0; i < pending.size(); ++i) {
+
+    int port = (int)pending[i].position.x;
+    int value = (int)pending[i].position.y;
+    std::map<int, int>::iterator it = state.find(port);
+
+    if (it != state.end() && it->second == value) {
+      stats.io_removed++;
+      continue;
+    }
+
+    state[port] = value;
+    out.push_back(pending[i]);
+  }
+
+  pending.clear();
+}
+
+bool KankerAbbPeephole::isSamePosition(const vec3& a, const vec3& b) {
+  vec3 d = a - b;
+  return dot(d, d) <= (epsilon * epsilon);
+}
@@ -0,0 +1,87 @@
+#include <kanker/KankerAbbReplyParser.h>
+
+/* ---------------------------------------------------------------------- */
+
+KankerAbbReply::KankerAbbReply()
+  :type(ABB_REPLY_NONE)
+  ,value(0)
+{
+}
+
+/* ---------------------------------------------------------------------- */
+
+KankerAbbReplyParser::KankerAbbReplyParser() {
+  reset();
+}
+
+void KankerAbbReplyParser::reset() {
+  reply.type = ABB_REPLY_NONE;
+  reply.value = 0;
+  num_digits = 0;
+}
+
+int KankerAbbReplyParser::parse(const char* data, size_t nbytes, std::vector<KankerAbbReply>& out) {
+
+  int result = 0;
+
+  if (NULL == data) {
+    RX_ERROR("No data given.");
+    return -1;
+  }
+
+  for (size_t i = 0; i < nbytes; ++i) {
+
+    char c = data[i];
+
+    /* Continue with the value of the current reply. */
+    if (ABB_REPLY_NONE != reply.type) {
+
+      if (c >= '0' && c <= '9' && num_digits < ABB_REPLY_MAX_DIGITS) {
+        reply.value = reply.value * 10 + (c - '0');
+        num_digits++;
+        continue;
+      }
+
+      if (ABB_REPLY_END == c && 0 < num_digits) {
+        out.push_back(reply);
+        reset();
+        continue;
+      }
+
+      /* The reply is invalid; we drop it and see if `c` starts a new one. */
+      RX_WARNING("Invalid value for reply `%c`, skipping it.", reply.type);
+      reset();
+      result = -2;
+    }
+
+    switch (c) {
+
+      case ABB_REPLY_READY:
+      case ABB_REPLY_DRAWING:
+      case ABB_REPLY_BANK_FREE:
+      case ABB_REPLY_STARTING:
+      case ABB_REPLY_CONNECTED: {
+        KankerAbbReply state;
+        state.type = c;
+        out.push_back(state);
+        break;
+      }
+
+      case ABB_REPLY_PROGRESS:
+      case ABB_REPLY_ERROR: {
+        reply.type = c;
+        reply.value = 0;
+        num_digits = 0;
+        break;
+      }
+
+      default: {
+        RX_WARNING("Unknown reply from the Abb: %d, skipping it.", (int)c);
+        result = -3;
+        break;
+      }
+    }
+  }
+
+  return result;
+}
@@ -208,7 +208,12 @@ int KankerApp::createGui() {
   group_abb->add(new Slider<int>("ABB.max_x", kanker_abb.max_x, -15000, 15000, 1, GUI_STYLE_NONE));
   group_abb->add(new Slider<int>("ABB.min_y", kanker_abb.min_y, -15000, 15000, 1, GUI_STYLE_NONE));
   group_abb->add(new Slider<int>("ABB.max_y", kanker_abb.max_y, -15000, 15000, 1, GUI_STYLE_NONE));
-  group_abb->add(new Slider<float>("ABB.min_point_dist", kanker_abb.min_point_dist, 1.0, 50.0, 0.5, GUI_STYLE_NONE)).setMarginBottom(10);
+  group_abb->add(new Slider<float>("ABB.min_point_dist", kanker_abb.min_point_dist, 1.0, 50.0, 0.5, GUI_STYLE_NONE));
+  group_abb->add(new Slider<int>("ABB.simplify_mode", kanker_abb.simplify_mode, 0, 2, 1, GUI_STYLE_NONE));
+  group_abb->add(new Slider<float>("ABB.simplify_tolerance", kanker_abb.simplify_tolerance, 0.0, 10.0, 0.1, GUI_STYLE_NONE));
+  group_abb->add(new Slider<float>("ABB.arc_tolerance", kanker_abb.arc_fitter.tolerance, 0.0, 10.0, 0.1, GUI_STYLE_NONE));
+  group_abb->add(new Slider<int>("ABB.zone_max", kanker_abb.zone_max, 0, 10, 1, GUI_STYLE_NONE));
+  group_abb->add(new Slider<float>("ABB.stroke_join_tolerance", kanker_abb.stroke_optimizer.join_tolerance, 0.0, 10.0, 0.1, GUI_STYLE_NONE)).setMarginBottom(10);
   group_abb->add(new Text("ABB.host", kanker_abb.abb_host));
   group_abb->add(new Slider<int>("ABB.port", kanker_abb.abb_port, 0, 999999, 1, GUI_STYLE_NONE)).setMarginBottom(10);
   group_abb->add(new Button("Save ABB Settings", 0, GUI_ICON_FLOPPY_O, on_abb_save_settings_clicked, this, GUI_STYLE_NONE));
@@ -281,10 +286,14 @@ void KankerApp::drawStateHome() {
 void KankerApp::drawStateFontTest() {
 
   if (0 != kanker_font.size()) {
-    std::vector<KankerAbbGlyph> result;
-    std::vector<std::vector<vec3> > points;
-    kanker_abb.write(kanker_font, test_message, result, points);
-    preview_drawer.updateVertices(points);
+
+    /* Only upload new vertices when the layout actually changed. */
+    if (0 == test_layout.update(kanker_abb, kanker_font, test_message)
+        && true == test_layout.has_changed)
+      {
+        preview_drawer.updateVertices(test_layout.segments);
+      }
+
     preview_drawer.drawLines();
   }
 
@@ -324,14 +333,15 @@ void KankerApp::drawStateCharInputDrawing() {
 
 void KankerApp::drawGlyphAsLine(KankerGlyph* glyph, float offsetX, float offsetY) {
 
-  for (size_t i = 0; i < glyph->segments.size(); ++i) {
+  for (size_t i = 0; i < glyph->getNumSegments(); ++i) {
 
-    std::vector<vec3>& seg = glyph->segments[i];
-    if (seg.size() < 2) {
+    vec3* seg = glyph->getSegmentPoints(i);
+    size_t num_points = glyph->getSegmentSize(i);
+    if (num_points < 2) {
       continue;
     }
 
-    for (size_t j = 0; j < seg.size() - 1; ++j) {
+    for (size_t j = 0; j < num_points - 1; ++j) {
       vec3& a = seg[j];
       vec3& b = seg[j + 1];
       painter.line(a.x + offsetX, a.y + offsetY, b.x + offsetX, b.y + offsetY);
@@ -501,6 +511,11 @@ void KankerApp::switchState(int newstate) {
       }
       break;
     }
+    case KSTATE_FONT_TEST: {
+      /* We edit glyphs through `kanker_glyph`; make sure the font test doesn't use cached glyphs and uploads its vertices again. */
+      kanker_font.markChanged();
+      break;
+    }
     case KSTATE_CHAR_OVERVIEW: {
       glyph_dx = -1;
       onKeyRelease(GLFW_KEY_RIGHT, 0, 0);
@@ -0,0 +1,151 @@
+#include <math.h>
+#include <kanker/KankerArcFitter.h>
+
+/* ---------------------------------------------------------------------- */
+
+#define ARC_MAX_RADIUS 100000.0f                                 /* Circles with a bigger radius are considered to be straight lines. */
+
+/* ---------------------------------------------------------------------- */
+
+KankerArcSpan::KankerArcSpan()
+  :start(0)
+  ,end(0)
+  ,is_arc(false)
+{
+}
+
+/* ---------------------------------------------------------------------- */
+
+KankerArcFitter::KankerArcFitter()
+  :tolerance(1.0f)
+  ,max_sweep(180.0f)
+  ,max_step(60.0f)
+{
+}
+
+int KankerArcFitter::fit(std::vector<vec3>& points, std::vector<KankerArcSpan>& out) {
+
+  KankerArcSpan arc;
+  KankerArcSpan best;
+  size_t i = 0;
+
+  out.clear();
+
+  if (0 > tolerance) {
+    RX_ERROR("Invalid tolerance: %f", tolerance);
+    return -1;
+  }
+
+  while (i + 1 < points.size()) {
+
+    bool found = false;
+
+    /* Grow the arc as long as the points fit; straight runs may still become an arc when they're longer. */
+    for (size_t e = i + 2; 0.0f < tolerance && e < points.size(); ++e) {
+
+      bool is_straight = false;
+
+      if (fitArc(points, i, e, arc, is_straight)) {
+        best = arc;
+        found = true;
+        continue;
+      }
+
+      if (false == is_straight) {
+        break;
+      }
+    }
+
+    if (found) {
+      out.push_back(best);
+      i = best.end;
+      continue;
+    }
+
+    KankerArcSpan line;
+    line.start = i;
+    line.end = i + 1;
+    out.push_back(line);
+    ++i;
+  }
+
+  return 0;
+}
+
+bool KankerArcFitter::fitArc(std::vector<vec3>& points, size_t start, size_t end, KankerArcSpan& arc, bool& isStraight) {
+
+  vec3& a = points[start];
+  vec3& b = points[(start + end) / 2];
+  vec3& c = points[end];
+  float sweep = 0.0f;
+  float dir = 0.0f;
+  float max_step_rad = max_step * (M_PI / 180.0f);
+  float max_sweep_rad = max_sweep * (M_PI / 180.0f);
+
+  isStraight = false;
+
+  /* The circle through a, b and c. */
+  float d = 2.0f * (a.x * (b.y - c.y) + b.x * (c.y - a.y) + c.x * (a.y - b.y));
+  if (fabsf(d) < 1e-6f) {
+    isStraight = true;
+    return false;
+  }
+
+  float aa = a.x * a.x + a.y * a.y;
+  float bb = b.x * b.x + b.y * b.y;
+  float cc = c.x * c.x + c.y * c.y;
+  float cx = (aa * (b.y - c.y) + bb * (c.y - a.y) + cc * (a.y - b.y)) / d;
+  float cy = (aa * (c.x - b.x) + bb * (a.x - c.x) + cc * (b.x - a.x)) / d;
+  float radius = sqrtf((a.x - cx) * (a.x - cx) + (a.y - cy) * (a.y - cy));
+
+  if (radius > ARC_MAX_RADIUS) {
+    isStraight = true;
+    return false;
+  }
+
+  dir = (d > 0.0f) ? 1.0f : -1.0f;
+
+  /* All points must be close to the circle and we must keep turning in the same direction. */
+  for (size_t i = start; i <= end; ++i) {
+
+    float px = points[i].x - cx;
+    float py = points[i].y - cy;
+
+    if (fabsf(sqrtf(px * px + py * py) - radius) > tolerance) {
+      return false;
+    }
+
+    if (i == end) {
+      break;
+    }
+
+    float nx = points[i + 1].x - cx;
+    float ny = points[i + 1].y - cy;
+    float step = atan2f(px * ny - py * nx, px * nx + py * ny) * dir;
+
+    if (step < 0.0f || step > max_step_rad) {
+      return false;
+    }
+
+    sweep += step;
+  }
+
+  if (sweep > max_sweep_rad) {
+    return false;
+  }
+
+  /* When the arc is hardly curved it's a line. */
+  if (radius * (1.0f - cosf(sweep * 0.5f)) < tolerance) {
+    isStraight = true;
+    return false;
+  }
+
+  float angle = atan2f(a.y - cy, a.x - cx) + dir * sweep * 0.5f;
+
+  arc.start = start;
+  arc.end = end;
+  arc.is_arc = true;
+  arc.via.set(cx + cosf(angle) * radius, cy + sinf(angle) * radius, b.z);
+
+  return true;
+}
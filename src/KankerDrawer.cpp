@@ -252,7 +252,7 @@ int KankerDrawer::updateVertices(std::vector<std::vector<vec3> >& lines) {
 
 int KankerDrawer::updateVertices(KankerGlyph glyph) {
 
-  if (0 == glyph.segments.size()) {
+  if (0 == glyph.getNumSegments()) {
     RX_ERROR("error: no segments in the glyph, cannot update vertices.");
     return -2;
   }
@@ -263,19 +263,20 @@ int KankerDrawer::updateVertices(KankerGlyph glyph) {
 
   glyph.normalizeAndCentralize();
 
-  for (size_t i = 0; i < glyph.segments.size(); ++i) {
+  for (size_t i = 0; i < glyph.getNumSegments(); ++i) {
 
-    std::vector<vec3>& points = glyph.segments[i];
-    if (points.size() < 2) {
+    vec3* points = glyph.getSegmentPoints(i);
+    size_t num_points = glyph.getSegmentSize(i);
+    if (num_points < 2) {
       RX_VERBOSE("Not engouh points in glyph segment, segment: %lu", i);
       continue;
     }
 
     offsets.push_back(vertices.size());
 
-    for (size_t k = 1; k < points.size() - 1; ++k) {
+    for (size_t k = 1; k < num_points - 1; ++k) {
 
-      float p = float(k-1)/(points.size()-2);
+      float p = float(k-1)/(num_points-2);
       vec3& a = points[k - 1];
       vec3& b = points[k];
       vec3 dir = b - a;
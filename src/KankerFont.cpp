@@ -1,43 +1,92 @@
 #include <kanker/KankerFont.h>
 #include <iterator>
 #include <algorithm>
+#include <climits>
+#include <string.h>
 #include <rapidxml.hpp>
 
 using namespace rapidxml;
 
 /* --------------------------------------------------------------------------------- */
 
-template<class T> T read_attribute(xml_node<>* node, std::string name, T def) {
+static uint32_t font_revision = 0;
+
+/* --------------------------------------------------------------------------------- */
+
+static const char* parse_number(const char* p, const char* end, float& result);
+static const char* parse_number(const char* p, const char* end, int& result);
+static const char* find_tag(const char* p, const char* end, const char* name);
+static const char* find_attribute(const char* tag, const char* tagEnd, const char* name);
+template<class T> T read_attribute(const char* tag, const char* tagEnd, const char* name, T def);
+
+/* --------------------------------------------------------------------------------- */
+
+template<class T> T read_attribute(xml_node<>* node, const char* name, T def) {
 
   if (NULL == node) {
     RX_ERROR("error: failed to read attribute, given node is NULL.");
     return def;
   }
-  if (0 == name.size()) {
+  if (NULL == name || 0 == name[0]) {
     RX_ERROR("error: failed to read attribute, because attribute name is invalid.");
     return def;
   }
 
-  xml_attribute<>* attr = node->first_attribute(name.c_str());
+  xml_attribute<>* attr = node->first_attribute(name);
   if (NULL == attr) {
-    RX_ERROR("error: failed to find attribute: %s", name.c_str());
+    RX_ERROR("error: failed to find attribute: %s", name);
     return def;
   }
 
-  T result;
-  std::stringstream ss;
-  ss << attr->value();
-  ss >> result;
+  T result = def;
+  if (NULL == parse_number(attr->value(), attr->value() + attr->value_size(), result)) {
+    RX_ERROR("error: attribute %s is not a number.", name);
+    return def;
+  }
 
   return result;
 }
 
 /* --------------------------------------------------------------------------------- */
 
+KankerGlyphTable::KankerGlyphTable() {
+  clear();
+}
+
+void KankerGlyphTable::clear() {
+
+  /* Page 0 is the shared "empty" page. */
+  directory.assign(KANKER_NUM_PAGES, 0);
+  pages.assign(KANKER_PAGE_SIZE, -1);
+}
+
+int KankerGlyphTable::insert(int charcode, int dx) {
+
+  if (charcode < 0 || charcode > KANKER_MAX_CODEPOINT) {
+    RX_ERROR("error: cannot insert glyph, charcode %d is not a valid code point.", charcode);
+    return -1;
+  }
+
+  uint16_t& page = directory[charcode >> KANKER_PAGE_BITS];
+  if (0 == page) {
+    page = (uint16_t)(pages.size() >> KANKER_PAGE_BITS);
+    pages.resize(pages.size() + KANKER_PAGE_SIZE, -1);
+  }
+
+  pages[(page << KANKER_PAGE_BITS) | (charcode & (KANKER_PAGE_SIZE - 1))] = dx;
+
+  return 0;
+}
+
+/* --------------------------------------------------------------------------------- */
+
 KankerFont::KankerFont() 
   :origin_x(-1.0f)
   ,origin_y(-1.0f)
+  ,revision(0)
+  ,font_file_revision(0)
 {
+  markChanged();
 }
 
 KankerFont::~KankerFont() {
@@ -46,40 +95,148 @@ KankerFont::~KankerFont() {
 
 
 void KankerFont::clear() {
-
-  for (size_t i = 0; i < glyphs.size(); ++i) {
-    delete glyphs[i];
-  }
   glyphs.clear();
+  glyph_table.clear();
+  glyph_state.clear();
+  glyph_sources.clear();
+  xml_source.clear();
+  font_file.close();
+  markChanged();
+}
+
+void KankerFont::markChanged() {
+  revision = ++font_revision;
 }
 
 KankerGlyph* KankerFont::getGlyphByCharCode(int charcode) {
-  
-  for (size_t i = 0; i < glyphs.size(); ++i) {
-    if (glyphs[i]->charcode == charcode) {
-      return glyphs[i];
+
+  /* The caller may change the glyph. */
+  markChanged();
+
+  int dx = glyph_table.find(charcode);
+  if (-1 != dx) {
+    if (KANKER_GLYPH_LOADED != glyph_state[dx]) {
+      loadGlyph(dx);
     }
+    return &glyphs[dx];
   }
 
-  KankerGlyph* new_glyph = new KankerGlyph(charcode);
-  if (NULL == new_glyph) {
-    RX_ERROR("error: cannot allocate glyph.");
+  if (0 != glyph_table.insert(charcode, (int)glyphs.size())) {
+    RX_ERROR("error: cannot create a glyph for charcode: %d", charcode);
     return NULL;
   }
 
-  glyphs.push_back(new_glyph);
-  return new_glyph;
+  glyphs.push_back(KankerGlyph(charcode));
+  glyph_state.push_back(KANKER_GLYPH_LOADED);
+
+  return &glyphs.back();
 }
 
-int KankerFont::save(std::string filepath) {
+int KankerFont::loadGlyph(size_t dx) {
 
-  RX_ERROR("We need to store the origin_x and origin_y");
+  if (dx >= glyphs.size()) {
+    RX_ERROR("Trying to load a glyph outside the range of the available glyphs: %lu", dx);
+    return -1;
+  }
+
+  if (KANKER_GLYPH_IN_FONT_FILE == glyph_state[dx]) {
+
+    /* The glyphs are stored in the same order as the glyph index of the file. */
+    KankerFontFileGlyph* info = font_file.getGlyphByIndex(dx);
+    if (NULL == info) {
+      RX_ERROR("Cannot find glyph %lu in the font file, not supposed to happen.", dx);
+      return -2;
+    }
+
+    KankerGlyph& glyph = glyphs[dx];
+
+    /* The points of a glyph are stored contiguously; we don't use addPoint() because the metrics are precomputed.
+       We copy them once because the glyph is mutable, see KankerFontFile.h. */
+    size_t first_point = font_file.segments[info->first_segment];
+    size_t num_points = font_file.segments[info->first_segment + info->num_segments] - first_point;
+    const float* p = font_file.points + first_point * 3;
+
+    glyph.segment_offsets.resize(info->num_segments);
+    glyph.points.resize(num_points);
+
+    for (size_t i = 0; i < info->num_segments; ++i) {
+      glyph.segment_offsets[i] = font_file.segments[info->first_segment + i] - first_point;
+    }
+
+    for (size_t k = 0; k < num_points; ++k, p += 3) {
+      glyph.points[k].set(p[0], p[1], p[2]);
+    }
+  }
+
+  else if (KANKER_GLYPH_IN_XML == glyph_state[dx]) {
+
+    /* Parse the <line> and <p> elements of the glyph from the range we found while indexing. */
+    KankerGlyph& glyph = glyphs[dx];
+    const char* p = xml_source.data() + glyph_sources[dx].begin;
+    const char* end = xml_source.data() + glyph_sources[dx].end;
+    const char* line = find_tag(p, end, "line");
+    std::vector<vec3> line_points;
+
+    if (NULL == line) {
+      RX_ERROR("error: the glyph %d does not hold any line segments.", glyph.charcode);
+    }
+
+    while (NULL != line) {
+
+      const char* line_end = find_tag(line + 1, end, "/line");
+      if (NULL == line_end) {
+        line_end = end;
+      }
+
+      glyph.onStartLine();
+      {
+        const char* point = find_tag(line, line_end, "p");
+
+        line_points.clear();
+
+        while (NULL != point) {
+
+          const char* point_end = (const char*)memchr(point, '>', line_end - point);
+          if (NULL == point_end) {
+            break;
+          }
+
+          line_points.push_back(vec3(read_attribute<float>(point, point_end, "x", 0.0f),
+                                     read_attribute<float>(point, point_end, "y", 0.0f),
+                                     read_attribute<float>(point, point_end, "z", 0.0f)));
+
+          point = find_tag(point_end, line_end, "p");
+        }
+
+        if (0 != line_points.size()) {
+          glyph.addPoints(&line_points[0], line_points.size());
+        }
+      }
+      glyph.onEndLine();
+
+      line = find_tag(line_end, end, "line");
+    }
+  }
+
+  glyph_state[dx] = KANKER_GLYPH_LOADED;
+
+  return 0;
+}
+
+int KankerFont::save(std::string filepath, int format) {
 
   if (0 == filepath.size()) {
     RX_ERROR("error: invalid filepath, is empty.");
     return -1;
   }
 
+  if (KANKER_FONT_FORMAT_BINARY == format) {
+    KankerFontFile compiled;
+    return compiled.save(filepath, *this);
+  }
+
+  RX_ERROR("We need to store the origin_x and origin_y");
+
   std::ofstream ofs(filepath.c_str(), std::ios::out);
   if (!ofs.is_open()) {
     RX_ERROR("error: failed to open %s, no permission maybe?", filepath.c_str());
@@ -92,13 +249,13 @@ int KankerFont::save(std::string filepath) {
 
   ss << "<font origin_x=\"" << origin_x << "\">\n";
   
-   std::vector<KankerGlyph*>::iterator it = glyphs.begin();
+  std::vector<KankerGlyph>::iterator it = glyphs.begin();
 
   while (it != glyphs.end()) {
  
-    KankerGlyph* glyph = *it;
+    KankerGlyph* glyph = getGlyphByIndex(it - glyphs.begin());
 
-    if (0 == glyph->segments.size()) {
+    if (0 == glyph->getNumSegments()) {
       ++it;
       continue;
     }
@@ -113,14 +270,14 @@ int KankerFont::save(std::string filepath) {
        << " advancex=\"" << glyph->advance_x  << "\""
        << ">\n";
 
-    RX_VERBOSE("writing: %c, %lu segments", (char)glyph->charcode, glyph->segments.size());
+    RX_VERBOSE("writing: %c, %lu segments", (char)glyph->charcode, glyph->getNumSegments());
 
-    for (size_t i = 0; i < glyph->segments.size(); ++i) {
+    for (size_t i = 0; i < glyph->getNumSegments(); ++i) {
 
       ss << "    <line>\n";
       
-      std::vector<vec3>& points = glyph->segments[i];
-      for (size_t k = 0; k < points.size(); ++k) {
+      vec3* points = glyph->getSegmentPoints(i);
+      for (size_t k = 0; k < glyph->getSegmentSize(i); ++k) {
         vec3& v = points[k];
         ss << "      <p x=\"" << v.x << "\" y=\"" << v.y << "\" z=\"" << v.z << "\" />\n";
       }
@@ -150,26 +307,26 @@ void KankerFont::write(std::string str, std::vector<std::vector<vec3> >& lines)
 
   for (size_t i = 0; i < str.size(); ++i) {
 
-    if (!hasGlyph(str[i])) {
-      RX_VERBOSE("The font can't create a valid string because the character '%c' is not found.", (char)str[i]);
-      continue;
-    }
-
-    KankerGlyph* g = getGlyphByCharCode(str[i]);
+    KankerGlyph* g = findGlyph(str[i]);
     if (NULL == g) {
-      RX_ERROR("Cannot get glyph by char code... not supposed to happen.");
+      RX_VERBOSE("The font can't create a valid string because the character '%c' is not found.", (char)str[i]);
       continue;
     }
 
     KankerGlyph glyph = *g;
     glyph.translate(pen_x, 0);
-    std::copy(glyph.segments.begin(), glyph.segments.end(), std::back_inserter(lines));
+
+    for (size_t j = 0; j < glyph.getNumSegments(); ++j) {
+      lines.push_back(std::vector<vec3>());
+      glyph.getSegment(j, lines.back());
+    }
+
     pen_x += glyph.advance_x;
   }
 }
 
 
-int KankerFont::load(std::string filepath) {
+int KankerFont::load(std::string filepath, int mode) {
 
   clear();
 
@@ -178,16 +335,33 @@ int KankerFont::load(std::string filepath) {
     return -1;
   }
 
-  std::ifstream ifs(filepath.c_str(),  std::ios::in);
+  if (0 == kanker_font_file_is_compiled(filepath)) {
+    return loadCompiled(filepath);
+  }
+
+  std::ifstream ifs(filepath.c_str(),  std::ios::in | std::ios::binary);
   if(!ifs.is_open()) {
     RX_ERROR("error: failed to load file: %s, wrong path?", filepath.c_str());
     return false;
   }
- 
+
+  /* Read the file in one go. */
   std::string xml_str;
-  xml_str.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+  ifs.seekg(0, std::ios::end);
+  xml_str.resize((size_t)ifs.tellg());
+  ifs.seekg(0, std::ios::beg);
+
+  if (0 != xml_str.size()) {
+    ifs.read(&xml_str[0], xml_str.size());
+  }
+
+  if (KANKER_FONT_LOAD_LAZY == mode) {
+    xml_source.swap(xml_str);
+    return loadIndex();
+  }
 
   xml_document<> doc;
+  std::vector<vec3> line_points;
 
   try {
 
@@ -248,6 +422,8 @@ int KankerFont::load(std::string filepath) {
         {
           xml_node<>* point = line->first_node("p");
 
+          line_points.clear();
+
           while (point) {
 
             vec3 v;
@@ -255,10 +431,15 @@ int KankerFont::load(std::string filepath) {
             v.y = read_attribute<float>(point, "y", 0.0f);
             v.z = read_attribute<float>(point, "z", 0.0f);
 
-            glyph->addPoint(v);
+            line_points.push_back(v);
 
             point = point->next_sibling();
           }
+
+          /* Updates the metrics once per line instead of once per point. */
+          if (0 != line_points.size()) {
+            glyph->addPoints(&line_points[0], line_points.size());
+          }
         }
         glyph->onEndLine();
         line = line->next_sibling();
@@ -274,11 +455,143 @@ int KankerFont::load(std::string filepath) {
   return 0;
 }
 
+int KankerFont::loadIndex() {
+
+  const char* start = xml_source.data();
+  const char* end = start + xml_source.size();
+  const char* font = find_tag(start, end, "font");
+  const char* tag_end = NULL;
+
+  if (NULL == font) {
+    RX_ERROR("error: cannot find main <font> element.");
+    clear();
+    return -2;
+  }
+
+  tag_end = (const char*)memchr(font, '>', end - font);
+  if (NULL == tag_end) {
+    RX_ERROR("error: the <font> element is not closed.");
+    clear();
+    return -2;
+  }
+
+  /* Get the origin x that is used to position glyphs or use the one which is currently set. */
+  origin_x = read_attribute<float>(font, tag_end, "origin_x", origin_x);
+
+  const char* glyph_el = find_tag(tag_end, end, "glyph");
+  if (NULL == glyph_el) {
+    RX_ERROR("error: the font xml is invald, not <glyph> element found.");
+    clear();
+    return -2;
+  }
+
+  /* Scan the file once and only store where the contents of each glyph element start and end. */
+  while (NULL != glyph_el) {
+
+    tag_end = (const char*)memchr(glyph_el, '>', end - glyph_el);
+    if (NULL == tag_end) {
+      RX_ERROR("error: the <glyph> element is not closed.");
+      break;
+    }
+
+    const char* glyph_end = find_tag(tag_end, end, "/glyph");
+    if (NULL == glyph_end) {
+      glyph_end = end;
+    }
+
+    int charcode = read_attribute<int>(glyph_el, tag_end, "charcode", -1);
+    if (-1 == charcode) {
+      RX_ERROR("error: invalid charcode, or glyph xml doesn't have a charcode (?).");
+      glyph_el = find_tag(glyph_end, end, "glyph");
+      continue;
+    }
+
+    KankerGlyph* glyph = getGlyphByCharCode(charcode);
+    if (NULL == glyph) {
+      RX_ERROR("error: cannot find or create the glyph for the given charcode: %d", charcode);
+      glyph_el = find_tag(glyph_end, end, "glyph");
+      continue;
+    }
+
+    glyph->advance_x = read_attribute<int>(glyph_el, tag_end, "advancex", -1);
+    if (-1 == glyph->advance_x) {
+      RX_VERBOSE("No advance_x found in glyph, not set yet? Char: %c", (char)glyph->charcode);
+    }
+
+    glyph->clear();
+    glyph->origin_x = origin_x;
+    glyph->origin_y = origin_y;
+
+    size_t dx = glyph - &glyphs[0];
+    if (glyph_sources.size() < glyphs.size()) {
+      glyph_sources.resize(glyphs.size());
+    }
+
+    glyph_sources[dx].begin = tag_end - start;
+    glyph_sources[dx].end = glyph_end - start;
+    glyph_state[dx] = KANKER_GLYPH_IN_XML;
+
+    glyph_el = find_tag(glyph_end, end, "glyph");
+  }
+
+  return 0;
+}
+
+int KankerFont::loadCompiled(std::string filepath) {
+
+  if (0 != font_file.open(filepath)) {
+    RX_ERROR("error: failed to open the compiled font: %s", filepath.c_str());
+    return -3;
+  }
+
+  origin_x = font_file.header->origin_x;
+  origin_y = font_file.header->origin_y;
+
+  glyphs.reserve(font_file.header->num_glyphs);
+  glyph_state.reserve(font_file.header->num_glyphs);
+
+  /* We only read the glyph index; the points are read in place when a glyph is used. */
+  for (uint32_t i = 0; i < font_file.header->num_glyphs; ++i) {
+
+    KankerFontFileGlyph* info = font_file.getGlyphByIndex(i);
+
+    if (0 != glyph_table.insert(info->charcode, (int)glyphs.size())) {
+      RX_ERROR("error: invalid charcode in the compiled font: %d", info->charcode);
+      clear();
+      return -4;
+    }
+
+    KankerGlyph glyph(info->charcode);
+    glyph.advance_x = info->advance_x;
+    glyph.min_x = info->min_x;
+    glyph.min_y = info->min_y;
+    glyph.max_x = info->max_x;
+    glyph.max_y = info->max_y;
+    glyph.width = info->width;
+    glyph.height = info->height;
+    glyph.origin_x = origin_x;
+    glyph.origin_y = origin_y;
+
+    glyphs.push_back(glyph);
+    glyph_state.push_back(KANKER_GLYPH_IN_FONT_FILE);
+  }
+
+  font_file_revision = revision;
+
+  return 0;
+}
+
 int KankerFont::getBaseHeight(float& height) {
 
+  /* The compiler stored the x-height; we don't have to load a glyph for it as long as nothing was changed. */
+  if (font_file.isOpen() && revision == font_file_revision && 0.0f <= font_file.header->x_height) {
+    height = font_file.header->x_height;
+    return 0;
+  }
+
   std::string chars = "xuvwz";
   for (size_t i = 0; i < chars.size(); ++i) {
-    KankerGlyph* g = getGlyphByCharCode(chars[i]);
+    KankerGlyph* g = findGlyph(chars[i]);
     if (NULL == g) {
       continue;
     }
@@ -289,3 +602,205 @@ int KankerFont::getBaseHeight(float& height) {
   return -1;
 }
 
+
+/* --------------------------------------------------------------------------------- */
+
+/* 
+   Parses a decimal number like "-311.957" or "1.5e-3" without 
+   allocating. Returns a pointer to the first character after the 
+   number or NULL when there is no number at `p`.
+*/
+static const char* parse_number(const char* p, const char* end, float& result) {
+
+  static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+  uint64_t mantissa = 0;
+  int exponent = 0;
+  int num_digits = 0;
+  bool negative = false;
+
+  while (p < end && (' ' == *p || '\t' == *p)) {
+    ++p;
+  }
+
+  if (p < end && ('-' == *p || '+' == *p)) {
+    negative = ('-' == *p);
+    ++p;
+  }
+
+  for (; p < end && *p >= '0' && *p <= '9'; ++p, ++num_digits) {
+    if (mantissa < 1000000000000000000ULL) {
+      mantissa = mantissa * 10 + (*p - '0');
+    }
+    else {
+      exponent++;
+    }
+  }
+
+  if (p < end && '.' == *p) {
+    for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++num_digits) {
+      if (mantissa < 1000000000000000000ULL) {
+        mantissa = mantissa * 10 + (*p - '0');
+        exponent--;
+      }
+    }
+  }
+
+  if (0 == num_digits) {
+    return NULL;
+  }
+
+  if (p < end && ('e' == *p || 'E' == *p)) {
+
+    const char* q = p + 1;
+    bool negative_exp = false;
+    int e = 0;
+
+    if (q < end && ('-' == *q || '+' == *q)) {
+      negative_exp = ('-' == *q);
+      ++q;
+    }
+
+    if (q < end && *q >= '0' && *q <= '9') {
+      for (; q < end && *q >= '0' && *q <= '9'; ++q) {
+        if (e < 1000) {
+          e = e * 10 + (*q - '0');
+        }
+      }
+      exponent += (negative_exp) ? -e : e;
+      p = q;
+    }
+  }
+
+  double value = (double)mantissa;
+
+  while (exponent < -22) {
+    value /= powers[22];
+    exponent += 22;
+  }
+
+  while (exponent > 22) {
+    value *= powers[22];
+    exponent -= 22;
+  }
+
+  value = (exponent < 0) ? value / powers[-exponent] : value * powers[exponent];
+  result = (float)((negative) ? -value : value);
+
+  return p;
+}
+
+/* Parses an integer; like std::stringstream we stop at the first character that isn't part of the integer, e.g. "89.5" gives 89. */
+static const char* parse_number(const char* p, const char* end, int& result) {
+
+  int64_t value = 0;
+  int num_digits = 0;
+  bool negative = false;
+
+  while (p < end && (' ' == *p || '\t' == *p)) {
+    ++p;
+  }
+
+  if (p < end && ('-' == *p || '+' == *p)) {
+    negative = ('-' == *p);
+    ++p;
+  }
+
+  for (; p < end && *p >= '0' && *p <= '9'; ++p, ++num_digits) {
+    if (value < INT_MAX) {
+      value = value * 10 + (*p - '0');
+    }
+  }
+
+  if (0 == num_digits) {
+    return NULL;
+  }
+
+  if (value > INT_MAX) {
+    value = INT_MAX;
+  }
+
+  result = (int)((negative) ? -value : value);
+
+  return p;
+}
+
+/* Returns a pointer to the `<` of the first `<name` tag in [p, end) or NULL when not found. */
+static const char* find_tag(const char* p, const char* end, const char* name) {
+
+  size_t len = strlen(name);
+
+  while (p < end) {
+
+    p = (const char*)memchr(p, '<', end - p);
+    if (NULL == p) {
+      return NULL;
+    }
+
+    if ((size_t)(end - p) > len + 1 && 0 == memcmp(p + 1, name, len)) {
+      char c = p[len + 1];
+      if (' ' == c || '\t' == c || '\n' == c || '\r' == c || '>' == c || '/' == c) {
+        return p;
+      }
+    }
+
+    ++p;
+  }
+
+  return NULL;
+}
+
+/* Returns a pointer to the first character of the (quoted) value of the attribute or NULL when not found. */
+static const char* find_attribute(const char* tag, const char* tagEnd, const char* name) {
+
+  size_t len = strlen(name);
+  const char* p = tag;
+
+  while (p + len < tagEnd) {
+
+    if (0 == memcmp(p, name, len)
+        && (' ' == p[-1] || '\t' == p[-1] || '\n' == p[-1] || '\r' == p[-1]))
+      {
+        const char* q = p + len;
+
+        while (q < tagEnd && (' ' == *q || '\t' == *q)) {
+          ++q;
+        }
+
+        if (q < tagEnd && '=' == *q) {
+
+          ++q;
+
+          while (q < tagEnd && (' ' == *q || '\t' == *q)) {
+            ++q;
+          }
+
+          if (q < tagEnd && ('"' == *q || '\'' == *q)) {
+            return q + 1;
+          }
+        }
+      }
+
+    ++p;
+  }
+
+  return NULL;
+}
+
+template<class T> T read_attribute(const char* tag, const char* tagEnd, const char* name, T def) {
+
+  T result = def;
+  const char* value = find_attribute(tag, tagEnd, name);
+
+  if (NULL == value) {
+    RX_ERROR("error: failed to find attribute: %s", name);
+    return def;
+  }
+
+  if (NULL == parse_number(value, tagEnd, result)) {
+    RX_ERROR("error: attribute %s is not a number.", name);
+    return def;
+  }
+
+  return result;
+}
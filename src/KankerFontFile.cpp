@@ -0,0 +1,391 @@
+#include <kanker/KankerFontFile.h>
+#include <kanker/KankerFont.h>
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+#if !defined(_WIN32)
+#  include <sys/types.h>
+#  include <sys/stat.h>
+#  include <sys/mman.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+/* ---------------------------------------------------------------------- */
+
+static bool glyph_sort_on_charcode(const KankerGlyph* a, const KankerGlyph* b);
+
+/* ---------------------------------------------------------------------- */
+
+int kanker_font_file_is_compiled(std::string filepath) {
+
+  char magic[4] = { 0 };
+
+  std::ifstream ifs(filepath.c_str(), std::ios::in | std::ios::binary);
+  if (!ifs.is_open()) {
+    return -1;
+  }
+
+  ifs.read(magic, sizeof(magic));
+  if (ifs.gcount() != sizeof(magic)) {
+    return -2;
+  }
+
+  if (magic[0] != 'K' || magic[1] != 'F' || magic[2] != 'N' || magic[3] != 'T') {
+    return -3;
+  }
+
+  return 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+KankerFontFile::KankerFontFile()
+  :header(NULL)
+  ,glyphs(NULL)
+  ,segments(NULL)
+  ,points(NULL)
+  ,data(NULL)
+  ,nbytes(0)
+#if defined(_WIN32)
+  ,file_handle(INVALID_HANDLE_VALUE)
+  ,map_handle(NULL)
+#endif
+{
+}
+
+KankerFontFile::~KankerFontFile() {
+  close();
+}
+
+int KankerFontFile::open(std::string filepath) {
+
+  if (NULL != data) {
+    RX_ERROR("Already opened a font file, call close() first.");
+    return -1;
+  }
+
+  if (0 == filepath.size()) {
+    RX_ERROR("Invalid filepath, is empty.");
+    return -2;
+  }
+
+#if defined(_WIN32)
+
+  file_handle = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (INVALID_HANDLE_VALUE == file_handle) {
+    RX_ERROR("Failed to open %s", filepath.c_str());
+    return -3;
+  }
+
+  nbytes = (size_t)GetFileSize(file_handle, NULL);
+  if (INVALID_FILE_SIZE == nbytes || nbytes < sizeof(KankerFontFileHeader)) {
+    RX_ERROR("The font file is too small: %s", filepath.c_str());
+    close();
+    return -4;
+  }
+
+  map_handle = CreateFileMapping(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (NULL == map_handle) {
+    RX_ERROR("Failed to create a file mapping for %s", filepath.c_str());
+    close();
+    return -5;
+  }
+
+  data = (uint8_t*)MapViewOfFile(map_handle, FILE_MAP_READ, 0, 0, 0);
+  if (NULL == data) {
+    RX_ERROR("Failed to map %s", filepath.c_str());
+    close();
+    return -5;
+  }
+
+#else
+
+  struct stat st;
+  int fd = ::open(filepath.c_str(), O_RDONLY);
+  if (-1 == fd) {
+    RX_ERROR("Failed to open %s", filepath.c_str());
+    return -3;
+  }
+
+  if (0 != fstat(fd, &st) || (size_t)st.st_size < sizeof(KankerFontFileHeader)) {
+    RX_ERROR("The font file is too small: %s", filepath.c_str());
+    ::close(fd);
+    return -4;
+  }
+
+  nbytes = (size_t)st.st_size;
+
+  void* ptr = mmap(NULL, nbytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+
+  if (MAP_FAILED == ptr) {
+    RX_ERROR("Failed to map %s", filepath.c_str());
+    nbytes = 0;
+    return -5;
+  }
+
+  data = (uint8_t*)ptr;
+
+#endif
+
+  /* Validate the header. */
+  header = (KankerFontFileHeader*)data;
+
+  if (header->magic[0] != 'K' || header->magic[1] != 'F' || header->magic[2] != 'N' || header->magic[3] != 'T') {
+    RX_ERROR("%s is not a compiled font file.", filepath.c_str());
+    close();
+    return -6;
+  }
+
+  if (KANKER_FONT_FILE_VERSION != header->version) {
+    RX_ERROR("Unsupported font file version %u, we support version %u. Recompile the font.", header->version, KANKER_FONT_FILE_VERSION);
+    close();
+    return -7;
+  }
+
+  if (KANKER_FONT_FILE_ENDIAN != header->endian) {
+    RX_ERROR("The font file was compiled on a machine with a different byte order. Recompile the font.");
+    close();
+    return -8;
+  }
+
+  if (header->file_size != nbytes
+      || header->glyphs_offset < sizeof(KankerFontFileHeader)
+      || header->glyphs_offset + (uint64_t)header->num_glyphs * sizeof(KankerFontFileGlyph) > header->segments_offset
+      || header->segments_offset + ((uint64_t)header->num_segments + 1) * sizeof(uint32_t) > header->points_offset
+      || header->points_offset + (uint64_t)header->num_points * sizeof(float) * 3 > nbytes
+      || 0 != (header->glyphs_offset % 4)
+      || 0 != (header->segments_offset % 4)
+      || 0 != (header->points_offset % 4))
+    {
+      RX_ERROR("The font file is corrupt, the offsets and sizes in the header are invalid.");
+      close();
+      return -9;
+    }
+
+  glyphs = (KankerFontFileGlyph*)(data + header->glyphs_offset);
+  segments = (uint32_t*)(data + header->segments_offset);
+  points = (float*)(data + header->points_offset);
+
+  /* Validate the segment offsets and glyph index once, so we can read them without checks later. */
+  if (0 != segments[0] || header->num_points != segments[header->num_segments]) {
+    RX_ERROR("The font file is corrupt, invalid segment offsets.");
+    close();
+    return -10;
+  }
+
+  for (uint32_t i = 0; i < header->num_segments; ++i) {
+    if (segments[i] > segments[i + 1]) {
+      RX_ERROR("The font file is corrupt, segment offsets are not increasing.");
+      close();
+      return -10;
+    }
+  }
+
+  for (uint32_t i = 0; i < header->num_glyphs; ++i) {
+
+    KankerFontFileGlyph& g = glyphs[i];
+
+    if ((uint64_t)g.first_segment + g.num_segments > header->num_segments) {
+      RX_ERROR("The font file is corrupt, glyph %d references invalid segments.", g.charcode);
+      close();
+      return -11;
+    }
+
+    if (i > 0 && glyphs[i - 1].charcode >= g.charcode) {
+      RX_ERROR("The font file is corrupt, the glyph index is not sorted.");
+      close();
+      return -12;
+    }
+  }
+
+  return 0;
+}
+
+int KankerFontFile::close() {
+
+#if defined(_WIN32)
+
+  if (NULL != data) {
+    UnmapViewOfFile(data);
+  }
+
+  if (NULL != map_handle) {
+    CloseHandle(map_handle);
+    map_handle = NULL;
+  }
+
+  if (INVALID_HANDLE_VALUE != file_handle) {
+    CloseHandle(file_handle);
+    file_handle = INVALID_HANDLE_VALUE;
+  }
+
+#else
+
+  if (NULL != data) {
+    munmap(data, nbytes);
+  }
+
+#endif
+
+  data = NULL;
+  nbytes = 0;
+  header = NULL;
+  glyphs = NULL;
+  segments = NULL;
+  points = NULL;
+
+  return 0;
+}
+
+KankerFontFileGlyph* KankerFontFile::findGlyph(int charcode) {
+
+  if (NULL == header) {
+    return NULL;
+  }
+
+  size_t lo = 0;
+  size_t hi = header->num_glyphs;
+
+  while (lo < hi) {
+
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (glyphs[mid].charcode < charcode) {
+      lo = mid + 1;
+    }
+    else {
+      hi = mid;
+    }
+  }
+
+  if (lo < header->num_glyphs && glyphs[lo].charcode == charcode) {
+    return &glyphs[lo];
+  }
+
+  return NULL;
+}
+
+int KankerFontFile::save(std::string filepath, KankerFont& font) {
+
+  KankerFontFileHeader hdr;
+  std::vector<KankerGlyph*> sorted;
+  std::vector<KankerFontFileGlyph> index;
+  std::vector<uint32_t> offsets;
+  std::vector<float> coords;
+
+  if (0 == filepath.size()) {
+    RX_ERROR("Invalid filepath, is empty.");
+    return -1;
+  }
+
+  /* The glyph index is sorted on charcode so we can use a binary search. */
+  for (size_t i = 0; i < font.size(); ++i) {
+
+    KankerGlyph* glyph = font.getGlyphByIndex(i);
+    if (NULL == glyph) {
+      RX_ERROR("Failed to get glyph %lu, not supposed to happen.", i);
+      return -2;
+    }
+
+    if (0 == glyph->getNumSegments()) {
+      continue;
+    }
+
+    sorted.push_back(glyph);
+  }
+
+  std::sort(sorted.begin(), sorted.end(), glyph_sort_on_charcode);
+
+  offsets.push_back(0);
+
+  for (size_t i = 0; i < sorted.size(); ++i) {
+
+    KankerGlyph* glyph = sorted[i];
+    KankerFontFileGlyph info;
+
+    info.charcode = glyph->charcode;
+    info.first_segment = offsets.size() - 1;
+    info.num_segments = glyph->getNumSegments();
+    info.advance_x = glyph->advance_x;
+    info.min_x = glyph->min_x;
+    info.min_y = glyph->min_y;
+    info.max_x = glyph->max_x;
+    info.max_y = glyph->max_y;
+    info.width = glyph->width;
+    info.height = glyph->height;
+    index.push_back(info);
+
+    for (size_t j = 0; j < glyph->getNumSegments(); ++j) {
+
+      vec3* seg = glyph->getSegmentPoints(j);
+
+      for (size_t k = 0; k < glyph->getSegmentSize(j); ++k) {
+        coords.push_back(seg[k].x);
+        coords.push_back(seg[k].y);
+        coords.push_back(seg[k].z);
+      }
+
+      offsets.push_back(coords.size() / 3);
+    }
+  }
+
+  memset(&hdr, 0x00, sizeof(hdr));
+  hdr.magic[0] = 'K';
+  hdr.magic[1] = 'F';
+  hdr.magic[2] = 'N';
+  hdr.magic[3] = 'T';
+  hdr.version = KANKER_FONT_FILE_VERSION;
+  hdr.endian = KANKER_FONT_FILE_ENDIAN;
+  hdr.num_glyphs = index.size();
+  hdr.num_segments = offsets.size() - 1;
+  hdr.num_points = coords.size() / 3;
+  hdr.glyphs_offset = sizeof(KankerFontFileHeader);
+  hdr.segments_offset = hdr.glyphs_offset + index.size() * sizeof(KankerFontFileGlyph);
+  hdr.points_offset = hdr.segments_offset + offsets.size() * sizeof(uint32_t);
+  hdr.file_size = hdr.points_offset + coords.size() * sizeof(float);
+  hdr.origin_x = font.origin_x;
+  hdr.origin_y = font.origin_y;
+
+  if (0 != font.getBaseHeight(hdr.x_height)) {
+    hdr.x_height = -1.0f;
+  }
+
+  std::ofstream ofs(filepath.c_str(), std::ios::out | std::ios::binary);
+  if (!ofs.is_open()) {
+    RX_ERROR("Failed to open %s, no permission maybe?", filepath.c_str());
+    return -3;
+  }
+
+  ofs.write((const char*)&hdr, sizeof(hdr));
+
+  if (0 != index.size()) {
+    ofs.write((const char*)&index[0], index.size() * sizeof(KankerFontFileGlyph));
+  }
+
+  ofs.write((const char*)&offsets[0], offsets.size() * sizeof(uint32_t));
+
+  if (0 != coords.size()) {
+    ofs.write((const char*)&coords[0], coords.size() * sizeof(float));
+  }
+
+  if (!ofs.good()) {
+    RX_ERROR("Failed to write the compiled font to %s", filepath.c_str());
+    return -4;
+  }
+
+  ofs.close();
+
+  RX_VERBOSE("Compiled %u glyphs, %u segments, %u points into %s (%u bytes).",
+             hdr.num_glyphs, hdr.num_segments, hdr.num_points, filepath.c_str(), hdr.file_size);
+
+  return 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static bool glyph_sort_on_charcode(const KankerGlyph* a, const KankerGlyph* b) {
+  return a->charcode < b->charcode;
+}
@@ -1,7 +1,19 @@
 #include <float.h>
+#include <string.h>
 #include <algorithm>
 #include <kanker/KankerGlyph.h>
 
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#  include <xmmintrin.h>
+#  define KANKER_GLYPH_USE_SSE
+#endif
+
+/* ---------------------------------------------------------------------- */
+
+static void kanker_glyph_get_bounds(const vec3* p, size_t num, float& minX, float& minY, float& maxX, float& maxY);
+
+/* ---------------------------------------------------------------------- */
+
 KankerGlyph::KankerGlyph(int charcode) 
   :charcode(charcode)
   ,min_x(FLT_MAX)
@@ -13,7 +25,10 @@ KankerGlyph::KankerGlyph(int charcode)
   ,advance_x(0)
   ,origin_x(0)
   ,origin_y(0)
+  ,has_transform(false)
 {
+  transform[0] = 1.0f;  transform[2] = 0.0f;  transform[4] = 0.0f;
+  transform[1] = 0.0f;  transform[3] = 1.0f;  transform[5] = 0.0f;
 }
 
 KankerGlyph::KankerGlyph(const KankerGlyph& other) {
@@ -25,7 +40,8 @@ KankerGlyph::KankerGlyph(const KankerGlyph& other) {
 
 KankerGlyph& KankerGlyph::operator=(const KankerGlyph& other) {
 
-  segments = other.segments;
+  points = other.points;
+  segment_offsets = other.segment_offsets;
   charcode = other.charcode;
   min_x = other.min_x;
   min_y = other.min_y;
@@ -36,6 +52,8 @@ KankerGlyph& KankerGlyph::operator=(const KankerGlyph& other) {
   advance_x = other.advance_x;
   origin_x = other.origin_x;
   origin_y = other.origin_y;
+  has_transform = other.has_transform;
+  memcpy(transform, other.transform, sizeof(transform));
 
   return *this;
 }
@@ -48,16 +66,151 @@ KankerGlyph::~KankerGlyph() {
 }
 
 void KankerGlyph::onStartLine() {
-
-  std::vector<vec3> seg;
-  segments.push_back(seg);
+  segment_offsets.push_back(points.size());
 }
 
 void KankerGlyph::onEndLine() {
 }
 
+void KankerGlyph::addSegment(const vec3* p, size_t num) {
+  onStartLine();
+  addPoints(p, num);
+  onEndLine();
+}
+
+void KankerGlyph::addPoints(const vec3* p, size_t num) {
+
+  float bmin_x, bmin_y, bmax_x, bmax_y;
+
+  if (0 == num) {
+    return;
+  }
+
+  if (has_transform) {
+    applyTransform();
+  }
+
+  if (0 == segment_offsets.size()) {
+    RX_VERBOSE("No segments found yet, not supposed to happen be we will create one.");
+    segment_offsets.push_back(points.size());
+  }
+
+  points.insert(points.end(), p, p + num);
+
+  kanker_glyph_get_bounds(p, num, bmin_x, bmin_y, bmax_x, bmax_y);
+
+  /* Same result as calling addPoint() for each point. */
+  if (bmax_x > max_x) { max_x = bmax_x; }
+  if (bmin_x < min_x) { min_x = bmin_x; }
+  if (bmax_y > max_y) { max_y = bmax_y; }
+  if (bmin_y < min_y) { min_y = bmin_y; }
+
+  width = max_x - min_x;
+  height = max_y - min_y;
+}
+
+void KankerGlyph::recomputeBounds() {
+
+  if (has_transform) {
+    applyTransform();
+  }
+
+  if (0 == points.size()) {
+    min_x = FLT_MAX;
+    min_y = FLT_MAX;
+    max_x = FLT_MIN;
+    max_y = FLT_MIN;
+    width = 0;
+    height = 0;
+    return;
+  }
+
+  kanker_glyph_get_bounds(&points[0], points.size(), min_x, min_y, max_x, max_y);
+
+  width = max_x - min_x;
+  height = max_y - min_y;
+}
+
+void KankerGlyph::addSegment(const std::vector<vec3>& p) {
+
+  if (0 == p.size()) {
+    onStartLine();
+    onEndLine();
+    return;
+  }
+
+  addSegment(&p[0], p.size());
+}
+
+void KankerGlyph::getSegment(size_t dx, std::vector<vec3>& result) {
+
+  vec3* p = getSegmentPoints(dx);
+  size_t num = getSegmentSize(dx);
+
+  if (0 == num) {
+    result.clear();
+    return;
+  }
+
+  result.assign(p, p + num);
+}
+
 void KankerGlyph::clear() {
-  segments.clear();
+
+  points.clear();
+  segment_offsets.clear();
+
+  has_transform = false;
+  transform[0] = 1.0f;  transform[2] = 0.0f;  transform[4] = 0.0f;
+  transform[1] = 0.0f;  transform[3] = 1.0f;  transform[5] = 0.0f;
+}
+
+void KankerGlyph::addTransform(float a, float b, float c, float d, float tx, float ty) {
+
+  float* t = transform;
+  float r[6];
+
+  /* new = given * current; the given transform is applied after the pending one. */
+  r[0] = a * t[0] + c * t[1];
+  r[1] = b * t[0] + d * t[1];
+  r[2] = a * t[2] + c * t[3];
+  r[3] = b * t[2] + d * t[3];
+  r[4] = a * t[4] + c * t[5] + tx;
+  r[5] = b * t[4] + d * t[5] + ty;
+
+  memcpy(transform, r, sizeof(transform));
+  has_transform = true;
+}
+
+void KankerGlyph::applyTransform() {
+
+  if (false == has_transform) {
+    return;
+  }
+
+  const float* t = transform;
+
+  if (0.0f == t[1] && 0.0f == t[2]) {
+    /* Only scale and translation, which is what all our transforms use. */
+    for (size_t i = 0; i < points.size(); ++i) {
+      vec3& point = points[i];
+      point.x = t[0] * point.x + t[4];
+      point.y = t[3] * point.y + t[5];
+    }
+  }
+  else {
+    for (size_t i = 0; i < points.size(); ++i) {
+      vec3& point = points[i];
+      float x = point.x;
+      float y = point.y;
+      point.x = t[0] * x + t[2] * y + t[4];
+      point.y = t[1] * x + t[3] * y + t[5];
+    }
+  }
+
+  has_transform = false;
+  transform[0] = 1.0f;  transform[2] = 0.0f;  transform[4] = 0.0f;
+  transform[1] = 0.0f;  transform[3] = 1.0f;  transform[5] = 0.0f;
 }
 
 void KankerGlyph::normalizeAndCentralize() {
@@ -90,13 +243,7 @@ void KankerGlyph::normalize() {
   float inv = 1.0f / height;
 #endif
 
-  for (size_t i = 0; i < segments.size(); ++i) {
-    std::vector<vec3>& points = segments[i];
-    for (size_t j = 0; j < points.size(); ++j) {
-      points[j].x *= inv;     
-      points[j].y *= -inv;  /* we need to flip ! */
-    }
-  }
+  addTransform(inv, 0.0f, 0.0f, -inv, 0.0f, 0.0f);  /* we need to flip ! */
 
   width *= inv;
   height *= inv;
@@ -118,13 +265,7 @@ void KankerGlyph::normalize(float xHeight) {
   
   float inv = 1.0f / xHeight;
 
-  for (size_t i = 0; i < segments.size(); ++i) {
-    std::vector<vec3>& points = segments[i];
-    for (size_t j = 0; j < points.size(); ++j) {
-      points[j].x *= inv;     
-      points[j].y *= -inv;  /* we need to flip ! */
-    }
-  }
+  addTransform(inv, 0.0f, 0.0f, -inv, 0.0f, 0.0f);  /* we need to flip ! */
 
   width *= inv;
   height *= inv;
@@ -142,13 +283,7 @@ void KankerGlyph::centralize() {
   float center_x = min_x + width * 0.5;
   float center_y = min_y + height * 0.5;
 
-  for (size_t i = 0; i < segments.size(); ++i) {
-    std::vector<vec3>& points = segments[i];
-    for (size_t j = 0; j < points.size(); ++j) {
-      points[j].x -= center_x;  
-      points[j].y -= center_y;  
-    }
-  }
+  addTransform(1.0f, 0.0f, 0.0f, 1.0f, -center_x, -center_y);
 
   min_x -= center_x;
   max_x -= center_x;
@@ -158,14 +293,7 @@ void KankerGlyph::centralize() {
 
 void KankerGlyph::translate(float x, float y) {
 
-  for (size_t i = 0; i < segments.size(); ++i) {
-    std::vector<vec3>& points = segments[i];
-    for (size_t j = 0; j < points.size(); ++j) {
-      vec3& point = points[j];
-      point.x += x;
-      point.y += y;
-    }
-  }
+  addTransform(1.0f, 0.0f, 0.0f, 1.0f, x, y);
 
   min_x += x;
   max_x += x;
@@ -195,14 +323,7 @@ void KankerGlyph::scale(float s) {
          (char)charcode, width,height,scale_x,scale_y);
   #endif
   
-  for (size_t i = 0; i < segments.size(); ++i) {
-    std::vector<vec3>& points = segments[i];
-    for (size_t j = 0; j < points.size(); ++j) {
-      vec3& point = points[j];
-      point.x *= scale_x;
-      point.y *= scale_y;
-    }
-  }
+  addTransform(scale_x, 0.0f, 0.0f, scale_y, 0.0f, 0.0f);
 
   min_x *= scale_x;
   max_x *= scale_x;
@@ -217,26 +338,12 @@ void KankerGlyph::scale(float s) {
 
 void KankerGlyph::flipHorizontal() {
 
-  for (size_t i = 0; i < segments.size(); ++i) {
-    std::vector<vec3>& points = segments[i];
-    for (size_t j = 0; j < points.size(); ++j) {
-      vec3& point = points[j];
-      point.y *= -1;
-    }
-  }
+  addTransform(1.0f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f);
 }
 
 void KankerGlyph::alignLeft() {
   
- for (size_t i = 0; i < segments.size(); ++i) {
-    std::vector<vec3>& points = segments[i];
-    for (size_t j = 0; j < points.size(); ++j) {
-      vec3& point = points[j];
-      // point.x -= min_x;
-      // printf("%f, %f\n", point.x, origin_x);
-      point.x -= origin_x;
-    }
-  }
+  addTransform(1.0f, 0.0f, 0.0f, 1.0f, -origin_x, 0.0f);
 
  //printf("ad.x: %f, origin_x: %f, r: %f\n", advance_x, origin_x, (advance_x - origin_x));
  // advance_x -= origin_x; /* advance x is already "relative" */
@@ -253,13 +360,7 @@ void KankerGlyph::alignLeft() {
 
 void KankerGlyph::alignBottom() {
 
-  for (size_t i = 0; i < segments.size(); ++i) {
-    std::vector<vec3>& points = segments[i];
-    for (size_t j = 0; j < points.size(); ++j) {
-      vec3& point = points[j];
-      point.y -= min_y;
-    }
-  }
+  addTransform(1.0f, 0.0f, 0.0f, 1.0f, 0.0f, -min_y);
 
   max_y -= min_y;
   min_y = 0;
@@ -277,6 +378,62 @@ void KankerGlyph::print() {
   RX_VERBOSE("glyph.width: %f", width);
   RX_VERBOSE("glyph.height: %f", height);
   RX_VERBOSE("glyph.advance_x: %f", advance_x);
-  RX_VERBOSE("glyph.segments.size(): %lu", segments.size());
+  RX_VERBOSE("glyph.segments: %lu", segment_offsets.size());
+  RX_VERBOSE("glyph.points: %lu", points.size());
   RX_VERBOSE("------");
 }
+
+/* ---------------------------------------------------------------------- */
+
+static void kanker_glyph_get_bounds(const vec3* p, size_t num, float& minX, float& minY, float& maxX, float& maxY) {
+
+  size_t i = 0;
+
+  minX = maxX = p[0].x;
+  minY = maxY = p[0].y;
+
+#if defined(KANKER_GLYPH_USE_SSE)
+
+  /* 
+     We load the x and y of two points into one register: x0, y0, x1, y1
+     with a 64 bit load into the low and one into the high half. We do 4
+     points per step with two registers; lane 0 and 2 hold the x and lane
+     1 and 3 the y. We never touch z or read past the last point; the
+     points that don't fill a step are handled below.
+  */
+  if (num >= 4) {
+
+    __m128 vmin = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)&p[0].x), (const __m64*)&p[0].x);
+    __m128 vmax = vmin;
+
+    for (i = 0; i + 4 <= num; i += 4) {
+      __m128 a = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)&p[i + 0].x), (const __m64*)&p[i + 1].x);
+      __m128 b = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)&p[i + 2].x), (const __m64*)&p[i + 3].x);
+      vmin = _mm_min_ps(vmin, _mm_min_ps(a, b));
+      vmax = _mm_max_ps(vmax, _mm_max_ps(a, b));
+    }
+
+    /* Combine the two points in the high half with the ones in the low half. */
+    vmin = _mm_min_ps(vmin, _mm_movehl_ps(vmin, vmin));
+    vmax = _mm_max_ps(vmax, _mm_movehl_ps(vmax, vmax));
+
+    float rmin[4];
+    float rmax[4];
+    _mm_storeu_ps(rmin, vmin);
+    _mm_storeu_ps(rmax, vmax);
+
+    minX = rmin[0];
+    minY = rmin[1];
+    maxX = rmax[0];
+    maxY = rmax[1];
+  }
+
+#endif
+
+  for (; i < num; ++i) {
+    if (p[i].x < minX) { minX = p[i].x; }
+    if (p[i].x > maxX) { maxX = p[i].x; }
+    if (p[i].y < minY) { minY = p[i].y; }
+    if (p[i].y > maxY) { maxY = p[i].y; }
+  }
+}
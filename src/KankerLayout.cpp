@@ -0,0 +1,187 @@
+#include <sstream>
+#include <kanker/KankerLayout.h>
+
+/* ---------------------------------------------------------------------- */
+
+KankerLayoutWord::KankerLayoutWord()
+  :glyph_start(0)
+  ,segment_start(0)
+{
+}
+
+/* ---------------------------------------------------------------------- */
+
+KankerLayout::KankerLayout()
+  :is_full(false)
+  ,has_changed(false)
+  ,font(NULL)
+  ,font_revision(0)
+  ,char_scale(0.0f)
+  ,min_point_dist(0.0f)
+  ,simplify_mode(0)
+  ,simplify_tolerance(0.0f)
+  ,word_spacing(0.0f)
+  ,line_height(0.0f)
+  ,offset_x(0.0f)
+  ,offset_y(0.0f)
+  ,min_x(0)
+  ,max_x(0)
+  ,min_y(0)
+  ,max_y(0)
+{
+}
+
+void KankerLayout::clear() {
+  glyphs.clear();
+  segments.clear();
+  words.clear();
+  text.clear();
+  font = NULL;
+  font_revision = 0;
+  is_full = false;
+}
+
+int KankerLayout::update(KankerAbb& abb, KankerFont& f, std::string str) {
+
+  std::stringstream ss;
+  std::string word;
+  size_t dx = 0;
+
+  has_changed = false;
+
+  if (0.0f == abb.getRangeWidth()) { RX_ERROR("Range width not yet set, call init() first.");  return -1;  }
+  if (0.0f == abb.getRangeHeight()) { RX_ERROR("Range height not yet set, call init() first.");  return -2;  }
+  if (0 == str.size()) { RX_ERROR("Trying to layout but the given text size is 0.");  return -3;  }
+
+  if (0 != abb.updateGlyphCache(f)) {
+    return -4;
+  }
+
+  /* Something changed that moves all words: lay out everything again. */
+  if (true == hasSettingsChanged(abb, f)) {
+    glyphs.clear();
+    segments.clear();
+    words.clear();
+    text.clear();
+    storeSettings(abb, f);
+    pen = KankerAbbPen();
+    pen.width_available = abb.getRangeWidth();
+    is_full = false;
+    has_changed = true;
+  }
+
+  /* Only the offset changed, move the glyphs we have. */
+  if (offset_x != abb.offset_x || offset_y != abb.offset_y) {
+    if (0 != applyOffset(abb, f)) {
+      clear();
+      return -5;
+    }
+    has_changed = true;
+  }
+
+  if (str == text) {
+    return 0;
+  }
+
+  /* Find the first word that is different. */
+  new_words.clear();
+  ss << str;
+
+  while (ss >> word) {
+    new_words.push_back(word);
+  }
+
+  while (dx < words.size() 
+         && dx < new_words.size() 
+         && words[dx].text == new_words[dx])
+    {
+      ++dx;
+    }
+
+  /* Continue at the first word that changed, with the pen we had before that word. */
+  if (dx < words.size()) {
+    pen = words[dx].pen;
+    glyphs.resize(words[dx].glyph_start);
+    segments.resize(words[dx].segment_start);
+    words.resize(dx);
+    is_full = false;
+  }
+
+  for (; dx < new_words.size() && false == is_full; ++dx) {
+
+    KankerLayoutWord layout_word;
+    layout_word.text = new_words[dx];
+    layout_word.pen = pen;
+    layout_word.glyph_start = glyphs.size();
+    layout_word.segment_start = segments.size();
+    words.push_back(layout_word);
+
+    if (0 != abb.writeWord(f, new_words[dx], pen, glyphs, segments)) {
+      is_full = true;
+    }
+  }
+
+  text = str;
+  has_changed = true;
+
+  return 0;
+}
+
+bool KankerLayout::hasSettingsChanged(KankerAbb& abb, KankerFont& f) {
+  return font != &f
+    || font_revision != f.revision
+    || char_scale != abb.char_scale
+    || min_point_dist != abb.min_point_dist
+    || simplify_mode != abb.simplify_mode
+    || simplify_tolerance != abb.simplify_tolerance
+    || word_spacing != abb.word_spacing
+    || line_height != abb.line_height
+    || min_x != abb.min_x
+    || max_x != abb.max_x
+    || min_y != abb.min_y
+    || max_y != abb.max_y;
+}
+
+void KankerLayout::storeSettings(KankerAbb& abb, KankerFont& f) {
+  font = &f;
+  font_revision = f.revision;
+  char_scale = abb.char_scale;
+  min_point_dist = abb.min_point_dist;
+  simplify_mode = abb.simplify_mode;
+  simplify_tolerance = abb.simplify_tolerance;
+  word_spacing = abb.word_spacing;
+  line_height = abb.line_height;
+  offset_x = abb.offset_x;
+  offset_y = abb.offset_y;
+  min_x = abb.min_x;
+  max_x = abb.max_x;
+  min_y = abb.min_y;
+  max_y = abb.max_y;
+}
+
+int KankerLayout::applyOffset(KankerAbb& abb, KankerFont& f) {
+
+  offset_x = abb.offset_x;
+  offset_y = abb.offset_y;
+  segments.clear();
+
+  /* We position the glyphs again from the cache so the result is exactly the same as laying out again. */
+  for (size_t i = 0; i < glyphs.size(); ++i) {
+
+    KankerAbbGlyph& abb_glyph = glyphs[i];
+    KankerAbbPreparedGlyph* prepared = abb.getPreparedGlyph(f, abb_glyph.glyph.charcode);
+
+    if (NULL == prepared) {
+      RX_ERROR("Cannot find the prepared glyph for `%c`, not supposed to happen.", (char)abb_glyph.glyph.charcode);
+      return -1;
+    }
+
+    abb.positionGlyph(*prepared, abb_glyph.pen_x, abb_glyph.pen_y, abb_glyph);
+
+    for (size_t k = 0; k < abb_glyph.segments.size(); ++k) {
+      segments.push_back(abb_glyph.segments[k]);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,506 @@
+#include <algorithm>
+#include <float.h>
+#include <kanker/KankerStrokeOptimizer.h>
+#include <kanker/KankerAbb.h>
+#include <kanker/KankerAbbPacker.h>
+
+/* ---------------------------------------------------------------------- */
+
+static float stroke_distance(const vec3& a, const vec3& b);
+
+/* ---------------------------------------------------------------------- */
+
+KankerStroke::KankerStroke()
+  :glyph(0)
+  ,segment(0)
+  ,group(0)
+  ,is_reversed(false)
+{
+}
+
+/* ---------------------------------------------------------------------- */
+
+KankerStrokeOptimizer::KankerStrokeOptimizer()
+  :order(KANKER_STROKE_ORDER_GLYPH)
+  ,allow_reverse(true)
+  ,max_passes(50)
+  ,travel_before(0.0f)
+  ,travel_after(0.0f)
+  ,join_tolerance(0.0f)
+  ,join_max_packets(ABB_BANK_PACKETS)
+  ,num_joins(0)
+  ,has_group_start(false)
+{
+}
+
+int KankerStrokeOptimizer::optimize(std::vector<KankerAbbGlyph>& glyphs) {
+
+  std::vector<size_t> counts;
+  size_t first = 0;
+  size_t dx = 0;
+
+  travel_before = getTravel(glyphs);
+  travel_after = travel_before;
+
+  if (KANKER_STROKE_ORDER_NONE == order) {
+    join(glyphs);
+    travel_after = getTravel(glyphs);
+    return 0;
+  }
+
+  if (KANKER_STROKE_ORDER_GLYPH != order
+      && KANKER_STROKE_ORDER_WORD != order
+      && KANKER_STROKE_ORDER_MESSAGE != order)
+    {
+      RX_ERROR("Invalid stroke order: %d", order);
+      return -1;
+    }
+
+  /* Collect the strokes; we skip empty segments. */
+  strokes.clear();
+  counts.assign(glyphs.size(), 0);
+
+  for (size_t i = 0; i < glyphs.size(); ++i) {
+
+    KankerAbbGlyph& g = glyphs[i];
+
+    for (size_t j = 0; j < g.segments.size(); ++j) {
+
+      if (0 == g.segments[j].size()) {
+        continue;
+      }
+
+      KankerStroke stroke;
+      stroke.glyph = i;
+      stroke.segment = j;
+      stroke.start = g.segments[j].front();
+      stroke.end = g.segments[j].back();
+
+      if (KANKER_STROKE_ORDER_GLYPH == order) {
+        stroke.group = i;
+      }
+      else if (KANKER_STROKE_ORDER_WORD == order) {
+        stroke.group = g.word;
+      }
+      else {
+        stroke.group = 0;
+      }
+
+      strokes.push_back(stroke);
+      counts[i]++;
+    }
+  }
+
+  /* Optimize each group; the pen starts where the previous group ended. */
+  has_group_start = false;
+
+  while (first < strokes.size()) {
+
+    size_t last = first + 1;
+    while (last < strokes.size() && strokes[last].group == strokes[first].group) {
+      ++last;
+    }
+
+    optimizeGroup(first, last);
+
+    group_start = getEnd(last - 1);
+    has_group_start = true;
+    first = last;
+  }
+
+  /* Put the segments back into the glyphs, in route order. Each glyph keeps the number of segments it had. */
+  segments.resize(strokes.size());
+
+  for (size_t i = 0; i < strokes.size(); ++i) {
+
+    KankerStroke& stroke = strokes[i];
+    std::vector<vec3>& points = glyphs[stroke.glyph].segments[stroke.segment];
+
+    segments[i].swap(points);
+
+    if (stroke.is_reversed) {
+      std::reverse(segments[i].begin(), segments[i].end());
+    }
+  }
+
+  for (size_t i = 0; i < glyphs.size(); ++i) {
+
+    glyphs[i].segments.resize(counts[i]);
+
+    for (size_t j = 0; j < counts[i]; ++j, ++dx) {
+      glyphs[i].segments[j].swap(segments[dx]);
+    }
+  }
+
+  join(glyphs);
+
+  travel_after = getTravel(glyphs);
+
+  RX_VERBOSE("Pen-up travel before: %f, after: %f (%lu strokes, %lu joins)", travel_before, travel_after, strokes.size(), num_joins);
+
+  return 0;
+}
+
+float KankerStrokeOptimizer::getTravel(std::vector<KankerAbbGlyph>& glyphs) {
+
+  float travel = 0.0f;
+  bool has_prev = false;
+  vec3 prev;
+
+  for (size_t i = 0; i < glyphs.size(); ++i) {
+
+    std::vector<std::vector<vec3> >& segs = glyphs[i].segments;
+
+    for (size_t j = 0; j < segs.size(); ++j) {
+
+      if (0 == segs[j].size()) {
+        continue;
+      }
+
+      if (has_prev) {
+        travel += stroke_distance(prev, segs[j].front());
+      }
+
+      prev = segs[j].back();
+      has_prev = true;
+    }
+  }
+
+  return travel;
+}
+
+int KankerStrokeOptimizer::join(std::vector<KankerAbbGlyph>& glyphs) {
+
+  std::vector<vec3>* prev = NULL;
+  int prev_word = 0;
+
+  num_joins = 0;
+
+  if (0.0f >= join_tolerance) {
+    return 0;
+  }
+
+  if (getMaxStrokePackets(2) > join_max_packets) {
+    RX_ERROR("The join_max_packets must be at least %lu.", getMaxStrokePackets(2));
+    return -1;
+  }
+
+  for (size_t i = 0; i < glyphs.size(); ++i) {
+
+    KankerAbbGlyph& g = glyphs[i];
+
+    for (size_t j = 0; j < g.segments.size(); ++j) {
+
+      std::vector<vec3>& points = g.segments[j];
+
+      if (0 == points.size()) {
+        continue;
+      }
+
+      if (NULL != prev
+          && prev_word == g.word
+          && getMaxStrokePackets(prev->size() + points.size() - 1) <= join_max_packets
+          && stroke_distance(prev->back(), points.front()) <= join_tolerance)
+        {
+          /* The first point is (almost) the end of the previous stroke; we skip it so we don't get points closer than `min_point_dist`. */
+          prev->insert(prev->end(), points.begin() + 1, points.end());
+          points.clear();
+          num_joins++;
+          continue;
+        }
+
+      prev = &points;
+      prev_word = g.word;
+    }
+  }
+
+  /* Remove the segments we've appended to another one. */
+  for (size_t i = 0; i < glyphs.size(); ++i) {
+
+    std::vector<std::vector<vec3> >& segs = glyphs[i].segments;
+    size_t dx = 0;
+
+    for (size_t j = 0; j < segs.size(); ++j) {
+      if (0 != segs[j].size()) {
+        segs[dx++].swap(segs[j]);
+      }
+    }
+
+    segs.resize(dx);
+  }
+
+  return 0;
+}
+
+/*
+  The move to the start, the I/O on, the move to the start again and
+  the I/O off take 4 packets. Every next point is a move of one packet,
+  or part of an arc of two packets which spans at least two points,
+  and the zone is modal so it may need an ABB_CMD_ZONE packet before
+  each move.
+*/
+size_t KankerStrokeOptimizer::getMaxStrokePackets(size_t numPoints) {
+
+  if (0 == numPoints) {
+    return 0;
+  }
+
+  return 4 + 2 * (numPoints - 1);
+}
+
+void KankerStrokeOptimizer::optimizeGroup(size_t first, size_t last) {
+
+  float travel_original = getGroupTravel(first, last);
+  std::vector<KankerStroke> original(strokes.begin() + first, strokes.begin() + last);
+
+  nearestNeighbour(first, last);
+
+  for (int i = 0; i < max_passes; ++i) {
+
+    bool improved = false;
+
+    if (allow_reverse) {
+      improved = twoOpt(first, last) || improved;
+    }
+
+    improved = orOpt(first, last) || improved;
+
+    if (false == improved) {
+      break;
+    }
+  }
+
+  /* The nearest neighbour route may be worse than the order of the font; keep the best one. */
+  if (getGroupTravel(first, last) > travel_original) {
+    std::copy(original.begin(), original.end(), strokes.begin() + first);
+  }
+}
+
+void KankerStrokeOptimizer::nearestNeighbour(size_t first, size_t last) {
+
+  size_t n = last - first;
+  bool has_pos = has_group_start;
+  vec3 pos = group_start;
+
+  scratch.assign(strokes.begin() + first, strokes.begin() + last);
+  is_used.assign(n, 0);
+
+  for (size_t k = 0; k < n; ++k) {
+
+    size_t best = 0;
+    bool best_reversed = false;
+    float best_dist = FLT_MAX;
+
+    /* Without a previous position we start with the first stroke of the font. */
+    if (false == has_pos) {
+      best = 0;
+    }
+    else {
+
+      for (size_t i = 0; i < n; ++i) {
+
+        if (is_used[i]) {
+          continue;
+        }
+
+        float d = stroke_distance(pos, scratch[i].start);
+        if (d < best_dist) {
+          best = i;
+          best_dist = d;
+          best_reversed = false;
+        }
+
+        if (allow_reverse) {
+          d = stroke_distance(pos, scratch[i].end);
+          if (d < best_dist) {
+            best = i;
+            best_dist = d;
+            best_reversed = true;
+          }
+        }
+      }
+    }
+
+    is_used[best] = 1;
+    strokes[first + k] = scratch[best];
+    strokes[first + k].is_reversed = best_reversed;
+
+    pos = getEnd(first + k);
+    has_pos = true;
+  }
+}
+
+bool KankerStrokeOptimizer::twoOpt(size_t first, size_t last) {
+
+  bool improved = false;
+
+  for (size_t i = first; i < last; ++i) {
+    for (size_t j = i; j < last; ++j) {
+
+      /* Reversing i..j: the new route starts at the end of j and ends at the start of i. */
+      float before = getArrival(first, i);
+      float after = 0.0f;
+
+      if (i == first) {
+        after = (has_group_start) ? stroke_distance(group_start, getEnd(j)) : 0.0f;
+      }
+      else {
+        after = stroke_distance(getEnd(i - 1), getEnd(j));
+      }
+
+      if (j + 1 < last) {
+        before += stroke_distance(getEnd(j), getStart(j + 1));
+        after += stroke_distance(getStart(i), getStart(j + 1));
+      }
+
+      if (after < before - 0.001f) {
+        reverseRange(i, j);
+        improved = true;
+      }
+    }
+  }
+
+  return improved;
+}
+
+bool KankerStrokeOptimizer::orOpt(size_t first, size_t last) {
+
+  bool improved = false;
+
+  for (size_t len = 1; len <= 3; ++len) {
+
+    if (last - first <= len) {
+      break;
+    }
+
+    for (size_t i = first; i + len <= last; ++i) {
+
+      size_t j = i + len - 1;
+      bool has_prev = (i > first) || has_group_start;
+      bool has_next = (j + 1 < last);
+      vec3 prev = (i > first) ? getEnd(i - 1) : group_start;
+      vec3 chain_start = getStart(i);
+      vec3 chain_end = getEnd(j);
+
+      /* What do we win when we remove the chain? */
+      float gain = 0.0f;
+
+      if (has_prev) {
+        gain += stroke_distance(prev, chain_start);
+      }
+
+      if (has_next) {
+        gain += stroke_distance(chain_end, getStart(j + 1));
+      }
+
+      if (has_prev && has_next) {
+        gain -= stroke_distance(prev, getStart(j + 1));
+      }
+
+      /* Find the best place to insert the chain: before the stroke at `p`, or at the end when p == last. */
+      float best_cost = gain - 0.001f;
+      size_t best_p = 0;
+      bool best_reversed = false;
+      bool found = false;
+
+      for (size_t p = first; p <= last; ++p) {
+
+        if (p >= i && p <= j + 1) {
+          continue;
+        }
+
+        bool p_has_prev = (p > first) || has_group_start;
+        bool p_has_next = (p < last);
+        vec3 p_prev = (p > first) ? getEnd(p - 1) : group_start;
+
+        for (int r = 0; r < 2; ++r) {
+
+          if (1 == r && false == allow_reverse) {
+            break;
+          }
+
+          vec3& cs = (0 == r) ? chain_start : chain_end;
+          vec3& ce = (0 == r) ? chain_end : chain_start;
+          float cost = 0.0f;
+
+          if (p_has_prev) {
+            cost += stroke_distance(p_prev, cs);
+          }
+
+          if (p_has_next) {
+            cost += stroke_distance(ce, getStart(p));
+          }
+
+          if (p_has_prev && p_has_next) {
+            cost -= stroke_distance(p_prev, getStart(p));
+          }
+
+          if (cost < best_cost) {
+            best_cost = cost;
+            best_p = p;
+            best_reversed = (1 == r);
+            found = true;
+          }
+        }
+      }
+
+      if (false == found) {
+        continue;
+      }
+
+      /* Move the chain. */
+      if (best_reversed) {
+        reverseRange(i, j);
+      }
+
+      scratch.assign(strokes.begin() + i, strokes.begin() + j + 1);
+      strokes.erase(strokes.begin() + i, strokes.begin() + j + 1);
+
+      if (best_p > j) {
+        best_p -= len;
+      }
+
+      strokes.insert(strokes.begin() + best_p, scratch.begin(), scratch.end());
+
+      improved = true;
+    }
+  }
+
+  return improved;
+}
+
+float KankerStrokeOptimizer::getGroupTravel(size_t first, size_t last) {
+
+  float travel = 0.0f;
+
+  for (size_t i = first; i < last; ++i) {
+    travel += getArrival(first, i);
+  }
+
+  return travel;
+}
+
+float KankerStrokeOptimizer::getArrival(size_t first, size_t dx) {
+
+  if (dx == first) {
+    return (has_group_start) ? stroke_distance(group_start, getStart(dx)) : 0.0f;
+  }
+
+  return stroke_distance(getEnd(dx - 1), getStart(dx));
+}
+
+void KankerStrokeOptimizer::reverseRange(size_t a, size_t b) {
+
+  std::reverse(strokes.begin() + a, strokes.begin() + b + 1);
+
+  for (size_t i = a; i <= b; ++i) {
+    strokes[i].is_reversed = !strokes[i].is_reversed;
+  }
+}
+
+/* ---------------------------------------------------------------------- */
+
+static float stroke_distance(const vec3& a, const vec3& b) {
+  vec3 d = a - b;
+  return sqrtf(dot(d, d));
+}
@@ -1,5 +1,21 @@
 #include <kanker/Socket.h>
 
+#include <sstream>
+
+#if !defined(_WIN32)
+#  include <fcntl.h>
+#  include <sys/uio.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#endif
+
+/* We don't want a SIGPIPE when the ABB closed the connection; we handle the error. */
+#if defined(MSG_NOSIGNAL)
+#  define SOCKET_SEND_FLAGS MSG_NOSIGNAL
+#else
+#  define SOCKET_SEND_FLAGS 0
+#endif
+
 /* ------------------------------------------------------------------------- */
 
 #if defined(_WIN32) 
@@ -31,6 +47,17 @@ int socket_shutdown() { return 0; }
 Socket::Socket() 
   :handle(-1)
   ,listener(NULL)
+  ,send_offset(0)
+  ,queued_bytes(0)
+  ,high_water(SOCKET_DEFAULT_HIGH_WATER)
+  ,is_above_high_water(false)
+  ,cached_port(0)
+  ,address_index(0)
+  ,is_connecting(false)
+  ,use_nodelay(true)
+  ,use_keepalive(true)
+  ,keepalive_idle(SOCKET_DEFAULT_KEEPALIVE_IDLE)
+  ,keepalive_interval(SOCKET_DEFAULT_KEEPALIVE_INTERVAL)
 {
   if (-1 != handle) {
     close();
@@ -42,77 +69,226 @@ Socket::~Socket() {
   listener = NULL;
 }
 
-int Socket::connect(std::string host, uint16_t port) {
+int Socket::connect(std::string host, uint16_t port, int timeoutMillis) {
 
-  int r;
-  std::stringstream ss;
-  struct addrinfo* result, *rp, hints;
+  int waited = 0;
+  int step = 0;
+
+  if (0 != startConnect(host, port)) {
+    return -1;
+  }
+
+  /* We wait in steps; when an address fails we continue with the next one within the same timeout. */
+  while (isConnecting() && waited < timeoutMillis) {
+    step = timeoutMillis - waited;
+    if (step > 50) {
+      step = 50;
+    }
+    if (0 != updateConnect(step)) {
+      return -2;
+    }
+    waited += step;
+  }
+
+  if (isConnecting()) {
+    RX_ERROR("Connecting to %s:%u timed out after %d ms.", host.c_str(), port, timeoutMillis);
+    close();
+    return -3;
+  }
+
+  return 0;
+}
+
+int Socket::startConnect(std::string host, uint16_t port) {
 
   if (-1 != handle) {
     RX_ERROR("Already connected, call close(), handle is: %d", handle);
     return -1;
   }
 
+  if (0 != resolve(host, port)) {
+    return -2;
+  }
+
+  address_index = 0;
+
+  return connectNextAddress();
+}
+
+/* 
+   Checks if the connect we started with startConnect() finished; when 
+   it failed we continue with the next address. 
+*/
+int Socket::updateConnect(int waitMillis) {
+
+  struct timeval timeout;
+  fd_set writeset;
+  fd_set errorset;
+  int err = 0;
+  socklen_t err_len = sizeof(err);
+  int r;
+
+  if (false == is_connecting) {
+    return 0;
+  }
+
+  timeout.tv_sec = waitMillis / 1000;
+  timeout.tv_usec = (waitMillis % 1000) * 1000;
+
+  FD_ZERO(&writeset);
+  FD_ZERO(&errorset);
+  FD_SET(handle, &writeset);
+  FD_SET(handle, &errorset);
+
+  r = select(handle + 1, NULL, &writeset, &errorset, &timeout);
+  if (0 == r) {
+    return 0;
+  }
+
+  if (0 > r) {
+    err = socket_get_error();
+    if (0 == socket_is_recoverable_error(err)) {
+      return 0;
+    }
+    RX_ERROR("Error while waiting for the connection: %s", strerror(err));
+  }
+  else if (0 != getsockopt(handle, SOL_SOCKET, SO_ERROR, (char*)&err, &err_len)) {
+    err = socket_get_error();
+  }
+
+  if (0 == err) {
+    return finishConnect();
+  }
+
+  RX_VERBOSE("Could not connect to %s:%u, error: %d", cached_host.c_str(), cached_port, err);
+
+  closeHandle();
+  address_index++;
+
+  return connectNextAddress();
+}
+
+int Socket::resolve(std::string host, uint16_t port) {
+
+  int r;
+  std::stringstream ss;
+  struct addrinfo* result, *rp, hints;
+
   if (0 == host.size()) {
     RX_ERROR("Invalid host (empty)");
-    return -2;
+    return -1;
   }
 
   if (0 == port) {
     RX_ERROR("Invald port: 0.");
-    return -3;
+    return -2;
+  }
+
+  /* Resolving can block for a long time, so we only do it once per host. */
+  if (host == cached_host && port == cached_port && 0 != addresses.size()) {
+    return 0;
   }
 
   ss << port;
 
-#if defined(_WIN32)
-  ZeroMemory(&hints, sizeof(hints));
-#endif
+  memset(&hints, 0x00, sizeof(hints));
 
   /* Get address info for the given host. */
   hints.ai_family = AF_UNSPEC;
   hints.ai_socktype = SOCK_STREAM;
   hints.ai_protocol = IPPROTO_TCP;
   hints.ai_flags = AI_ADDRCONFIG;
-  hints.ai_canonname = NULL;
-  hints.ai_addr = NULL;
-  hints.ai_next = NULL;
 
   r = getaddrinfo(host.c_str(), ss.str().c_str(), &hints, &result);
   if (0 != r) {
     RX_ERROR("Cannot get address info for %s:%u. Error: %s", host.c_str(), port, gai_strerror(r));
-    return -4;
+    return -3;
   }
 
-  /* Iterate over the found addresses and create socket. Use first one that works. */
-  r = -99;
+  addresses.clear();
+
   for (rp = result; rp != NULL; rp = rp->ai_next) {
-    handle = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+
+    if (rp->ai_addrlen > sizeof(struct sockaddr_storage)) {
+      continue;
+    }
+
+    SocketAddress address;
+    address.family = rp->ai_family;
+    address.socktype = rp->ai_socktype;
+    address.protocol = rp->ai_protocol;
+    address.length = rp->ai_addrlen;
+    memcpy(&address.addr, rp->ai_addr, rp->ai_addrlen);
+    addresses.push_back(address);
+  }
+
+  freeaddrinfo(result);
+
+  if (0 == addresses.size()) {
+    RX_ERROR("No usable address for %s:%u", host.c_str(), port);
+    return -4;
+  }
+
+  cached_host = host;
+  cached_port = port;
+
+  return 0;
+}
+
+/* Starts a non-blocking connect to `addresses[address_index]`, or the first one after it we can create a socket for. */
+int Socket::connectNextAddress() {
+
+  int err;
+  int r;
+
+  is_connecting = false;
+
+  for (; address_index < addresses.size(); ++address_index) {
+
+    SocketAddress& address = addresses[address_index];
+
+    handle = socket(address.family, address.socktype, address.protocol);
     if (handle < 0) {
+      handle = -1;
+      continue;
+    }
+
+    if (0 != setNonBlocking()) {
+      RX_ERROR("Failed to make the socket non-blocking.");
+      closeHandle();
       continue;
     }
-      
-    r = ::connect(handle, rp->ai_addr, rp->ai_addrlen);
+
+    r = ::connect(handle, (struct sockaddr*)&address.addr, address.length);
     if (0 == r) {
-      break;
+      return finishConnect();
     }
-  }
 
-  /* When we arrive here and r == -99 we're not connected. */
-  if (0 != r) {
-    close();
-    freeaddrinfo(result);
-    RX_ERROR("Could not find host %s:%u. Cleanly reset the socket handle. handle is: %d", host.c_str(), port, handle);
-    return -5;
+    err = socket_get_error();
+
+#if defined(_WIN32)
+    if (WSAEWOULDBLOCK == err) {
+#else
+    if (EINPROGRESS == err) {
+#endif
+      is_connecting = true;
+      return 0;
+    }
+
+    closeHandle();
   }
 
-  freeaddrinfo(result);
+  RX_ERROR("Could not connect to %s:%u", cached_host.c_str(), cached_port);
 
-  /* Connection failed? */
-  if (NULL == rp) {
-    RX_ERROR("Could not connect to %s:%u", host.c_str(), port);
-    close();
-    return -5;
+  return -1;
+}
+
+int Socket::finishConnect() {
+
+  is_connecting = false;
+
+  if (0 != setOptions()) {
+    RX_ERROR("Failed to set the socket options; we continue.");
   }
 
   if (NULL != listener) {
@@ -122,17 +298,53 @@ int Socket::connect(std::string host, uint16_t port) {
   return 0;
 }
 
+/* Our command frames are small, so we don't want Nagle to hold them back; keepalive detects a robot that went away. */
+int Socket::setOptions() {
+
+  int result = 0;
+  int flag = 1;
+
+  if (use_nodelay && 0 != setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, (const char*)&flag, sizeof(flag))) {
+    RX_ERROR("Cannot set TCP_NODELAY.");
+    result = -1;
+  }
+
+  if (false == use_keepalive) {
+    return result;
+  }
+
+  if (0 != setsockopt(handle, SOL_SOCKET, SO_KEEPALIVE, (const char*)&flag, sizeof(flag))) {
+    RX_ERROR("Cannot set SO_KEEPALIVE.");
+    return -2;
+  }
+
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+  int idle = keepalive_idle;
+  int interval = keepalive_interval;
+  int count = SOCKET_KEEPALIVE_PROBES;
+
+  if (0 != setsockopt(handle, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle))
+      || 0 != setsockopt(handle, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval))
+      || 0 != setsockopt(handle, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)))
+    {
+      RX_ERROR("Cannot set the keepalive times.");
+      result = -3;
+    }
+#endif
+
+  return result;
+}
+
 int Socket::send(const char* data, int nbytes) {
 
-  int err = 0;
-  int done = 0;
+  Buffer buffer;
 
   if (NULL == data) {
     RX_ERROR("Trying to send NULL data.");
     return -1;
   }
 
-  if (0 == nbytes) {
+  if (0 >= nbytes) {
     RX_ERROR("Trying to send 0 bytes.");
     return -2;
   }
@@ -142,36 +354,107 @@ int Socket::send(const char* data, int nbytes) {
     return -3;
   }
 
-  while (nbytes > 0 && 0 == isConnected()) {
-#if defined(_WIN32)      
-    done = ::send(handle, (const char*) data, nbytes, 0);
-#else
-    done = ::send(handle, (const void*) data, nbytes, 0);
-#endif
+  buffer.data.assign((const uint8_t*)data, (const uint8_t*)data + nbytes);
+  queue(buffer);
 
-    if (done != nbytes) {
+  return flush();
+}
 
-      /* @todo implement the situation where we couldn't send all bytes. */
-      RX_ERROR("Failed to send all bytes, this is a situation we need to handle correctly. We sent: %d, but should: %lu.", done, nbytes);
+int Socket::send(Buffer& buffer) {
 
-      err = socket_get_error();
-      if (0 == socket_is_recoverable_error(err)) {
-        RX_ERROR("The error is recoverable.");
-        return -4;
-      }
-      else {
-        close();
-        return -5;
-      }
+  if (0 == buffer.data.size()) {
+    RX_ERROR("Trying to send 0 bytes.");
+    return -1;
+  }
+
+  if (0 != isConnected()) {
+    RX_ERROR("Cannot send because we're not connected.");
+    return -2;
+  }
+
+  queue(buffer);
+
+  return flush();
+}
+
+void Socket::queue(Buffer& buffer) {
+
+  queued_bytes += buffer.data.size();
+
+  send_queue.push_back(Buffer());
+  send_queue.back().data.swap(buffer.data);
+
+  if (false == is_above_high_water && queued_bytes > high_water) {
+    is_above_high_water = true;
+    if (NULL != listener) {
+      listener->onSocketHighWater(queued_bytes);
     }
+  }
+}
+
+/* 
+   Writes the queued buffers with one call; when the socket accepts 
+   only a part we remember how much of the first buffer was sent and 
+   continue from there the next time. 
+*/
+int Socket::flush() {
+
+  int err = 0;
+  int done = 0;
+  size_t count = 0;
+
+  if (0 != isConnected()) {
+    return -1;
+  }
+
+  while (0 != send_queue.size()) {
+
+    count = (send_queue.size() < SOCKET_MAX_IOV) ? send_queue.size() : SOCKET_MAX_IOV;
+
+#if defined(_WIN32)
+    WSABUF bufs[SOCKET_MAX_IOV];
+    DWORD nsent = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+      size_t offset = (0 == i) ? send_offset : 0;
+      bufs[i].buf = (char*)&send_queue[i].data[offset];
+      bufs[i].len = (ULONG)(send_queue[i].data.size() - offset);
+    }
+
+    done = (0 == WSASend(handle, bufs, (DWORD)count, &nsent, 0, NULL, NULL)) ? (int)nsent : -1;
+#else
+    struct iovec bufs[SOCKET_MAX_IOV];
+    struct msghdr msg;
+
+    for (size_t i = 0; i < count; ++i) {
+      size_t offset = (0 == i) ? send_offset : 0;
+      bufs[i].iov_base = (void*)&send_queue[i].data[offset];
+      bufs[i].iov_len = send_queue[i].data.size() - offset;
+    }
+
+    memset(&msg, 0x00, sizeof(msg));
+    msg.msg_iov = bufs;
+    msg.msg_iovlen = count;
+
+    done = ::sendmsg(handle, &msg, SOCKET_SEND_FLAGS);
+#endif
 
     if (done < 0) {
+
       err = socket_get_error();
+
+#if !defined(_WIN32)
+      if (EINTR == err) {
+        continue;
+      }
+#endif
+
+      /* The socket buffer is full; we continue when the socket is writable again. */
       if (0 == socket_is_recoverable_error(err)) {
         return 0;
       }
 
-      RX_ERROR("Error while sending data over socket: %s", strerror(errno));
+      RX_ERROR("Error while sending data over socket: %s", strerror(err));
 
       if (0 != close()) {
         RX_ERROR("Failed to cleanly close the socket after being disconnected.");
@@ -181,11 +464,50 @@ int Socket::send(const char* data, int nbytes) {
         listener->onSocketDisconnected();
       }
 
-      return -3;
+      return -2;
     }
-      
-    nbytes -= done;
+
+    /* Remove what was sent. */
+    while (done > 0) {
+
+      size_t left = send_queue.front().data.size() - send_offset;
+
+      if ((size_t)done < left) {
+        send_offset += done;
+        queued_bytes -= done;
+        break;
+      }
+
+      done -= left;
+      queued_bytes -= left;
+      send_offset = 0;
+      send_queue.pop_front();
+    }
+  }
+
+  if (is_above_high_water) {
+    is_above_high_water = false;
+    if (NULL != listener) {
+      listener->onSocketDrained();
+    }
+  }
+
+  return 0;
+}
+
+int Socket::setNonBlocking() {
+
+#if defined(_WIN32)
+  u_long mode = 1;
+  if (0 != ioctlsocket(handle, FIONBIO, &mode)) {
+    return -1;
+  }
+#else
+  int flags = fcntl(handle, F_GETFL, 0);
+  if (-1 == flags || -1 == fcntl(handle, F_SETFL, flags | O_NONBLOCK)) {
+    return -1;
   }
+#endif
 
   return 0;
 }
@@ -275,8 +597,20 @@ int Socket::read(char* buffer, int nbytes) {
 
 int Socket::close() {
 
+  /* What we didn't send yet is lost. */
+  send_queue.clear();
+  send_offset = 0;
+  queued_bytes = 0;
+  is_above_high_water = false;
+  is_connecting = false;
+
+  return closeHandle();
+}
+
+int Socket::closeHandle() {
+
   /* Already closed? */
-  if (0 != isConnected()) {
+  if (-1 == handle) {
     return 0; 
   }
 
@@ -0,0 +1,464 @@
+#include <kanker/SocketReactor.h>
+
+#if defined(__linux)
+#  include <sys/epoll.h>
+#  include <sys/eventfd.h>
+#elif !defined(_WIN32)
+#  include <sys/select.h>
+#  include <fcntl.h>
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+#if !defined(__linux)
+static int socket_reactor_create_pair(SOCKET_HANDLE* fds);
+static void socket_reactor_close(SOCKET_HANDLE fd);
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+SocketReactor::SocketReactor()
+#if defined(__linux)
+  :epoll_fd(-1)
+  ,watched_fd(-1)
+  ,wake_fd(-1)
+#endif
+{
+#if !defined(__linux)
+  wake_fds[0] = -1;
+  wake_fds[1] = -1;
+#endif
+}
+
+SocketReactor::~SocketReactor() {
+  shutdown();
+}
+
+#if defined(__linux)
+
+int SocketReactor::init() {
+
+  struct epoll_event ev;
+
+  if (-1 != epoll_fd) {
+    return 0;
+  }
+
+  epoll_fd = epoll_create(1);
+  if (-1 == epoll_fd) {
+    RX_ERROR("Cannot create the epoll instance: %s", strerror(errno));
+    return -1;
+  }
+
+  watched_fd = -1;
+
+  wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (-1 == wake_fd) {
+    RX_ERROR("Cannot create the wakeup eventfd: %s", strerror(errno));
+    shutdown();
+    return -2;
+  }
+
+  memset(&ev, 0x00, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = wake_fd;
+
+  if (0 != epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev)) {
+    RX_ERROR("Cannot watch the wakeup eventfd: %s", strerror(errno));
+    shutdown();
+    return -3;
+  }
+
+  return 0;
+}
+
+int SocketReactor::shutdown() {
+
+  if (-1 != wake_fd) {
+    ::close(wake_fd);
+    wake_fd = -1;
+  }
+
+  if (-1 == epoll_fd) {
+    return 0;
+  }
+
+  ::close(epoll_fd);
+  epoll_fd = -1;
+  watched_fd = -1;
+
+  return 0;
+}
+
+int SocketReactor::wait(SOCKET_HANDLE fd, int events, int timeoutMillis) {
+
+  struct epoll_event evs[2];
+  int result = 0;
+  int r;
+
+  if (0 != init()) {
+    return -1;
+  }
+
+  if (0 > fd) {
+    events = SOCKET_EVENT_NONE;
+  }
+
+  if (SOCKET_EVENT_NONE == events && -1 != watched_fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, watched_fd, &evs[0]);
+    watched_fd = -1;
+  }
+
+  if (SOCKET_EVENT_NONE != events && 0 != watch(fd, events)) {
+    return -2;
+  }
+
+  /* Without events only the wakeup handle is registered. */
+  r = epoll_wait(epoll_fd, evs, 2, timeoutMillis);
+  if (0 > r) {
+    if (EINTR == errno) {
+      return 0;
+    }
+    RX_ERROR("Error while waiting for socket events: %s", strerror(errno));
+    return -3;
+  }
+
+  for (int i = 0; i < r; ++i) {
+
+    struct epoll_event& ev = evs[i];
+
+    if (ev.data.fd == wake_fd) {
+      drainWakeup();
+      result |= SOCKET_EVENT_WAKEUP;
+      continue;
+    }
+
+    if (SOCKET_EVENT_NONE == events) {
+      continue;
+    }
+
+    if (ev.events & EPOLLIN) {
+      result |= SOCKET_EVENT_READ;
+    }
+    if (ev.events & EPOLLOUT) {
+      result |= SOCKET_EVENT_WRITE;
+    }
+    if (ev.events & (EPOLLERR | EPOLLHUP)) {
+      result |= SOCKET_EVENT_ERROR;
+    }
+  }
+
+  return result;
+}
+
+int SocketReactor::wakeup() {
+
+  uint64_t one = 1;
+
+  if (-1 == wake_fd) {
+    RX_ERROR("Cannot wake up the reactor, call init() first.");
+    return -1;
+  }
+
+  /* EAGAIN means the counter is already set; the waiter wakes up anyway. */
+  if (sizeof(one) != ::write(wake_fd, &one, sizeof(one)) && EAGAIN != errno) {
+    RX_ERROR("Cannot wake up the reactor: %s", strerror(errno));
+    return -2;
+  }
+
+  return 0;
+}
+
+void SocketReactor::drainWakeup() {
+
+  uint64_t count = 0;
+
+  if (sizeof(count) != ::read(wake_fd, &count, sizeof(count)) && EAGAIN != errno) {
+    RX_ERROR("Cannot reset the wakeup eventfd: %s", strerror(errno));
+  }
+}
+
+int SocketReactor::watch(SOCKET_HANDLE fd, int events) {
+
+  struct epoll_event ev;
+
+  memset(&ev, 0x00, sizeof(ev));
+  ev.data.fd = fd;
+
+  if (events & SOCKET_EVENT_READ) {
+    ev.events |= EPOLLIN;
+  }
+  if (events & SOCKET_EVENT_WRITE) {
+    ev.events |= EPOLLOUT;
+  }
+
+  /* A socket that was closed is removed from the epoll set, but a new socket can get the same handle; so we modify and add when that fails. */
+  if (fd != watched_fd && -1 != watched_fd) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, watched_fd, &ev);
+  }
+
+  watched_fd = fd;
+
+  if (0 == epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev)) {
+    return 0;
+  }
+
+  if (ENOENT == errno && 0 == epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+    return 0;
+  }
+
+  RX_ERROR("Cannot watch socket %d: %s", fd, strerror(errno));
+  watched_fd = -1;
+
+  return -1;
+}
+
+#else
+
+/* ------------------------------------------------------------------------- */
+
+int SocketReactor::init() {
+
+  if (-1 != wake_fds[0]) {
+    return 0;
+  }
+
+  if (0 != socket_reactor_create_pair(wake_fds)) {
+    wake_fds[0] = -1;
+    wake_fds[1] = -1;
+    return -1;
+  }
+
+  return 0;
+}
+
+int SocketReactor::shutdown() {
+
+  if (-1 == wake_fds[0]) {
+    return 0;
+  }
+
+  socket_reactor_close(wake_fds[0]);
+  socket_reactor_close(wake_fds[1]);
+  wake_fds[0] = -1;
+  wake_fds[1] = -1;
+
+  return 0;
+}
+
+int SocketReactor::wait(SOCKET_HANDLE fd, int events, int timeoutMillis) {
+
+  struct timeval timeout;
+  struct timeval* timeout_ptr = NULL;
+  SOCKET_HANDLE max_fd = -1;
+  fd_set readset;
+  fd_set writeset;
+  fd_set errorset;
+  int result = 0;
+  int r;
+
+  if (0 <= timeoutMillis) {
+    timeout.tv_sec = timeoutMillis / 1000;
+    timeout.tv_usec = (timeoutMillis % 1000) * 1000;
+    timeout_ptr = &timeout;
+  }
+
+  if (0 != init()) {
+    return -1;
+  }
+
+  if ((SOCKET_HANDLE)-1 == fd) {
+    events = SOCKET_EVENT_NONE;
+  }
+
+  FD_ZERO(&readset);
+  FD_ZERO(&writeset);
+  FD_ZERO(&errorset);
+
+  FD_SET(wake_fds[0], &readset);
+  max_fd = wake_fds[0];
+
+  if (SOCKET_EVENT_NONE != events) {
+    FD_SET(fd, &errorset);
+    if (events & SOCKET_EVENT_READ) {
+      FD_SET(fd, &readset);
+    }
+    if (events & SOCKET_EVENT_WRITE) {
+      FD_SET(fd, &writeset);
+    }
+    if (fd > max_fd) {
+      max_fd = fd;
+    }
+  }
+
+  /* The first argument is ignored on Windows. */
+  r = select((int)(max_fd + 1), &readset, &writeset, &errorset, timeout_ptr);
+  if (0 > r) {
+    if (0 == socket_is_recoverable_error(socket_get_error())) {
+      return 0;
+    }
+    RX_ERROR("Error while waiting for socket events: %d", socket_get_error());
+    return -2;
+  }
+
+  if (0 == r) {
+    return 0;
+  }
+
+  if (FD_ISSET(wake_fds[0], &readset)) {
+    drainWakeup();
+    result |= SOCKET_EVENT_WAKEUP;
+  }
+
+  if (SOCKET_EVENT_NONE == events) {
+    return result;
+  }
+
+  if (FD_ISSET(fd, &readset)) {
+    result |= SOCKET_EVENT_READ;
+  }
+  if (FD_ISSET(fd, &writeset)) {
+    result |= SOCKET_EVENT_WRITE;
+  }
+  if (FD_ISSET(fd, &errorset)) {
+    result |= SOCKET_EVENT_ERROR;
+  }
+
+  return result;
+}
+
+int SocketReactor::wakeup() {
+
+  char one = 1;
+  int r;
+
+  if (-1 == wake_fds[1]) {
+    RX_ERROR("Cannot wake up the reactor, call init() first.");
+    return -1;
+  }
+
+#if defined(_WIN32)
+  r = ::send(wake_fds[1], &one, 1, 0);
+#else
+  r = ::write(wake_fds[1], &one, 1);
+#endif
+
+  /* When the pipe is full there are enough bytes to wake up the waiter. */
+  if (1 != r && 0 != socket_is_recoverable_error(socket_get_error())) {
+    RX_ERROR("Cannot wake up the reactor: %d", socket_get_error());
+    return -2;
+  }
+
+  return 0;
+}
+
+void SocketReactor::drainWakeup() {
+
+  char buf[64];
+
+#if defined(_WIN32)
+  while (0 < ::recv(wake_fds[0], buf, sizeof(buf), 0)) {
+  }
+#else
+  while (0 < ::read(wake_fds[0], buf, sizeof(buf))) {
+  }
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+
+#if defined(_WIN32)
+
+/* Windows has no socketpair() and select() only accepts sockets, so we connect two sockets over the loopback interface. */
+static int socket_reactor_create_pair(SOCKET_HANDLE* fds) {
+
+  struct sockaddr_in addr;
+  int addr_len = sizeof(addr);
+  u_long mode = 1;
+  SOCKET_HANDLE server = -1;
+
+  fds[0] = -1;
+  fds[1] = -1;
+
+  memset(&addr, 0x00, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+
+  server = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (-1 == server) {
+    RX_ERROR("Cannot create the wakeup sockets: %d", socket_get_error());
+    return -1;
+  }
+
+  /* Port 0 lets the OS pick a free port; getsockname() tells us which one. */
+  if (0 != ::bind(server, (struct sockaddr*)&addr, sizeof(addr)) || 0 != ::listen(server, 1) || 0 != ::getsockname(server, (struct sockaddr*)&addr, &addr_len)) {
+    RX_ERROR("Cannot listen for the wakeup sockets: %d", socket_get_error());
+    socket_reactor_close(server);
+    return -2;
+  }
+
+  fds[1] = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (-1 == fds[1] || 0 != ::connect(fds[1], (struct sockaddr*)&addr, sizeof(addr))) {
+    RX_ERROR("Cannot connect the wakeup sockets: %d", socket_get_error());
+    socket_reactor_close(fds[1]);
+    socket_reactor_close(server);
+    return -3;
+  }
+
+  fds[0] = ::accept(server, NULL, NULL);
+  socket_reactor_close(server);
+
+  if (-1 == fds[0]) {
+    RX_ERROR("Cannot accept the wakeup socket: %d", socket_get_error());
+    socket_reactor_close(fds[1]);
+    return -4;
+  }
+
+  if (0 != ioctlsocket(fds[0], FIONBIO, &mode) || 0 != ioctlsocket(fds[1], FIONBIO, &mode)) {
+    RX_ERROR("Cannot make the wakeup sockets non-blocking: %d", socket_get_error());
+    socket_reactor_close(fds[0]);
+    socket_reactor_close(fds[1]);
+    return -5;
+  }
+
+  return 0;
+}
+
+static void socket_reactor_close(SOCKET_HANDLE fd) {
+  if (-1 != fd) {
+    ::closesocket(fd);
+  }
+}
+
+#else
+
+static int socket_reactor_create_pair(SOCKET_HANDLE* fds) {
+
+  if (0 != pipe(fds)) {
+    RX_ERROR("Cannot create the wakeup pipe: %s", strerror(errno));
+    return -1;
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    int flags = fcntl(fds[i], F_GETFL, 0);
+    if (-1 == flags || -1 == fcntl(fds[i], F_SETFL, flags | O_NONBLOCK) || -1 == fcntl(fds[i], F_SETFD, FD_CLOEXEC)) {
+      RX_ERROR("Cannot make the wakeup pipe non-blocking: %s", strerror(errno));
+      socket_reactor_close(fds[0]);
+      socket_reactor_close(fds[1]);
+      return -2;
+    }
+  }
+
+  return 0;
+}
+
+static void socket_reactor_close(SOCKET_HANDLE fd) {
+  if (-1 != fd) {
+    ::close(fd);
+  }
+}
+
+#endif
+
+#endif
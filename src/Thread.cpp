@@ -0,0 +1,119 @@
+#include <kanker/Thread.h>
+
+#if !defined(_WIN32)
+#  include <errno.h>
+#  include <string.h>
+#  include <time.h>
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+#if defined(_WIN32)
+
+static DWORD WINAPI thread_main(LPVOID user) {
+  Thread* thread = static_cast<Thread*>(user);
+  thread->function(thread->user);
+  return 0;
+}
+
+#else
+
+static void* thread_main(void* user) {
+  Thread* thread = static_cast<Thread*>(user);
+  thread->function(thread->user);
+  return NULL;
+}
+
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+Thread::Thread()
+  :function(NULL)
+  ,user(NULL)
+  ,is_running(false)
+#if defined(_WIN32)
+  ,handle(NULL)
+#endif
+{
+}
+
+Thread::~Thread() {
+
+  if (is_running) {
+    RX_ERROR("The thread is still running; call join() before destroying it.");
+  }
+}
+
+int Thread::create(thread_function func, void* usr) {
+
+  if (is_running) {
+    RX_ERROR("The thread is already running.");
+    return -1;
+  }
+
+  if (NULL == func) {
+    RX_ERROR("No thread function given.");
+    return -2;
+  }
+
+  function = func;
+  user = usr;
+
+#if defined(_WIN32)
+  handle = CreateThread(NULL, 0, thread_main, this, 0, NULL);
+  if (NULL == handle) {
+    RX_ERROR("Cannot create the thread: %lu", GetLastError());
+    return -3;
+  }
+#else
+  int r = pthread_create(&handle, NULL, thread_main, this);
+  if (0 != r) {
+    RX_ERROR("Cannot create the thread: %s", strerror(r));
+    return -3;
+  }
+#endif
+
+  is_running = true;
+
+  return 0;
+}
+
+int Thread::join() {
+
+  if (false == is_running) {
+    return 0;
+  }
+
+#if defined(_WIN32)
+  WaitForSingleObject(handle, INFINITE);
+  CloseHandle(handle);
+  handle = NULL;
+#else
+  int r = pthread_join(handle, NULL);
+  if (0 != r) {
+    RX_ERROR("Cannot join the thread: %s", strerror(r));
+    return -1;
+  }
+#endif
+
+  is_running = false;
+
+  return 0;
+}
+
+/* ------------------------------------------------------------------------- */
+
+void thread_sleep_millis(int millis) {
+
+#if defined(_WIN32)
+  Sleep(millis);
+#else
+  struct timespec ts;
+  ts.tv_sec = millis / 1000;
+  ts.tv_nsec = (millis % 1000) * 1000000L;
+
+  while (0 != nanosleep(&ts, &ts) && EINTR == errno) {
+  }
+#endif
+}
@@ -0,0 +1,55 @@
+/*
+
+  kankerfontc
+  -----------
+
+  Compiles a xml font into a binary .kfnt font file that can be 
+  memory mapped, see KankerFontFile.h. 
+
+  Usage: ./kankerfontc fonts/roxlu.xml fonts/roxlu.kfnt
+
+ */
+#include <kanker/KankerFont.h>
+#include <kanker/KankerFontFile.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ROXLU_USE_MATH
+#define ROXLU_USE_LOG
+#define ROXLU_IMPLEMENTATION
+#include <tinylib.h>
+
+int main(int argc, char** argv) {
+
+  rx_log_init();
+
+  if (3 != argc) {
+    printf("Usage: %s <input.xml> <output.kfnt>\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  std::string input = argv[1];
+  std::string output = argv[2];
+
+  KankerFont font;
+  if (0 != font.load(input)) {
+    RX_ERROR("Failed to load the font: %s", input.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  if (0 != font.save(output, KANKER_FONT_FORMAT_BINARY)) {
+    RX_ERROR("Failed to compile the font into: %s", output.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  /* Make sure we can read back what we've written. */
+  KankerFont compiled;
+  if (0 != compiled.load(output)) {
+    RX_ERROR("Failed to load the compiled font: %s", output.c_str());
+    exit(EXIT_FAILURE);
+  }
+
+  RX_VERBOSE("Compiled %s into %s, %lu glyphs.", input.c_str(), output.c_str(), compiled.size());
+
+  return 0;
+}
@@ -13,6 +13,9 @@
     TASK PERS wobjdata myWobj:=[FALSE,TRUE,"",[[400,0,400],[1,0,0,0]],[[0,0,0],[1,0,0,0]]];
     VAR robtarget myRobtarget:=[[0,0,0],[1,0,0,0],[0,0,0,0],[9E9,9E9,9E9,9E9,9E9,9E9]];
     VAR robtarget draw_target;
+    VAR robtarget via_target;
+    VAR bool has_via_target:=FALSE;
+    VAR zonedata draw_zone:=fine;
     VAR jointtarget joints;
     VAR bool to_home:=TRUE;
     VAR speeddata speed:=[700,500,500,15];
@@ -21,6 +24,11 @@
     PERS num pkt_write_dx:=1;
     PERS bool has_data:=FALSE;
     PERS bool drawing_ready:=FALSE;
+    PERS num packets_drawn;
+    PERS bool bank_ready{2}:=[FALSE,FALSE];
+    PERS num bank_count{2}:=[0,0];
+    CONST num bank_size:=250;
+    VAR num read_bank:=1;
 
     VAR num prev_write_dx:=1;
     PERS string state;
@@ -32,6 +40,7 @@
             TPErase;
             pkt_write_dx:=1;
             pkt_read_dx:=1;
+            read_bank:=1;
 
             ! Move all axis into their start position.
             MoveAbsJ [[0,0,0,0,0,0],[9E9,9E9,9E9,9E9,9E9,9E9]],speed,fine,tool0;
@@ -56,64 +65,25 @@
         SetDO doLed2,0;
         SetDO doLed3,0;
 
-        WaitUntil has_data;
+        WaitUntil has_data OR bank_ready{read_bank};
+
+        ! Banked streaming: Networking receives the next bank while we draw this one.
+        IF bank_ready{read_bank}=TRUE THEN
+            drawBank;
+            RETURN ;
+        ENDIF
 
         prev_write_dx:=pkt_write_dx;
         pkt_read_dx:=1;
         pkt_write_dx:=pkt_write_dx-1;
 
+        has_via_target:=FALSE;
+        draw_zone:=fine;
+
         IF pkt_write_dx>0 THEN
             FOR i FROM 1 TO pkt_write_dx DO
-                IF 0=packets{i}.cmd THEN
-                    draw_target:=Offs(myRobtarget,packets{i}.x,packets{i}.y,packets{i}.z);
-                    MoveL draw_target,speed,fine,tool0,\WObj:=myWobj;
-
-                    IF 0<>packets{i}.rot_z THEN
-                        joints:=CJointT();
-                        joints.robax.rax_6:=joints.robax.rax_6+packets{i}.rot_z;
-                        MoveAbsJ joints\NoEOffs,speed,fine,tool0,\WObj:=myWobj;
-                    ENDIF
-
-                ELSEIF 1=packets{i}.cmd THEN
-
-                    ! Lamp0
-                    IF 0=packets{i}.x THEN
-                        IF 1=packets{i}.y THEN
-                            SetDO doLamp,1;
-                        ELSE
-                            SetDO doLamp,0;
-                        ENDIF
-                        ! Led1    
-                    ELSEIF 1=packets{i}.x THEN
-                        IF 1=packets{i}.y THEN
-                            SetDO doLed1,1;
-                        ELSE
-                            SetDO doLed1,0;
-                        ENDIF
-                        ! Led2
-                    ELSEIF 2=packets{i}.x THEN
-                        IF 1=packets{i}.y THEN
-                            SetDO doLed2,1;
-                        ELSE
-                            SetDO doLed2,0;
-                        ENDIF
-                        ! Led3
-                    ELSEIF 3=packets{i}.x THEN
-                        IF 3=packets{i}.y THEN
-                            SetDO doLed3,1;
-                        ELSE
-                            SetDO doLed3,0;
-                        ENDIF
-                    ELSE
-                        ! Nothing to be done here; maybe a safety check on i/o port?
-                    ENDIF
-                ELSEIF 5=packets{i}.cmd THEN
-                    ! Move back to original home position.
-                    moveToHomePosition;
-                    TPWrite "TO HOME!";
-                ELSE
-                    TPWrite "Unhandled packet command: "\Num:=packets{i}.cmd;
-                ENDIF
+                executePacket i;
+                packets_drawn:=packets_drawn+1;
                 pkt_read_dx:=pkt_read_dx+1;
             ENDFOR
         ENDIF
@@ -135,6 +105,100 @@
 
     ENDPROC
 
+    ! Executes one packet; `draw_zone` and the via target of an arc are kept between calls.
+    PROC executePacket(num dx)
+        IF 0=packets{dx}.cmd THEN
+            draw_target:=Offs(myRobtarget,packets{dx}.x,packets{dx}.y,packets{dx}.z);
+            MoveL draw_target,speed,draw_zone,tool0,\WObj:=myWobj;
+
+            IF 0<>packets{dx}.rot_z THEN
+                joints:=CJointT();
+                joints.robax.rax_6:=joints.robax.rax_6+packets{dx}.rot_z;
+                MoveAbsJ joints\NoEOffs,speed,fine,tool0,\WObj:=myWobj;
+            ENDIF
+
+        ELSEIF 1=packets{dx}.cmd THEN
+
+            ! Lamp0
+            IF 0=packets{dx}.x THEN
+                IF 1=packets{dx}.y THEN
+                    SetDO doLamp,1;
+                ELSE
+                    SetDO doLamp,0;
+                ENDIF
+                ! Led1    
+            ELSEIF 1=packets{dx}.x THEN
+                IF 1=packets{dx}.y THEN
+                    SetDO doLed1,1;
+                ELSE
+                    SetDO doLed1,0;
+                ENDIF
+                ! Led2
+            ELSEIF 2=packets{dx}.x THEN
+                IF 1=packets{dx}.y THEN
+                    SetDO doLed2,1;
+                ELSE
+                    SetDO doLed2,0;
+                ENDIF
+                ! Led3
+            ELSEIF 3=packets{dx}.x THEN
+                IF 3=packets{dx}.y THEN
+                    SetDO doLed3,1;
+                ELSE
+                    SetDO doLed3,0;
+                ENDIF
+            ELSE
+                ! Nothing to be done here; maybe a safety check on i/o port?
+            ENDIF
+        ELSEIF 6=packets{dx}.cmd THEN
+
+            ! An arc is stored in two packets; the first one is the via point, the second one the end point.
+            IF has_via_target=FALSE THEN
+                via_target:=Offs(myRobtarget,packets{dx}.x,packets{dx}.y,packets{dx}.z);
+                has_via_target:=TRUE;
+            ELSE
+                draw_target:=Offs(myRobtarget,packets{dx}.x,packets{dx}.y,packets{dx}.z);
+                MoveC via_target,draw_target,speed,draw_zone,tool0,\WObj:=myWobj;
+                has_via_target:=FALSE;
+            ENDIF
+
+        ELSEIF 7=packets{dx}.cmd THEN
+
+            ! The zone (in mm) for the next moves; the points inside a stroke are blended, the others are fine points.
+            IF 0=packets{dx}.x THEN
+                draw_zone:=fine;
+            ELSE
+                draw_zone:=[FALSE,packets{dx}.x,1.5*packets{dx}.x,1.5*packets{dx}.x,0.15*packets{dx}.x,1.5*packets{dx}.x,0.15*packets{dx}.x];
+            ENDIF
+
+        ELSEIF 5=packets{dx}.cmd THEN
+            ! Move back to original home position.
+            moveToHomePosition;
+            TPWrite "TO HOME!";
+        ELSE
+            TPWrite "Unhandled packet command: "\Num:=packets{dx}.cmd;
+        ENDIF
+    ENDPROC
+
+    ! Draws the packets of `read_bank` and hands the bank back to Networking.
+    PROC drawBank()
+        VAR num first;
+
+        first:=(read_bank-1)*bank_size+1;
+        has_via_target:=FALSE;
+        draw_zone:=fine;
+
+        IF bank_count{read_bank}>0 THEN
+            FOR i FROM first TO first+bank_count{read_bank}-1 DO
+                executePacket i;
+                packets_drawn:=packets_drawn+1;
+            ENDFOR
+        ENDIF
+
+        bank_ready{read_bank}:=FALSE;
+        read_bank:=3-read_bank;
+    ENDPROC
+
     ! Last minute fix/on-site. Moves the abb into it's start state.
     PROC moveToHomePosition()
         MoveAbsJ [[0,0,0,0,0,0],[9E9,9E9,9E9,9E9,9E9,9E9]],speed,fine,tool0;
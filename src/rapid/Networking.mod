@@ -15,14 +15,28 @@ MODULE Networking(SYSMODULE)
 
     ! 0     = ABB_CMD_POSITION:            We expect a x,y,z position in robot coordinates, 4 bytes per float.
     ! 1     = ABB_CMD_TOGGLE_IO:           Change the value of an I/O port. 
-    ! 2     = ABB_CMD_RESET_PACKET_INDEX:  Reset the read and write indices into our packet array.
+    ! 2     = ABB_CMD_RESET:               Resets `packets_drawn`; the client sends this at the start of a message.
     ! 3     = ABB_CMD_DRAW:                When we receive this command we iterate over the `packets` and move the tcp.
+    ! 6     = ABB_CMD_ARC:                 We expect a via x,y,z and end x,y,z position, 4 bytes per float. Stored in two packets.
+    ! 7     = ABB_CMD_ZONE:                We expect 1 byte with the zone in mm which is used for the next moves; 0 = fine.
+    ! 8     = ABB_CMD_DRAW_BANKED:         We expect 1 byte, 1 when it's the last bank. FreeWriting draws the bank while we receive the next one into the other bank.
+    ! 9     = ABB_CMD_FRAME:               Everything we receive is framed: 9, the size of the payload (u16, big endian) and the payload. 
+    !                                      A command can continue in the next frame.
+    ! 10    = ABB_CMD_POSITION_DELTA:      We expect dx,dy,dz relative to the previous position in 0.1 mm, 2 bytes (signed) per value. Stored as a position.
     ! 255   = unset/unknown command.
     VAR pos read_position;
     VAR byte command:=255;
+    VAR byte zone_byte:=0;
+    VAR pos delta_base:=[0,0,0];
+    VAR num delta_value:=0;
     VAR num read_offset:=1;
     VAR num bytes_available:=0;
     VAR rawbytes raw_data_in;
+    VAR rawbytes frame_data;
+    VAR rawbytes carry_data;
+    VAR num frame_size:=0;
+    VAR num carry_size:=0;
+    CONST num frame_max_size:=1000;
 
     PERS Packet packets{500}:=[[0,0,-680,-300,0],[0,0,0,0,0],[0,0,-680,200,0],[1,2,1,0,0],[0,0,0,-50,120],[1,2,0,0,0],[1,2,1,0,0],[0,0,680,200,120],[1,2,0,0,0],[1,1,1,0,0],[0,0,680,200,-120],[1,1,0,0,0],[1,1,1,0,0],[0,0,0,-50,20],[1,1,0,0,0],[5,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0],[0,0,0,0,0]];
     PERS num pkt_read_dx:=17;
@@ -30,11 +44,30 @@ MODULE Networking(SYSMODULE)
     PERS bool has_data:=FALSE;
     PERS bool drawing_ready:=FALSE;
 
+    ! The number of packets FreeWriting executed since ABB_CMD_RESET. While we wait for 
+    ! FreeWriting we send it to the client as "p<packets_drawn>;", at most every `progress_rate` seconds.
+    PERS num packets_drawn:=0;
+    VAR num progress_sent:=0;
+    CONST num progress_rate:=0.2;
+
+    ! Banked streaming: `packets` is split into two banks of `bank_size` packets. 
+    ! We receive into one bank while FreeWriting draws the other one.
+    PERS bool bank_ready{2}:=[FALSE,FALSE];
+    PERS num bank_count{2}:=[0,0];
+    CONST num bank_size:=250;
+    VAR num write_bank:=1;
+    VAR byte last_bank:=0;
+
     ! Experimental
     ! n = none, starting up.
     ! c = someone just connected
     ! r = ready to receive commands
     ! d = we're currently drawing
+    ! Besides the state we send: 
+    ! b        = a bank is free (see notifyBankFree)
+    ! p<num>;  = the number of packets drawn (see notifyProgress)
+    ! e<num>;  = an error: 1 = invalid frame header, we close the connection after it (see dropClient),
+    !            2 = unknown command (see notifyError)
     PERS string state:="r";
 
     VAR socketstatus server_ss;
@@ -50,6 +83,10 @@ MODULE Networking(SYSMODULE)
             pkt_write_dx:=1;
             has_data:=FALSE;
             drawing_ready:=FALSE;
+            bank_ready{1}:=FALSE;
+            bank_ready{2}:=FALSE;
+            write_bank:=1;
+            carry_size:=0;
 
             FOR i FROM 1 TO 500 DO
                 packets{i}:=[0,0,0,0,0];
@@ -67,12 +104,34 @@ MODULE Networking(SYSMODULE)
 
         bytes_available:=SocketPeek(client_socket);
 
-        IF bytes_available>=1 THEN
+        IF bytes_available>=3 THEN
+
+            ! Read one frame: the header and then exactly the size of the payload.
+            ClearRawBytes frame_data;
+            SocketReceive client_socket\RawData:=frame_data\ReadNoOfBytes:=3;
+            UnpackRawBytes frame_data,1,command\Hex1;
+            UnpackRawBytes frame_data\Network,2,frame_size\IntX:=UINT;
+
+            ! We don't know where the next frame starts anymore; the client has to reconnect and start over.
+            IF 9<>command OR frame_size<1 OR frame_size>frame_max_size THEN
+                TPWrite "Invalid frame, header: "\Num:=command;
+                notifyError 1;
+                dropClient;
+                RETURN ;
+            ENDIF
+
+            ClearRawBytes frame_data;
+            SocketReceive client_socket\RawData:=frame_data\ReadNoOfBytes:=frame_size;
 
-            ! @todo how to deal with situations where the buffer has more then 1024 bytes ?
-            ! Append read data to our parse buffer. 
+            ! Continue with the start of the command that didn't fit in the previous frame.
             ClearRawBytes raw_data_in;
-            SocketReceive client_socket\RawData:=raw_data_in;
+            IF carry_size>0 THEN
+                CopyRawBytes carry_data,1,raw_data_in,1\NoOfBytes:=carry_size;
+            ENDIF
+            IF frame_size>0 THEN
+                CopyRawBytes frame_data,1,raw_data_in,carry_size+1\NoOfBytes:=frame_size;
+            ENDIF
+            carry_size:=0;
 
             read_offset:=1;
             bytes_available:=RawBytesLen(raw_data_in);
@@ -83,7 +142,7 @@ MODULE Networking(SYSMODULE)
 
                     UnpackRawBytes raw_data_in,read_offset,command\Hex1;
 
-                    IF 0=command AND bytes_available>=13 THEN
+                    IF 0=command AND bytes_available>=17 THEN
                         ! Read a position.      
                         UnpackRawBytes raw_data_in\Network,read_offset+1,pkt.x\Float4;
                         UnpackRawBytes raw_data_in\Network,read_offset+5,pkt.y\Float4;
@@ -95,6 +154,7 @@ MODULE Networking(SYSMODULE)
                         packets{pkt_write_dx}.x:=pkt.x;
                         packets{pkt_write_dx}.y:=pkt.y;
                         packets{pkt_write_dx}.z:=pkt.z;
+                        delta_base:=[pkt.x,pkt.y,pkt.z];
                         packets{pkt_write_dx}.rot_z:=pkt.rot_z;
 
                         pkt_write_dx:=pkt_write_dx+1;
@@ -121,8 +181,122 @@ MODULE Networking(SYSMODULE)
                         bytes_available:=bytes_available-9;
                         read_offset:=read_offset+9;
 
+                    ELSEIF 6=command AND bytes_available>=25 THEN
+
+                        ! An arc is stored in two packets: the via point and the end point.
+                        UnpackRawBytes raw_data_in\Network,read_offset+1,pkt.x\Float4;
+                        UnpackRawBytes raw_data_in\Network,read_offset+5,pkt.y\Float4;
+                        UnpackRawBytes raw_data_in\Network,read_offset+9,pkt.z\Float4;
+
+                        packets{pkt_write_dx}.cmd:=6;
+                        packets{pkt_write_dx}.x:=pkt.x;
+                        packets{pkt_write_dx}.y:=pkt.y;
+                        packets{pkt_write_dx}.z:=pkt.z;
+                        packets{pkt_write_dx}.rot_z:=0;
+
+                        pkt_write_dx:=pkt_write_dx+1;
+                        IF pkt_write_dx>500 THEN
+                            pkt_write_dx:=1;
+                        ENDIF
+
+                        UnpackRawBytes raw_data_in\Network,read_offset+13,pkt.x\Float4;
+                        UnpackRawBytes raw_data_in\Network,read_offset+17,pkt.y\Float4;
+                        UnpackRawBytes raw_data_in\Network,read_offset+21,pkt.z\Float4;
+
+                        packets{pkt_write_dx}.cmd:=6;
+                        packets{pkt_write_dx}.x:=pkt.x;
+                        packets{pkt_write_dx}.y:=pkt.y;
+                        packets{pkt_write_dx}.z:=pkt.z;
+                        packets{pkt_write_dx}.rot_z:=0;
+                        delta_base:=[pkt.x,pkt.y,pkt.z];
+
+                        pkt_write_dx:=pkt_write_dx+1;
+                        bytes_available:=bytes_available-25;
+                        read_offset:=read_offset+25;
+
+                        IF pkt_write_dx>500 THEN
+                            pkt_write_dx:=1;
+                        ENDIF
+
+                    ELSEIF 10=command AND bytes_available>=7 THEN
+
+                        ! A position relative to the previous one, in 0.1 mm.
+                        UnpackRawBytes raw_data_in\Network,read_offset+1,delta_value\IntX:=INT;
+                        delta_base.x:=delta_base.x+delta_value/10;
+                        UnpackRawBytes raw_data_in\Network,read_offset+3,delta_value\IntX:=INT;
+                        delta_base.y:=delta_base.y+delta_value/10;
+                        UnpackRawBytes raw_data_in\Network,read_offset+5,delta_value\IntX:=INT;
+                        delta_base.z:=delta_base.z+delta_value/10;
+
+                        packets{pkt_write_dx}.cmd:=0;
+                        packets{pkt_write_dx}.x:=delta_base.x;
+                        packets{pkt_write_dx}.y:=delta_base.y;
+                        packets{pkt_write_dx}.z:=delta_base.z;
+                        packets{pkt_write_dx}.rot_z:=0;
+
+                        pkt_write_dx:=pkt_write_dx+1;
+                        bytes_available:=bytes_available-7;
+                        read_offset:=read_offset+7;
+
+                        IF pkt_write_dx>500 THEN
+                            pkt_write_dx:=1;
+                        ENDIF
+
+                    ELSEIF 7=command AND bytes_available>=2 THEN
+
+                        ! The zone is modal: it's used for all moves till the next zone command.
+                        UnpackRawBytes raw_data_in,read_offset+1,zone_byte\Hex1;
+
+                        packets{pkt_write_dx}.cmd:=7;
+                        packets{pkt_write_dx}.x:=zone_byte;
+                        packets{pkt_write_dx}.y:=0;
+                        packets{pkt_write_dx}.z:=0;
+                        packets{pkt_write_dx}.rot_z:=0;
+
+                        pkt_write_dx:=pkt_write_dx+1;
+                        bytes_available:=bytes_available-2;
+                        read_offset:=read_offset+2;
+
+                        IF pkt_write_dx>500 THEN
+                            pkt_write_dx:=1;
+                        ENDIF
+
+                    ELSEIF 8=command AND bytes_available>=2 THEN
+
+                        UnpackRawBytes raw_data_in,read_offset+1,last_bank\Hex1;
+                        bytes_available:=bytes_available-2;
+                        read_offset:=read_offset+2;
+
+                        ! Hand the bank to FreeWriting and continue with the other bank.
+                        bank_count{write_bank}:=pkt_write_dx-((write_bank-1)*bank_size+1);
+                        bank_ready{write_bank}:=TRUE;
+                        write_bank:=3-write_bank;
+                        pkt_write_dx:=(write_bank-1)*bank_size+1;
+
+                        IF 1=last_bank THEN
+
+                            ! Wait till both banks have been drawn.
+                            setStateDrawing;
+                            waitForBank 0;
+                            write_bank:=1;
+                            pkt_write_dx:=1;
+                            setStateReady;
+
+                        ELSE
+
+                            ! Wait till the bank we write into next has been drawn.
+                            IF bank_ready{write_bank}=TRUE THEN
+                                setStateDrawing;
+                                waitForBank write_bank;
+                            ENDIF
+                            notifyBankFree;
+
+                        ENDIF
+
                     ELSEIF 2=command THEN
-                        ! @todo - not sure if we really need this, probably not.
+                        ! A new message starts.
+                        packets_drawn:=0;
+                        progress_sent:=0;
                         bytes_available:=bytes_available-1;
                         read_offset:=read_offset+1;
                     ELSEIF 3=command THEN
@@ -135,7 +309,7 @@ MODULE Networking(SYSMODULE)
                         has_data:=TRUE;
 
                         ! The main task sets this to true when ready.
-                        WaitUntil drawing_ready;
+                        waitForDrawing;
                         drawing_ready:=FALSE;
 
                         pkt_write_dx:=1;
@@ -157,8 +331,16 @@ MODULE Networking(SYSMODULE)
                         read_offset:=read_offset+1;
                         bytes_available:=bytes_available-1;
 
+                    ELSEIF 0=command OR 1=command OR 6=command OR 7=command OR 8=command OR 10=command THEN
+                        ! The command continues in the next frame; keep its start.
+                        ClearRawBytes carry_data;
+                        CopyRawBytes raw_data_in,read_offset,carry_data,1\NoOfBytes:=bytes_available;
+                        carry_size:=bytes_available;
+                        bytes_available:=0;
+
                     ELSE
                         ! Reset 
+                        notifyError 2;
                         bytes_available:=0;
                         read_offset:=0;
                         ClearRawBytes raw_data_in;
@@ -172,6 +354,8 @@ MODULE Networking(SYSMODULE)
             TPWrite "Socket timeout! @todo handle this error correctly";
         CASE ERR_SOCK_CLOSED:
             TPWrite "ERROR: Socket closed";
+            carry_size:=0;
+            clearBatch;
             SocketClose client_socket;
             SocketClose server_socket;
             checkServerAndClientSockets;
@@ -212,6 +396,138 @@ MODULE Networking(SYSMODULE)
 
     ENDPROC
 
+    ! Closes the connection after a frame we couldn't parse. We forget the partial command and the
+    ! packets of the batch we were receiving, so nothing of the broken stream is drawn.
+    PROC dropClient()
+        carry_size:=0;
+        clearBatch;
+        SocketClose client_socket;
+        SocketClose server_socket;
+        checkServerAndClientSockets;
+    ENDPROC
+
+    ! Removes the packets we stored for the batch (or bank) we're receiving; FreeWriting never got them.
+    PROC clearBatch()
+        VAR num first;
+        first:=(write_bank-1)*bank_size+1;
+        ! Not a FOR loop: it counts down when nothing was stored yet.
+        WHILE pkt_write_dx>first DO
+            pkt_write_dx:=pkt_write_dx-1;
+            packets{pkt_write_dx}:=[0,0,0,0,0];
+        ENDWHILE
+        pkt_write_dx:=first;
+    ENDPROC
+
+    ! Tells the client it can send the next bank; this is not a state so we don't change `state`.
+    PROC notifyBankFree()
+
+        checkServerAndClientSockets;
+
+        IF client_ok<>TRUE OR server_ok<>TRUE THEN
+            RETURN ;
+        ENDIF
+
+        SocketSend client_socket\Str:="b";
+
+    ERROR
+        TEST ERRNO
+        CASE ERR_SOCK_TIMEOUT:
+            TPWrite "Socket timeout! @todo handle this error correctly";
+        CASE ERR_SOCK_CLOSED:
+            TPWrite "ERROR: Socket closed";
+            SocketClose client_socket;
+            SocketClose server_socket;
+            checkServerAndClientSockets;
+            RETRY;
+        DEFAULT:
+            TPWrite "Unhandled error: "\Num:=ERRNO;
+        ENDTEST
+
+    ENDPROC
+
+    ! Tells the client how many packets have been drawn, when that changed since we told it last time.
+    PROC notifyProgress()
+
+        IF packets_drawn=progress_sent THEN
+            RETURN ;
+        ENDIF
+
+        progress_sent:=packets_drawn;
+
+        checkServerAndClientSockets;
+
+        IF client_ok<>TRUE OR server_ok<>TRUE THEN
+            RETURN ;
+        ENDIF
+
+        SocketSend client_socket\Str:="p"+NumToStr(progress_sent,0)+";";
+
+    ERROR
+        TEST ERRNO
+        CASE ERR_SOCK_TIMEOUT:
+            TPWrite "Socket timeout! @todo handle this error correctly";
+        CASE ERR_SOCK_CLOSED:
+            TPWrite "ERROR: Socket closed";
+            SocketClose client_socket;
+            SocketClose server_socket;
+            checkServerAndClientSockets;
+            RETRY;
+        DEFAULT:
+            TPWrite "Unhandled error: "\Num:=ERRNO;
+        ENDTEST
+
+    ENDPROC
+
+    ! Tells the client something went wrong; the codes are documented at `state`.
+    PROC notifyError(num code)
+
+        checkServerAndClientSockets;
+
+        IF client_ok<>TRUE OR server_ok<>TRUE THEN
+            RETURN ;
+        ENDIF
+
+        SocketSend client_socket\Str:="e"+NumToStr(code,0)+";";
+
+    ERROR
+        TEST ERRNO
+        CASE ERR_SOCK_TIMEOUT:
+            TPWrite "Socket timeout! @todo handle this error correctly";
+        CASE ERR_SOCK_CLOSED:
+            TPWrite "ERROR: Socket closed";
+            SocketClose client_socket;
+            SocketClose server_socket;
+            checkServerAndClientSockets;
+            RETRY;
+        DEFAULT:
+            TPWrite "Unhandled error: "\Num:=ERRNO;
+        ENDTEST
+
+    ENDPROC
+
+    ! Waits till FreeWriting is ready with ABB_CMD_DRAW; meanwhile we send the progress.
+    PROC waitForDrawing()
+        WHILE drawing_ready=FALSE DO
+            WaitUntil drawing_ready OR packets_drawn<>progress_sent\PollRate:=progress_rate;
+            notifyProgress;
+        ENDWHILE
+    ENDPROC
+
+    ! Waits till FreeWriting has drawn the given bank, or both banks when `bank` is 0; meanwhile we send the progress.
+    PROC waitForBank(num bank)
+        WHILE isBankBusy(bank) DO
+            WaitUntil isBankBusy(bank)=FALSE OR packets_drawn<>progress_sent\PollRate:=progress_rate;
+            notifyProgress;
+        ENDWHILE
+    ENDPROC
+
+    FUNC bool isBankBusy(num bank)
+        IF bank=0 THEN
+            RETURN bank_ready{1} OR bank_ready{2};
+        ENDIF
+        RETURN bank_ready{bank};
+    ENDFUNC
+
     PROC setStateReady()
         state:="r";
         notifyCurrentState;
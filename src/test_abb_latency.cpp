@@ -0,0 +1,372 @@
+/*
+
+  test_abb_latency
+  ----------------
+
+  Measures the time between the moment the ABB reports that it's ready
+  and the moment the next batch arrives, for a KankerAbbController that
+  runs on the frame loop and for one that uses its own I/O thread.
+
+  We run a fake ABB on localhost: it reads the frames we send, and
+  after each ABB_CMD_DRAW it replies `d`, waits `draw_millis` and
+  replies `r`. The main thread is a frame loop that calls update()
+  every `frame_millis` and writes the next message when the previous
+  one is ready. The first batch of a message is not measured, because
+  it waits for the frame loop in both modes.
+
+  We write one glyph per batch and don't use banks so every glyph is a
+  ready-to-next-send round trip. The settings are written to
+  test_abb_latency.xml with the host and port of the fake ABB.
+
+  Usage: ./test_abb_latency <font.xml> <abb_settings.xml> [frame_millis] [draw_millis]
+
+ */
+#include <kanker/KankerAbbController.h>
+#include <kanker/Thread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#if !defined(_WIN32)
+#  include <netinet/in.h>
+#  include <arpa/inet.h>
+#  include <netinet/tcp.h>
+#endif
+
+#define ROXLU_USE_MATH
+#define ROXLU_USE_LOG
+#define ROXLU_IMPLEMENTATION
+#include <tinylib.h>
+
+#define LATENCY_PORT 21025
+#define LATENCY_SETTINGS_FILE "test_abb_latency.xml"
+#define LATENCY_NUM_MESSAGES 5
+#define LATENCY_MESSAGE "the quick brown fox"
+
+/* ---------------------------------------------------------------------- */
+
+class FakeAbb {
+ public:
+  FakeAbb();
+  int run();                                               /* Accepts one connection and answers until it's closed. */
+  int handleCommands();                                    /* Handles the complete commands in `payload`. */
+  int reply(const char* str);
+
+ public:
+  SOCKET_HANDLE server;
+  SOCKET_HANDLE client;
+  int draw_millis;
+  std::vector<uint8_t> received;                           /* The bytes we didn't parse yet. */
+  std::vector<uint8_t> payload;                            /* The payload of the frames we didn't handle yet. */
+  std::vector<double> gaps;                                /* The measured gaps in microseconds. */
+  uint64_t ready_time;                                     /* When we sent the last `r`, 0 when we don't measure the next batch. */
+  uint64_t batch_time;                                     /* When the first bytes of the current batch arrived. */
+};
+
+class LatencyListener : public KankerAbbListener {
+ public:
+  LatencyListener();
+  void onAbbConnected();
+  void onAbbMessageReady();
+
+ public:
+  bool can_write;
+  int num_ready;
+};
+
+static void fake_abb_thread(void* user);
+static void measure(const char* name, bool useThread, std::string fontFile, int frameMillis, int drawMillis);
+static void close_handle(SOCKET_HANDLE handle);
+
+/* ---------------------------------------------------------------------- */
+
+int main(int argc, char** argv) {
+
+  rx_log_init();
+  socket_init();
+
+  if (3 > argc) {
+    printf("Usage: %s <font.xml> <abb_settings.xml> [frame_millis] [draw_millis]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  int frame_millis = (4 <= argc) ? atoi(argv[3]) : 16;
+  int draw_millis = (5 <= argc) ? atoi(argv[4]) : 5;
+
+  /* Point the settings to our fake ABB; one glyph per batch and no banks. */
+  {
+    KankerAbb abb;
+    if (0 != abb.loadSettings(argv[2])) {
+      RX_ERROR("Failed to load the settings %s", argv[2]);
+      exit(EXIT_FAILURE);
+    }
+
+    abb.abb_host = "127.0.0.1";
+    abb.abb_port = LATENCY_PORT;
+    abb.packer.batch_glyphs = false;
+    abb.packer.use_banks = false;
+
+    if (0 != abb.saveSettings(LATENCY_SETTINGS_FILE)) {
+      RX_ERROR("Failed to save the settings to %s", LATENCY_SETTINGS_FILE);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  printf("frame: %d ms, draw: %d ms, %d messages of \"%s\"\n\n", frame_millis, draw_millis, LATENCY_NUM_MESSAGES, LATENCY_MESSAGE);
+  printf("%-14s %8s %10s %10s %10s %10s %10s\n", "mode", "gaps", "min us", "avg us", "p50 us", "p99 us", "max us");
+
+  measure("frame loop", false, argv[1], frame_millis, draw_millis);
+  measure("I/O thread", true, argv[1], frame_millis, draw_millis);
+
+  socket_shutdown();
+
+  return 0;
+}
+
+static void measure(const char* name, bool useThread, std::string fontFile, int frameMillis, int drawMillis) {
+
+  FakeAbb fake;
+  Thread fake_thread;
+  int one = 1;
+  struct sockaddr_in addr;
+
+  fake.draw_millis = drawMillis;
+  fake.server = socket(AF_INET, SOCK_STREAM, 0);
+  setsockopt(fake.server, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+
+  memset(&addr, 0x00, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(LATENCY_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (0 != bind(fake.server, (struct sockaddr*)&addr, sizeof(addr)) || 0 != listen(fake.server, 1)) {
+    RX_ERROR("Cannot listen on port %d.", LATENCY_PORT);
+    exit(EXIT_FAILURE);
+  }
+
+  if (0 != fake_thread.create(fake_abb_thread, &fake)) {
+    exit(EXIT_FAILURE);
+  }
+
+  {
+    KankerAbbController controller;
+    KankerAbbControllerSettings cfg;
+    LatencyListener listener;
+
+    cfg.font_file = fontFile;
+    cfg.settings_file = LATENCY_SETTINGS_FILE;
+    cfg.use_thread = useThread;
+
+    if (0 != controller.init(cfg, &listener)) {
+      RX_ERROR("Cannot initialize the controller.");
+      exit(EXIT_FAILURE);
+    }
+
+    /* The frame loop of an app. */
+    int num_written = 0;
+    while (listener.num_ready < LATENCY_NUM_MESSAGES) {
+
+      controller.update();
+
+      if (listener.can_write && num_written < LATENCY_NUM_MESSAGES) {
+        listener.can_write = false;
+        controller.writeText(num_written, LATENCY_MESSAGE);
+        num_written++;
+      }
+
+      thread_sleep_millis(frameMillis);
+    }
+
+    controller.shutdown();
+  }
+
+  fake_thread.join();
+  close_handle(fake.server);
+
+  std::vector<double>& gaps = fake.gaps;
+  if (0 == gaps.size()) {
+    printf("%-14s %8d\n", name, 0);
+    return;
+  }
+
+  double sum = 0.0;
+  for (size_t i = 0; i < gaps.size(); ++i) {
+    sum += gaps[i];
+  }
+
+  std::sort(gaps.begin(), gaps.end());
+
+  printf("%-14s %8lu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+         name,
+         gaps.size(),
+         gaps[0],
+         sum / gaps.size(),
+         gaps[gaps.size() / 2],
+         gaps[(gaps.size() * 99) / 100],
+         gaps[gaps.size() - 1]);
+}
+
+/* ---------------------------------------------------------------------- */
+
+FakeAbb::FakeAbb()
+  :server(-1)
+  ,client(-1)
+  ,draw_millis(5)
+  ,ready_time(0)
+  ,batch_time(0)
+{
+}
+
+int FakeAbb::run() {
+
+  char buf[4096];
+
+  client = accept(server, NULL, NULL);
+  if (0 > client) {
+    RX_ERROR("Failed to accept the controller.");
+    return -1;
+  }
+
+  /* The `d` and `r` replies are tiny; without this Nagle holds back the `r` until the `d` is acknowledged. */
+  int one = 1;
+  setsockopt(client, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+
+  while (true) {
+
+    int nread = recv(client, buf, sizeof(buf), 0);
+    if (0 >= nread) {
+      break;
+    }
+
+    if (0 == batch_time) {
+      batch_time = rx_hrtime();
+    }
+
+    received.insert(received.end(), buf, buf + nread);
+
+    /* Collect the payload of the complete frames. */
+    while (ABB_FRAME_HEADER_SIZE <= received.size()) {
+
+      size_t size = (received[1] << 8) | received[2];
+
+      if (ABB_CMD_FRAME != received[0]) {
+        RX_ERROR("Invalid frame.");
+        close_handle(client);
+        return -2;
+      }
+
+      if (received.size() < ABB_FRAME_HEADER_SIZE + size) {
+        break;
+      }
+
+      payload.insert(payload.end(), received.begin() + ABB_FRAME_HEADER_SIZE, received.begin() + ABB_FRAME_HEADER_SIZE + size);
+      received.erase(received.begin(), received.begin() + ABB_FRAME_HEADER_SIZE + size);
+    }
+
+    if (0 != handleCommands()) {
+      close_handle(client);
+      return -3;
+    }
+  }
+
+  close_handle(client);
+
+  return 0;
+}
+
+int FakeAbb::handleCommands() {
+
+  size_t offset = 0;
+
+  while (offset < payload.size()) {
+
+    int size = kanker_abb_get_command_size(&payload[offset], payload.size() - offset);
+    if (0 > size) {
+      break;
+    }
+
+    uint8_t cmd = payload[offset];
+    offset += size;
+
+    switch (cmd) {
+
+      /* A new message; its first batch waits for the frame loop in both modes. */
+      case ABB_CMD_RESET: {
+        ready_time = 0;
+        break;
+      }
+
+      case ABB_CMD_DRAW: {
+
+        if (0 != ready_time) {
+          gaps.push_back(double(batch_time - ready_time) / 1000.0);
+        }
+
+        reply("d");
+        thread_sleep_millis(draw_millis);
+        reply("r");
+
+        ready_time = rx_hrtime();
+        batch_time = 0;
+        break;
+      }
+
+      case ABB_CMD_GET_STATE: {
+        batch_time = 0;
+        break;
+      }
+
+      default: {
+        break;
+      }
+    }
+  }
+
+  payload.erase(payload.begin(), payload.begin() + offset);
+
+  return 0;
+}
+
+int FakeAbb::reply(const char* str) {
+
+  if (0 > send(client, str, strlen(str), 0)) {
+    RX_ERROR("Failed to send the reply.");
+    return -1;
+  }
+
+  return 0;
+}
+
+/* ---------------------------------------------------------------------- */
+
+LatencyListener::LatencyListener()
+  :can_write(false)
+  ,num_ready(0)
+{
+}
+
+void LatencyListener::onAbbConnected() {
+  can_write = true;
+}
+
+void LatencyListener::onAbbMessageReady() {
+  num_ready++;
+  can_write = true;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static void fake_abb_thread(void* user) {
+  FakeAbb* fake = static_cast<FakeAbb*>(user);
+  fake->run();
+}
+
+static void close_handle(SOCKET_HANDLE handle) {
+#if defined(_WIN32)
+  closesocket(handle);
+#else
+  ::close(handle);
+#endif
+}
@@ -0,0 +1,79 @@
+/*
+
+  test_font_load
+  --------------
+
+  Measures how long it takes to load a font and to get the glyphs
+  for a typical message. We compare loading all glyphs from xml,
+  indexing the xml and parsing glyphs on first use and loading a
+  compiled font (when you pass one).
+
+  Usage: ./test_font_load fonts/roxlu.xml [fonts/roxlu.kfnt]
+
+ */
+#include <kanker/KankerFont.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ROXLU_USE_MATH
+#define ROXLU_USE_LOG
+#define ROXLU_IMPLEMENTATION
+#include <tinylib.h>
+
+#define NUM_RUNS 50
+
+static void measure(const char* name, std::string filepath, int mode, const char* message);
+
+int main(int argc, char** argv) {
+
+  rx_log_init();
+
+  if (2 > argc) {
+    printf("Usage: %s <font.xml> [font.kfnt]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  const char* message = "Mijn, mijn, Lieve papa, we denken aan je.";
+
+  measure("xml, eager", argv[1], KANKER_FONT_LOAD_EAGER, NULL);
+  measure("xml, eager + message", argv[1], KANKER_FONT_LOAD_EAGER, message);
+  measure("xml, lazy", argv[1], KANKER_FONT_LOAD_LAZY, NULL);
+  measure("xml, lazy + message", argv[1], KANKER_FONT_LOAD_LAZY, message);
+
+  if (3 == argc) {
+    measure("compiled", argv[2], KANKER_FONT_LOAD_EAGER, NULL);
+    measure("compiled + message", argv[2], KANKER_FONT_LOAD_EAGER, message);
+  }
+
+  return 0;
+}
+
+/* Loads the font NUM_RUNS times and prints the average time; when `message` is given we also get all glyphs we need to write it. */
+static void measure(const char* name, std::string filepath, int mode, const char* message) {
+
+  uint64_t total = 0;
+  size_t num_glyphs = 0;
+
+  for (int i = 0; i < NUM_RUNS; ++i) {
+
+    KankerFont font;
+    uint64_t start = rx_hrtime();
+
+    if (0 != font.load(filepath, mode)) {
+      RX_ERROR("Failed to load %s", filepath.c_str());
+      exit(EXIT_FAILURE);
+    }
+
+    if (NULL != message) {
+      for (size_t j = 0; j < strlen(message); ++j) {
+        font.findGlyph(message[j]);
+      }
+    }
+
+    total += rx_hrtime() - start;
+    num_glyphs = font.size();
+  }
+
+  printf("%-24s %8.3f ms  (%lu glyphs)\n", name, (double(total) / NUM_RUNS) / 1e6, num_glyphs);
+}
@@ -0,0 +1,207 @@
+/*
+
+  test_simplify
+  -------------
+
+  Compares the ways we can simplify the glyphs before sending them to
+  the ABB. For each simplify mode we prepare all glyphs of the font
+  and report the number of points and the number of bytes we send per
+  glyph, and the maximum distance between the original and simplified
+  segments. When you pass an ABB settings file we use its scale,
+  min_point_dist and tolerance.
+
+  Usage: ./test_simplify fonts/roxlu.xml [abb_settings.xml]
+
+ */
+#include <kanker/KankerFont.h>
+#include <kanker/KankerAbb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+
+#define ROXLU_USE_MATH
+#define ROXLU_USE_LOG
+#define ROXLU_IMPLEMENTATION
+#include <tinylib.h>
+
+/* The bytes KankerAbb::packMessage() creates: a position per point, an extra position + IO packet at the start and an IO packet at the end of a segment, one draw command per glyph when we do not batch glyphs. */
+#define POSITION_BYTES 17
+#define IO_BYTES 9
+#define DRAW_BYTES 1
+
+static void measure(const char* name, KankerAbb& abb, KankerFont& font, int mode);
+static float get_max_deviation(KankerGlyph& original, KankerGlyph& simplified);
+static float get_polyline_distance(vec3& p, vec3* points, size_t num);
+
+int main(int argc, char** argv) {
+
+  rx_log_init();
+
+  if (2 > argc) {
+    printf("Usage: %s <font.xml> [abb_settings.xml]\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  KankerFont font;
+  if (0 != font.load(argv[1])) {
+    RX_ERROR("Failed to load %s", argv[1]);
+    exit(EXIT_FAILURE);
+  }
+
+  KankerAbb abb;
+  abb.char_scale = 67;
+  abb.min_point_dist = 5;
+  abb.simplify_tolerance = 1.0f;
+
+  if (3 == argc && 0 != abb.loadSettings(argv[2])) {
+    RX_ERROR("Failed to load the settings %s", argv[2]);
+    exit(EXIT_FAILURE);
+  }
+
+  printf("char_scale: %.2f, min_point_dist: %.2f, tolerance: %.2f\n\n", abb.char_scale, abb.min_point_dist, abb.simplify_tolerance);
+  printf("%-20s %10s %12s %12s %14s %10s\n", "mode", "points", "points/glyph", "bytes/glyph", "max deviation", "time");
+
+  float min_point_dist = abb.min_point_dist;
+
+  measure("none", abb, font, -1);
+  measure("min dist", abb, font, ABB_SIMPLIFY_MIN_DIST);
+  measure("douglas-peucker", abb, font, ABB_SIMPLIFY_DOUGLAS_PEUCKER);
+  measure("visvalingam", abb, font, ABB_SIMPLIFY_VISVALINGAM);
+
+  /* Without merging the points closer then min_point_dist we keep more points; the deviation stays below the tolerance either way. */
+  abb.min_point_dist = 0.0f;
+  measure("douglas-peucker only", abb, font, ABB_SIMPLIFY_DOUGLAS_PEUCKER);
+  measure("visvalingam only", abb, font, ABB_SIMPLIFY_VISVALINGAM);
+  abb.min_point_dist = min_point_dist;
+
+  return 0;
+}
+
+/* Prepares all glyphs with the given mode; with -1 we report the glyphs before simplifying. */
+static void measure(const char* name, KankerAbb& abb, KankerFont& font, int mode) {
+
+  size_t num_glyphs = 0;
+  size_t num_points = 0;
+  size_t num_bytes = 0;
+  float max_deviation = 0.0f;
+
+  if (-1 != mode) {
+    abb.simplify_mode = mode;
+  }
+
+  uint64_t start = rx_hrtime();
+
+  if (0 != abb.updateGlyphCache(font)) {
+    RX_ERROR("Failed to update the glyph cache.");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < font.size(); ++i) {
+
+    KankerGlyph* glyph = font.getGlyphByIndex(i);
+    if (NULL == glyph || 0 == glyph->getNumSegments()) {
+      continue;
+    }
+
+    KankerAbbPreparedGlyph* prepared = abb.getPreparedGlyph(font, glyph->charcode);
+    if (NULL == prepared) {
+      continue;
+    }
+
+    KankerGlyph& simplified = (-1 == mode) ? prepared->glyph : prepared->simplified;
+
+    for (size_t j = 0; j < simplified.getNumSegments(); ++j) {
+      num_points += simplified.getSegmentSize(j);
+      num_bytes += simplified.getSegmentSize(j) * POSITION_BYTES + POSITION_BYTES + 2 * IO_BYTES;
+    }
+
+    num_bytes += DRAW_BYTES;
+    num_glyphs++;
+  }
+
+  uint64_t duration = rx_hrtime() - start;
+
+  for (size_t i = 0; -1 != mode && i < font.size(); ++i) {
+
+    KankerGlyph* glyph = font.getGlyphByIndex(i);
+    if (NULL == glyph || 0 == glyph->getNumSegments()) {
+      continue;
+    }
+
+    KankerAbbPreparedGlyph* prepared = abb.getPreparedGlyph(font, glyph->charcode);
+    if (NULL == prepared) {
+      continue;
+    }
+
+    float dev = get_max_deviation(prepared->glyph, prepared->simplified);
+    if (dev > max_deviation) {
+      max_deviation = dev;
+    }
+  }
+
+  if (0 == num_glyphs) {
+    printf("%-20s no glyphs\n", name);
+    return;
+  }
+
+  printf("%-20s %10lu %12.1f %12.1f %14.3f %7.2f ms\n",
+         name,
+         num_points,
+         float(num_points) / num_glyphs,
+         float(num_bytes) / num_glyphs,
+         max_deviation,
+         double(duration) / 1e6);
+}
+
+/* The largest distance from a point of `original` to the simplified segments; we match segments by their index which is fine as long as no segment was removed completely. */
+static float get_max_deviation(KankerGlyph& original, KankerGlyph& simplified) {
+
+  float max_dist = 0.0f;
+
+  if (original.getNumSegments() != simplified.getNumSegments()) {
+    return 0.0f;
+  }
+
+  for (size_t i = 0; i < original.getNumSegments(); ++i) {
+
+    vec3* points = original.getSegmentPoints(i);
+
+    for (size_t j = 0; j < original.getSegmentSize(i); ++j) {
+      float dist = get_polyline_distance(points[j], simplified.getSegmentPoints(i), simplified.getSegmentSize(i));
+      if (dist > max_dist) {
+        max_dist = dist;
+      }
+    }
+  }
+
+  return max_dist;
+}
+
+static float get_polyline_distance(vec3& p, vec3* points, size_t num) {
+
+  float min_dist = FLT_MAX;
+
+  if (1 == num) {
+    vec3 d = p - points[0];
+    return sqrtf(dot(d, d));
+  }
+
+  for (size_t i = 0; i + 1 < num; ++i) {
+
+    vec3 ab = points[i + 1] - points[i];
+    vec3 ap = p - points[i];
+    float len_sq = dot(ab, ab);
+    float t = (0.0f < len_sq) ? dot(ap, ab) / len_sq : 0.0f;
+
+    t = (t < 0.0f) ? 0.0f : (t > 1.0f) ? 1.0f : t;
+
+    vec3 d = ap - ab * t;
+    float dist = sqrtf(dot(d, d));
+
+    if (dist < min_dist) {
+      min_dist = dist;
+    }
+  }
+
+  return min_dist;
+}
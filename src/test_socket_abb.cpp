@@ -17,7 +17,7 @@
 #define USE_ABB_TEST 1
 
 bool must_run = true;
-static void sighandler(int s);
+static void sighandler(int);
 
 /* ---------------------------------------------------------------------- */
 class AbbListener : public KankerAbbListener {
@@ -61,8 +61,9 @@ int main() {
 
   RX_VERBOSE("Starting socket loop");
 
-  while (true) { 
-    abb.update();
+  /* We sleep until the Abb sends something or a timer is due, so we don't use a core while idle. */
+  while (must_run) { 
+    abb.poll(-1);
   }
 
   socket_shutdown();
@@ -70,7 +71,7 @@ int main() {
   return 0;
 }
 
-static void sighandler(int s) {
+static void sighandler(int) {
   RX_VERBOSE("Got signal.");
   must_run = false;
 }
@@ -130,14 +131,12 @@ void AbbListener::onAbbReadyToDraw() {
       vec3& v = positions[i];
       vec3 p = abb->convertFontPointToAbbPoint(v);
       abb->buffer.writeU8(ABB_CMD_POSITION);
-      abb->buffer.writeFloat(p.x);
-      abb->buffer.writeFloat(p.y);
-      abb->buffer.writeFloat(p.z);
+      abb->buffer.writePosition(p.x, p.y, p.z);
       RX_VERBOSE("Sending: x: %f, y: %f, z: %f", v.x, v.y, v.z);
     }
 
     abb->buffer.writeU8(ABB_CMD_DRAW);
-    abb->sock.send(abb->buffer.ptr(), abb->buffer.size());
+    abb->sendCommands(abb->buffer.ptr(), abb->buffer.size());
     abb->buffer.clear();
   }
 